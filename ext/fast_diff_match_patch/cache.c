@@ -0,0 +1,442 @@
+#include "fast_diff_match_patch.h"
+#include "cache.h"
+#include "diff.h"
+#include "hash.h"
+
+#ifdef HAVE_PTHREAD_H
+#define CACHE_LOCK(cache)       (pthread_mutex_lock(&(cache)->mutex))
+#define CACHE_UNLOCK(cache)     (pthread_mutex_unlock(&(cache)->mutex))
+#else
+#define CACHE_LOCK(cache)
+#define CACHE_UNLOCK(cache)
+#endif
+
+#ifdef RUBY_TYPED_FROZEN_SHAREABLE
+#define CACHE_SHAREABLE         RUBY_TYPED_FROZEN_SHAREABLE
+#else
+#define CACHE_SHAREABLE         0
+#endif
+
+static VALUE cache_initialize(VALUE self, VALUE max_bytes);
+static VALUE cache_lookup(VALUE self, VALUE text1, VALUE text2, VALUE hash1, VALUE hash2, VALUE timeout, VALUE check_lines);
+static VALUE cache_store(int argc, VALUE *argv, VALUE self);
+static VALUE cache_clear(VALUE self);
+static VALUE cache_stats(VALUE self);
+
+static void cache_free(void *data);
+static size_t cache_memsize(const void *data);
+
+static const rb_data_type_t cache_type = {
+    "FastDiffMatchPatch::DiffCache",
+    { NULL, cache_free, cache_memsize, },
+    NULL, NULL, RUBY_TYPED_FREE_IMMEDIATELY | CACHE_SHAREABLE
+};
+
+static VALUE cache_alloc(VALUE klass);
+
+void dmp_init_cache()
+{
+    const VALUE cache_klass = rb_define_class_under(dmp_klass, "DiffCache", rb_cObject);
+
+    rb_define_alloc_func(cache_klass, cache_alloc);
+    rb_define_method(cache_klass, "initialize", RUBY_METHOD_FUNC(cache_initialize), 1);
+    rb_define_method(cache_klass, "lookup", RUBY_METHOD_FUNC(cache_lookup), 6);
+    rb_define_method(cache_klass, "store", RUBY_METHOD_FUNC(cache_store), -1);
+    rb_define_method(cache_klass, "clear", RUBY_METHOD_FUNC(cache_clear), 0);
+    rb_define_method(cache_klass, "stats", RUBY_METHOD_FUNC(cache_stats), 0);
+}
+
+static void cache_free_entries(DMPDiffCache *cache)
+{
+    DMPCacheEntry *entry = cache->newest;
+    DMPCacheEntry *older = NULL;
+
+    while(entry != NULL)
+    {
+        older = entry->older;
+        DMP_NATIVE_FREE(entry);
+        entry = older;
+    }
+
+    memset(cache->buckets, 0, sizeof(DMPCacheEntry *) * (size_t)cache->bucket_count);
+    cache->newest = NULL;
+    cache->oldest = NULL;
+    cache->count  = 0;
+    cache->bytes  = 0;
+}
+
+static void cache_free(void *data)
+{
+    DMPDiffCache *cache = data;
+
+    if(cache->buckets != NULL)
+    {
+        cache_free_entries(cache);
+        DMP_NATIVE_FREE(cache->buckets);
+    }
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_destroy(&cache->mutex);
+#endif
+    xfree(cache);
+}
+
+static size_t cache_memsize(const void *data)
+{
+    const DMPDiffCache *cache = data;
+    return sizeof(DMPDiffCache) + sizeof(DMPCacheEntry *) * (size_t)cache->bucket_count + cache->bytes;
+}
+
+static VALUE cache_alloc(VALUE klass)
+{
+    DMPDiffCache *cache;
+    const VALUE self = TypedData_Make_Struct(klass, DMPDiffCache, &cache_type, cache);
+
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_init(&cache->mutex, NULL);
+#endif
+    cache->bucket_count = DMP_CACHE_BUCKETS;
+    cache->buckets      = DMP_NATIVE_ALLOC_N(DMPCacheEntry *, cache->bucket_count);
+    memset(cache->buckets, 0, sizeof(DMPCacheEntry *) * (size_t)cache->bucket_count);
+
+    return self;
+}
+
+static DMPDiffCache *get_cache(VALUE self)
+{
+    DMPDiffCache *cache;
+
+    TypedData_Get_Struct(self, DMPDiffCache, &cache_type, cache);
+    return cache;
+}
+
+// Keeps at most max_bytes of diff texts and bookkeeping, evicting the least recently used diffs first
+// Ruby equivalent code: DiffCache.new(64 * 1024 * 1024)
+static VALUE cache_initialize(VALUE self, VALUE max_bytes)
+{
+    DMPDiffCache *cache = get_cache(self);
+    const long limit    = NUM2LONG(max_bytes);
+
+    if(limit <= 0)
+    {
+        rb_raise(rb_eArgError, "max_bytes must be positive");
+    }
+
+    cache->max_bytes = (size_t)limit;
+    return self;
+}
+
+// Returns: the key of a diff_main(text1, text2, check_lines) with the given diff_timeout.
+// The content hashes are computed unless given.
+static DMPCacheKey cache_key(VALUE *text1, VALUE *text2, VALUE hash1, VALUE hash2, VALUE timeout, VALUE check_lines)
+{
+    DMPCacheKey key;
+
+    StringValue(*text1);
+    StringValue(*text2);
+
+    memset(&key, 0, sizeof(key));
+    key.hash1       = NIL_P(hash1) ? dmp_content_hash(RSTRING_PTR(*text1), (size_t)RSTRING_LEN(*text1)) : NUM2ULL(hash1);
+    key.hash2       = NIL_P(hash2) ? dmp_content_hash(RSTRING_PTR(*text2), (size_t)RSTRING_LEN(*text2)) : NUM2ULL(hash2);
+    key.bytes1      = RSTRING_LEN(*text1);
+    key.bytes2      = RSTRING_LEN(*text2);
+    key.timeout     = NUM2DBL(timeout);
+    key.encoding    = rb_enc_get_index(*text1);
+    key.check_lines = RTEST(check_lines);
+
+    return key;
+}
+
+// Points the arrays of an entry into the memory allocated after it
+static void entry_layout(DMPCacheEntry *entry)
+{
+    entry->lengths    = (long *)(entry + 1);
+    entry->operations = (signed char *)(entry->lengths + entry->count);
+    entry->text       = (char *)(entry->operations + entry->count);
+}
+
+// All of the functions below are called with the cache mutex held
+
+static DMPCacheEntry **cache_bucket(const DMPDiffCache *cache, uint64_t digest)
+{
+    return &cache->buckets[digest & (uint64_t)(cache->bucket_count - 1)];
+}
+
+static DMPCacheEntry *cache_find(const DMPDiffCache *cache, const DMPCacheKey *key, uint64_t digest)
+{
+    DMPCacheEntry *entry = *cache_bucket(cache, digest);
+
+    while(entry != NULL && (entry->digest != digest || memcmp(&entry->key, key, sizeof(*key)) != 0))
+    {
+        entry = entry->next;
+    }
+
+    return entry;
+}
+
+static void cache_push_newest(DMPDiffCache *cache, DMPCacheEntry *entry)
+{
+    entry->older = cache->newest;
+    entry->newer = NULL;
+
+    if(cache->newest != NULL)
+    {
+        cache->newest->newer = entry;
+    } else {
+        cache->oldest = entry;
+    }
+    cache->newest = entry;
+}
+
+static void cache_unlink_order(DMPDiffCache *cache, DMPCacheEntry *entry)
+{
+    if(entry->newer != NULL)
+    {
+        entry->newer->older = entry->older;
+    } else {
+        cache->newest = entry->older;
+    }
+
+    if(entry->older != NULL)
+    {
+        entry->older->newer = entry->newer;
+    } else {
+        cache->oldest = entry->newer;
+    }
+}
+
+static void cache_remove(DMPDiffCache *cache, DMPCacheEntry *entry)
+{
+    DMPCacheEntry **link = cache_bucket(cache, entry->digest);
+
+    while(*link != entry)
+    {
+        link = &(*link)->next;
+    }
+    *link = entry->next;
+
+    cache_unlink_order(cache, entry);
+    cache->bytes -= entry->size;
+    cache->count--;
+    DMP_NATIVE_FREE(entry);
+}
+
+// Doubles the buckets and spreads the entries over them again
+static void cache_grow(DMPDiffCache *cache)
+{
+    DMPCacheEntry *entry = NULL;
+    DMPCacheEntry **bucket = NULL;
+
+    cache->bucket_count *= 2;
+    cache->buckets       = dmp_native_realloc(cache->buckets, sizeof(DMPCacheEntry *) * (size_t)cache->bucket_count);
+    memset(cache->buckets, 0, sizeof(DMPCacheEntry *) * (size_t)cache->bucket_count);
+
+    for(entry = cache->newest; entry != NULL; entry = entry->older)
+    {
+        bucket      = cache_bucket(cache, entry->digest);
+        entry->next = *bucket;
+        *bucket     = entry;
+    }
+}
+
+static void cache_insert(DMPDiffCache *cache, DMPCacheEntry *entry)
+{
+    DMPCacheEntry *existing = cache_find(cache, &entry->key, entry->digest);
+    DMPCacheEntry **bucket  = NULL;
+
+    if(existing != NULL)
+    {
+        cache_remove(cache, existing);
+    }
+
+    bucket      = cache_bucket(cache, entry->digest);
+    entry->next = *bucket;
+    *bucket     = entry;
+    cache_push_newest(cache, entry);
+    cache->bytes += entry->size;
+    cache->count++;
+
+    while(cache->bytes > cache->max_bytes && cache->oldest != entry)
+    {
+        cache_remove(cache, cache->oldest);
+        cache->evictions++;
+    }
+
+    if(cache->count > cache->bucket_count)
+    {
+        cache_grow(cache);
+    }
+}
+
+// Returns: a copy of the entry of the key marked as most recently used, NULL on a miss
+static DMPCacheEntry *cache_take(DMPDiffCache *cache, const DMPCacheKey *key)
+{
+    const uint64_t digest = dmp_content_hash(key, sizeof(*key));
+    DMPCacheEntry *entry  = NULL;
+    DMPCacheEntry *copy   = NULL;
+
+    CACHE_LOCK(cache);
+    entry = cache_find(cache, key, digest);
+    if(entry != NULL)
+    {
+        cache_unlink_order(cache, entry);
+        cache_push_newest(cache, entry);
+        cache->hits++;
+
+        copy = (DMPCacheEntry *)DMP_NATIVE_ALLOC_N(char, entry->size);
+        memcpy(copy, entry, entry->size);
+    } else {
+        cache->misses++;
+    }
+    CACHE_UNLOCK(cache);
+
+    return copy;
+}
+
+// Returns: new diffs equal to the cached ones of diff_main(text1, text2, check_lines) with the given
+// diff_timeout, nil on a miss. Pass the content_hash of the texts as hash1 and hash2 when known.
+// Ruby equivalent code: @entries[[content_hash(text1), content_hash(text2), ...]]&.map(&:dup)
+static VALUE cache_lookup(VALUE self, VALUE text1, VALUE text2, VALUE hash1, VALUE hash2, VALUE timeout, VALUE check_lines)
+{
+    const DMPCacheKey key = cache_key(&text1, &text2, hash1, hash2, timeout, check_lines);
+    DMPCacheEntry *entry  = cache_take(get_cache(self), &key);
+    rb_encoding *enc      = rb_enc_from_index(key.encoding);
+    VALUE diffs, operation;
+    const char *text;
+    long i;
+
+    if(entry == NULL)
+    {
+        return Qnil;
+    }
+
+    entry_layout(entry);
+    diffs = rb_ary_new_capa(entry->count);
+    text  = entry->text;
+    for(i = 0; i < entry->count; i++)
+    {
+        operation = entry->operations[i] == DMP_DIFF_EQUAL ? dmp_equal_sym :
+                    entry->operations[i] == DMP_DIFF_DELETE ? dmp_delete_sym : dmp_insert_sym;
+        rb_ary_push(diffs, dmp_new_node(operation, rb_enc_str_new(text, entry->lengths[i], enc)));
+        text += entry->lengths[i];
+    }
+    DMP_NATIVE_FREE(entry);
+
+    return diffs;
+}
+
+static signed char diff_operation(VALUE operation)
+{
+    if(operation == dmp_equal_sym)
+    {
+        return DMP_DIFF_EQUAL;
+    } else if(operation == dmp_delete_sym) {
+        return DMP_DIFF_DELETE;
+    } else if(operation == dmp_insert_sym) {
+        return DMP_DIFF_INSERT;
+    }
+
+    rb_raise(rb_eArgError, "invalid diff operation: %"PRIsVALUE, operation);
+    return DMP_DIFF_EQUAL;
+}
+
+// Caches the diffs of diff_main(text1, text2, check_lines) with the given diff_timeout.
+// Diffs larger than max_bytes are not kept.
+// Returns: the diffs
+// Ruby equivalent code: store(text1, text2, hash1, hash2, diff_timeout, check_lines, diffs)
+static VALUE cache_store(int argc, VALUE *argv, VALUE self)
+{
+    DMPDiffCache *cache = get_cache(self);
+    VALUE text1, text2, hash1, hash2, timeout, check_lines, diffs, texts, diff, text;
+    DMPCacheKey key;
+    DMPCacheEntry *entry = NULL;
+    size_t size;
+    long count, i;
+    char *ptr;
+
+    rb_scan_args(argc, argv, "70", &text1, &text2, &hash1, &hash2, &timeout, &check_lines, &diffs);
+    Check_Type(diffs, T_ARRAY);
+
+    key   = cache_key(&text1, &text2, hash1, hash2, timeout, check_lines);
+    count = RARRAY_LEN(diffs);
+    size  = sizeof(DMPCacheEntry) + (sizeof(long) + 1) * (size_t)count;
+    texts = rb_ary_new_capa(count);
+
+    // Texts are stored in the encoding of text1
+    for(i = 0; i < count; i++)
+    {
+        diff = RARRAY_AREF(diffs, i);
+        diff_operation(RSTRUCT_GET(diff, DMP_NODE_OPERATION));
+        text = RSTRUCT_GET(diff, DMP_NODE_TEXT);
+        StringValue(text);
+        text = rb_str_conv_enc(text, rb_enc_get(text), rb_enc_from_index(key.encoding));
+        rb_ary_push(texts, text);
+        size += (size_t)RSTRING_LEN(text);
+    }
+
+    if(size > cache->max_bytes)
+    {
+        return diffs;
+    }
+
+    entry         = (DMPCacheEntry *)DMP_NATIVE_ALLOC_N(char, size);
+    entry->key    = key;
+    entry->digest = dmp_content_hash(&key, sizeof(key));
+    entry->size   = size;
+    entry->count  = count;
+    entry_layout(entry);
+
+    ptr = entry->text;
+    for(i = 0; i < count; i++)
+    {
+        text = RARRAY_AREF(texts, i);
+        entry->operations[i] = diff_operation(RSTRUCT_GET(RARRAY_AREF(diffs, i), DMP_NODE_OPERATION));
+        entry->lengths[i]    = RSTRING_LEN(text);
+        memcpy(ptr, RSTRING_PTR(text), (size_t)RSTRING_LEN(text));
+        ptr += RSTRING_LEN(text);
+    }
+
+    CACHE_LOCK(cache);
+    cache_insert(cache, entry);
+    CACHE_UNLOCK(cache);
+
+    RB_GC_GUARD(texts);
+    return diffs;
+}
+
+static VALUE cache_clear(VALUE self)
+{
+    DMPDiffCache *cache = get_cache(self);
+
+    CACHE_LOCK(cache);
+    cache_free_entries(cache);
+    CACHE_UNLOCK(cache);
+
+    return self;
+}
+
+// Ruby equivalent code: { hits:, misses:, evictions:, entries:, bytes:, max_bytes: }
+static VALUE cache_stats(VALUE self)
+{
+    DMPDiffCache *cache = get_cache(self);
+    const VALUE stats   = rb_hash_new();
+    unsigned long hits, misses, evictions;
+    long count;
+    size_t bytes;
+
+    CACHE_LOCK(cache);
+    hits      = cache->hits;
+    misses    = cache->misses;
+    evictions = cache->evictions;
+    count     = cache->count;
+    bytes     = cache->bytes;
+    CACHE_UNLOCK(cache);
+
+    rb_hash_aset(stats, ID2SYM(rb_intern("hits")), ULONG2NUM(hits));
+    rb_hash_aset(stats, ID2SYM(rb_intern("misses")), ULONG2NUM(misses));
+    rb_hash_aset(stats, ID2SYM(rb_intern("evictions")), ULONG2NUM(evictions));
+    rb_hash_aset(stats, ID2SYM(rb_intern("entries")), LONG2NUM(count));
+    rb_hash_aset(stats, ID2SYM(rb_intern("bytes")), SIZET2NUM(bytes));
+    rb_hash_aset(stats, ID2SYM(rb_intern("max_bytes")), SIZET2NUM(cache->max_bytes));
+
+    return stats;
+}
@@ -0,0 +1,60 @@
+#ifndef FAST_DIFF_MATCH_PATCH_CACHE_H
+#define FAST_DIFF_MATCH_PATCH_CACHE_H
+
+#include <stdint.h>
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+// Buckets of a new cache, doubled whenever the entries outnumber them
+#define DMP_CACHE_BUCKETS       64
+
+// Everything the result of diff_main depends on, zero filled so it can be hashed as bytes
+typedef struct DMPCacheKey
+{
+    uint64_t hash1;         // Ruby equivalent code: content_hash(text1)
+    uint64_t hash2;
+    long bytes1;            // Ruby equivalent code: text1.bytesize
+    long bytes2;
+    double timeout;         // Ruby equivalent code: diff_timeout
+    int encoding;           // Encoding index of text1, the diff texts are stored in it
+    int check_lines;
+} DMPCacheKey;
+
+// One cached diff. The operations, lengths and texts are allocated along with the entry.
+typedef struct DMPCacheEntry
+{
+    DMPCacheKey key;
+    uint64_t digest;                // Hash of the key, picks the bucket
+    struct DMPCacheEntry *next;     // Next entry of the same bucket
+    struct DMPCacheEntry *newer;    // Neighbours in least recently used order
+    struct DMPCacheEntry *older;
+    size_t size;                    // Bytes counted against max_bytes, the entry included
+    long count;                     // Number of diffs
+    long *lengths;                  // Byte length of the text of every diff
+    signed char *operations;        // DMP_DIFF_DELETE, DMP_DIFF_EQUAL or DMP_DIFF_INSERT
+    char *text;                     // Texts of all diffs back to back
+} DMPCacheEntry;
+
+// A FastDiffMatchPatch::DiffCache. Frozen ones are shared between Ractors, so every access takes the mutex.
+typedef struct DMPDiffCache
+{
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_t mutex;
+#endif
+    DMPCacheEntry **buckets;
+    long bucket_count;
+    long count;                     // Number of entries
+    DMPCacheEntry *newest;
+    DMPCacheEntry *oldest;          // Evicted first
+    size_t bytes;                   // Sum of the entry sizes
+    size_t max_bytes;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+} DMPDiffCache;
+
+extern void dmp_init_cache();
+
+#endif //FAST_DIFF_MATCH_PATCH_CACHE_H
@@ -0,0 +1,74 @@
+#include "fast_diff_match_patch.h"
+#include "cancel.h"
+
+static VALUE token_cancel(VALUE self);
+static VALUE token_cancelled_p(VALUE self);
+
+static size_t token_memsize(const void *data);
+
+static const rb_data_type_t token_type = {
+    "FastDiffMatchPatch::CancellationToken",
+    { NULL, RUBY_TYPED_DEFAULT_FREE, token_memsize, },
+    NULL, NULL, RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+static VALUE token_alloc(VALUE klass);
+
+void dmp_init_cancel()
+{
+    const VALUE token_klass = rb_define_class_under(dmp_klass, "CancellationToken", rb_cObject);
+
+    dmp_cancelled_klass = rb_define_class_under(dmp_klass, "Cancelled", rb_eStandardError);
+
+    rb_define_alloc_func(token_klass, token_alloc);
+    rb_define_method(token_klass, "cancel", RUBY_METHOD_FUNC(token_cancel), 0);
+    rb_define_method(token_klass, "cancelled?", RUBY_METHOD_FUNC(token_cancelled_p), 0);
+}
+
+static size_t token_memsize(const void *data)
+{
+    return sizeof(DMPCancellationToken);
+}
+
+static VALUE token_alloc(VALUE klass)
+{
+    DMPCancellationToken *token;
+
+    return TypedData_Make_Struct(klass, DMPCancellationToken, &token_type, token);
+}
+
+// Stops every diff and patch_apply the token was passed to, from any thread.
+// Running native searches give up on their next iteration and raise Cancelled.
+static VALUE token_cancel(VALUE self)
+{
+    DMPCancellationToken *token;
+
+    TypedData_Get_Struct(self, DMPCancellationToken, &token_type, token);
+    token->cancelled = true;
+
+    return self;
+}
+
+static VALUE token_cancelled_p(VALUE self)
+{
+    DMPCancellationToken *token;
+
+    TypedData_Get_Struct(self, DMPCancellationToken, &token_type, token);
+
+    return token->cancelled ? Qtrue : Qfalse;
+}
+
+// Returns: the flag polled by native code, NULL for a nil token
+const volatile bool *dmp_cancel_token(VALUE token)
+{
+    DMPCancellationToken *data;
+
+    if(NIL_P(token))
+    {
+        return NULL;
+    }
+
+    TypedData_Get_Struct(token, DMPCancellationToken, &token_type, data);
+
+    return &data->cancelled;
+}
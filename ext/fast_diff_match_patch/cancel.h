@@ -0,0 +1,13 @@
+#ifndef FAST_DIFF_MATCH_PATCH_CANCEL_H
+#define FAST_DIFF_MATCH_PATCH_CANCEL_H
+
+// Flag of a FastDiffMatchPatch::CancellationToken, read by native code without the GVL
+typedef struct DMPCancellationToken
+{
+    volatile bool cancelled;
+} DMPCancellationToken;
+
+extern void dmp_init_cancel();
+extern const volatile bool *dmp_cancel_token(VALUE token);
+
+#endif //FAST_DIFF_MATCH_PATCH_CANCEL_H
@@ -0,0 +1,735 @@
+#include "fast_diff_match_patch.h"
+#include "compose.h"
+
+static VALUE patch_compose(VALUE self, VALUE first, VALUE second);
+static VALUE patch_transform(VALUE self, VALUE first, VALUE second);
+static VALUE patch_invert(VALUE self, VALUE patches);
+
+void dmp_init_compose()
+{
+    rb_define_method(dmp_klass, "patch_compose", RUBY_METHOD_FUNC(patch_compose), 2);
+    rb_define_method(dmp_klass, "patch_transform", RUBY_METHOD_FUNC(patch_transform), 2);
+    rb_define_method(dmp_klass, "patch_invert", RUBY_METHOD_FUNC(patch_invert), 1);
+}
+
+// Combines the edit streams of two lists into a third one
+typedef void (*dmp_stream_merge)(const DMPEditStream *first, const DMPEditStream *second, DMPEditStream *merged);
+
+// Streams of a patch_compose, patch_transform or patch_invert call, released by compose_cleanup even when an argument raises
+typedef struct DMPComposeArgs
+{
+    VALUE self;
+    VALUE first;
+    VALUE second;
+    dmp_stream_merge merge;
+    DMPEditStream streams[5];
+} DMPComposeArgs;
+
+static void stream_free(DMPEditStream *stream)
+{
+    long i;
+
+    for(i = 0; i < stream->buffer_count; i++)
+    {
+        xfree(stream->buffers[i]);
+    }
+    xfree(stream->buffers);
+    xfree(stream->ops);
+}
+
+static void stream_push(DMPEditStream *stream, int operation, long length, const long *chars)
+{
+    if(length == 0)
+    {
+        return;
+    }
+
+    if(stream->count == stream->capa)
+    {
+        stream->capa = stream->capa == 0 ? 16 : stream->capa * 2;
+        REALLOC_N(stream->ops, DMPEditOp, stream->capa);
+    }
+
+    stream->ops[stream->count].operation = operation;
+    stream->ops[stream->count].length    = length;
+    stream->ops[stream->count].chars     = chars;
+    stream->count++;
+}
+
+// Hand a codepoint buffer over to the stream, it's freed along with it
+static long *stream_own(DMPEditStream *stream, long *buffer)
+{
+    if(stream->buffer_count == stream->buffer_capa)
+    {
+        stream->buffer_capa = stream->buffer_capa == 0 ? 16 : stream->buffer_capa * 2;
+        REALLOC_N(stream->buffers, long *, stream->buffer_capa);
+    }
+
+    stream->buffers[stream->buffer_count++] = buffer;
+    return buffer;
+}
+
+static int node_operation(VALUE diff)
+{
+    const VALUE operation = RSTRUCT_GET(diff, DMP_NODE_OPERATION);
+
+    if(operation == dmp_insert_sym) return DMP_DIFF_INSERT;
+    if(operation == dmp_delete_sym) return DMP_DIFF_DELETE;
+    return DMP_DIFF_EQUAL;
+}
+
+// Push a DiffNode onto the stream, without its first skip characters
+// Returns: the number of characters of the node
+static long stream_push_node(DMPEditStream *stream, VALUE diff, long skip)
+{
+    VALUE text = RSTRUCT_GET(diff, DMP_NODE_TEXT);
+    const int operation = node_operation(diff);
+    DMPString chars;
+
+    StringValue(text);
+    if(stream->enc == NULL || (stream->ascii_only && !rb_enc_str_asciionly_p(text)))
+    {
+        stream->enc        = rb_enc_get(text);
+        stream->ascii_only = rb_enc_str_asciionly_p(text);
+    }
+
+    chars = rb_str_to_dmp_chars(text);
+    stream_own(stream, chars.chars);
+    skip = DMP_MIN(skip, (long)chars.size);
+    stream_push(stream, operation, (long)chars.size - skip, chars.chars + skip);
+
+    return chars.size;
+}
+
+static void diffs_to_stream(VALUE diffs, DMPEditStream *stream)
+{
+    long i;
+
+    for(i = 0; i < RARRAY_LEN(diffs); i++)
+    {
+        dmp_check_node(RARRAY_AREF(diffs, i));
+        stream_push_node(stream, RARRAY_AREF(diffs, i), 0);
+    }
+
+    stream_push(stream, DMP_DIFF_EQUAL, DMP_EDIT_REST, NULL);
+}
+
+// Each patch of a list starts at start2 in the text the earlier patches of the list were applied to.
+// The text up to there is retained. Where the patch overlaps the previous one, it takes over
+// the trailing context of the previous patch and skips its own leading context.
+static void patches_to_stream(VALUE patches, DMPEditStream *stream)
+{
+    long position = 0; // Where the stream ends in the text the earlier patches produced
+    long i, j;
+
+    for(i = 0; i < RARRAY_LEN(patches); i++)
+    {
+        const VALUE patch = RARRAY_AREF(patches, i);
+
+        dmp_check_patch(patch);
+
+        const VALUE diffs   = RSTRUCT_GET(patch, DMP_PATCH_DIFFS);
+        const long start2   = NUM2LONG(RSTRUCT_GET(patch, DMP_PATCH_START2));
+        const long previous = position;
+        long skip           = position - start2;
+
+        Check_Type(diffs, T_ARRAY);
+        if(skip < 0)
+        {
+            stream_push(stream, DMP_DIFF_EQUAL, -skip, NULL);
+            position = start2;
+            skip     = 0;
+        }
+
+        // Ruby equivalent code: patch_split_max(patches) ends a patch with context the next one edits
+        while(skip > 0 && stream->count > 0 && stream->ops[stream->count - 1].operation == DMP_DIFF_EQUAL)
+        {
+            DMPEditOp *last   = &stream->ops[stream->count - 1];
+            const long length = DMP_MIN(skip, last->length);
+
+            last->length -= length;
+            position     -= length;
+            skip         -= length;
+            if(last->length == 0) stream->count--;
+        }
+
+        for(j = 0; j < RARRAY_LEN(diffs); j++)
+        {
+            const VALUE diff = RARRAY_AREF(diffs, j);
+            long length, skipped;
+
+            dmp_check_node(diff);
+            const int operation = node_operation(diff);
+
+            if(skip > 0 && operation != DMP_DIFF_EQUAL)
+            {
+                rb_raise(rb_eArgError, "Patches overlap at character %ld", position);
+            }
+
+            length  = stream_push_node(stream, diff, skip);
+            skipped = DMP_MIN(skip, length);
+            skip   -= skipped;
+
+            if(operation != DMP_DIFF_DELETE)
+            {
+                position += length - skipped;
+            }
+        }
+
+        // The context taken over from the previous patch reached further than this patch
+        if(position < previous)
+        {
+            stream_push(stream, DMP_DIFF_EQUAL, previous - position, NULL);
+            position = previous;
+        }
+    }
+
+    stream_push(stream, DMP_DIFF_EQUAL, DMP_EDIT_REST, NULL);
+}
+
+static void edit_op_advance(DMPEditOp *op, long count)
+{
+    if(op->length == DMP_EDIT_REST)
+    {
+        return;
+    }
+
+    op->length -= count;
+    if(op->chars != NULL)
+    {
+        op->chars += count;
+    }
+}
+
+// Merge two edit streams, the second one editing the text the first one produces.
+// Text inserted by the first stream and deleted by the second one cancels out.
+static void compose_streams(const DMPEditStream *first, const DMPEditStream *second, DMPEditStream *composed)
+{
+    long i         = 0;
+    long j         = 0;
+    DMPEditOp a    = first->ops[0];
+    DMPEditOp b    = second->ops[0];
+    long length;
+
+    while(true)
+    {
+        if(a.operation == DMP_DIFF_DELETE)
+        {
+            stream_push(composed, DMP_DIFF_DELETE, a.length, a.chars);
+            a = first->ops[++i];
+            continue;
+        }
+
+        if(b.operation == DMP_DIFF_INSERT)
+        {
+            stream_push(composed, DMP_DIFF_INSERT, b.length, b.chars);
+            b = second->ops[++j];
+            continue;
+        }
+
+        if(a.length == DMP_EDIT_REST && b.length == DMP_EDIT_REST)
+        {
+            stream_push(composed, DMP_DIFF_EQUAL, DMP_EDIT_REST, NULL);
+            break;
+        }
+
+        // Text produced by the first stream and consumed by the second one
+        length = DMP_MIN(a.length, b.length);
+        if(a.operation == DMP_DIFF_EQUAL)
+        {
+            if(b.operation == DMP_DIFF_EQUAL)
+            {
+                stream_push(composed, DMP_DIFF_EQUAL, length, a.chars != NULL ? a.chars : b.chars);
+            } else {
+                stream_push(composed, DMP_DIFF_DELETE, length, b.chars);
+            }
+        } else if(b.operation == DMP_DIFF_EQUAL) {
+            stream_push(composed, DMP_DIFF_INSERT, length, a.chars);
+        }
+
+        edit_op_advance(&a, length);
+        edit_op_advance(&b, length);
+        if(a.length == 0) a = first->ops[++i];
+        if(b.length == 0) b = second->ops[++j];
+    }
+}
+
+// Rewrite the second edit stream to apply to the text the first one produces, both editing the same text.
+// Text inserted by the first stream is retained, text it deletes is no longer edited.
+// Insertions at the same location keep the text of the first stream ahead.
+static void transform_streams(const DMPEditStream *first, const DMPEditStream *second, DMPEditStream *transformed)
+{
+    long i         = 0;
+    long j         = 0;
+    DMPEditOp a    = first->ops[0];
+    DMPEditOp b    = second->ops[0];
+    long length;
+
+    while(true)
+    {
+        if(a.operation == DMP_DIFF_INSERT)
+        {
+            stream_push(transformed, DMP_DIFF_EQUAL, a.length, a.chars);
+            a = first->ops[++i];
+            continue;
+        }
+
+        if(b.operation == DMP_DIFF_INSERT)
+        {
+            stream_push(transformed, DMP_DIFF_INSERT, b.length, b.chars);
+            b = second->ops[++j];
+            continue;
+        }
+
+        if(a.length == DMP_EDIT_REST && b.length == DMP_EDIT_REST)
+        {
+            stream_push(transformed, DMP_DIFF_EQUAL, DMP_EDIT_REST, NULL);
+            break;
+        }
+
+        // Text of the original both streams consume
+        length = DMP_MIN(a.length, b.length);
+        if(a.operation == DMP_DIFF_EQUAL)
+        {
+            if(b.operation == DMP_DIFF_EQUAL)
+            {
+                stream_push(transformed, DMP_DIFF_EQUAL, length, a.chars != NULL ? a.chars : b.chars);
+            } else {
+                stream_push(transformed, DMP_DIFF_DELETE, length, b.chars);
+            }
+        }
+
+        edit_op_advance(&a, length);
+        edit_op_advance(&b, length);
+        if(a.length == 0) a = first->ops[++i];
+        if(b.length == 0) b = second->ops[++j];
+    }
+}
+
+// Concatenate the texts of the ops with the given operation
+static const long *stream_join(DMPEditStream *stream, const DMPEditOp *ops, long count, int operation, long length)
+{
+    long *chars  = stream_own(stream, ALLOC_N(long, (size_t)length));
+    long offset  = 0;
+    long i;
+
+    for(i = 0; i < count; i++)
+    {
+        if(ops[i].operation == operation)
+        {
+            MEMCPY(chars + offset, ops[i].chars, long, ops[i].length);
+            offset += ops[i].length;
+        }
+    }
+
+    return chars;
+}
+
+// Reduce every run of edits to a single deletion and insertion, factoring out their common text.
+// Ruby equivalent code: diff_cleanup_merge(diffs) without the sliding of single edits
+static void stream_merge_edits(DMPEditStream *stream, DMPEditStream *merged)
+{
+    long i = 0;
+    long end, deleted, inserted, prefix, suffix;
+    const long *deletion, *insertion;
+
+    while(i < stream->count)
+    {
+        if(stream->ops[i].operation == DMP_DIFF_EQUAL)
+        {
+            stream_push(merged, DMP_DIFF_EQUAL, stream->ops[i].length, stream->ops[i].chars);
+            i++;
+            continue;
+        }
+
+        deleted  = 0;
+        inserted = 0;
+        for(end = i; end < stream->count && stream->ops[end].operation != DMP_DIFF_EQUAL; end++)
+        {
+            if(stream->ops[end].operation == DMP_DIFF_DELETE)
+            {
+                deleted += stream->ops[end].length;
+            } else {
+                inserted += stream->ops[end].length;
+            }
+        }
+
+        deletion  = stream_join(merged, stream->ops + i, end - i, DMP_DIFF_DELETE, deleted);
+        insertion = stream_join(merged, stream->ops + i, end - i, DMP_DIFF_INSERT, inserted);
+
+        // Factor out any common prefixes and suffixes.
+        prefix = 0;
+        while(prefix < deleted && prefix < inserted && deletion[prefix] == insertion[prefix])
+        {
+            prefix++;
+        }
+
+        suffix = 0;
+        while(suffix < deleted - prefix && suffix < inserted - prefix &&
+              deletion[deleted - suffix - 1] == insertion[inserted - suffix - 1])
+        {
+            suffix++;
+        }
+
+        stream_push(merged, DMP_DIFF_EQUAL, prefix, deletion);
+        stream_push(merged, DMP_DIFF_DELETE, deleted - prefix - suffix, deletion + prefix);
+        stream_push(merged, DMP_DIFF_INSERT, inserted - prefix - suffix, insertion + prefix);
+        stream_push(merged, DMP_DIFF_EQUAL, suffix, deletion + deleted - suffix);
+        i = end;
+    }
+}
+
+// Join adjacent equalities whose text is known, and adjacent ones whose text isn't
+static void stream_merge_equalities(DMPEditStream *stream, DMPEditStream *merged)
+{
+    long i = 0;
+    long end, length;
+    bool known;
+
+    while(i < stream->count)
+    {
+        const DMPEditOp *op = &stream->ops[i];
+
+        if(op->operation != DMP_DIFF_EQUAL || op->length == DMP_EDIT_REST)
+        {
+            stream_push(merged, op->operation, op->length, op->chars);
+            i++;
+            continue;
+        }
+
+        known  = op->chars != NULL;
+        length = 0;
+        for(end = i; end < stream->count && stream->ops[end].operation == DMP_DIFF_EQUAL &&
+            stream->ops[end].length != DMP_EDIT_REST && (stream->ops[end].chars != NULL) == known; end++)
+        {
+            length += stream->ops[end].length;
+        }
+
+        stream_push(merged, DMP_DIFF_EQUAL, length,
+                    !known ? NULL : end - i == 1 ? op->chars : stream_join(merged, op, end - i, DMP_DIFF_EQUAL, length));
+        i = end;
+    }
+}
+
+static VALUE edit_op_node(const DMPEditOp *op, long offset, long length, rb_encoding *enc)
+{
+    const VALUE operation = op->operation == DMP_DIFF_INSERT ? dmp_insert_sym :
+                            op->operation == DMP_DIFF_DELETE ? dmp_delete_sym : dmp_equal_sym;
+
+    return dmp_new_node(operation, dmp_chars_to_rb_str(op->chars + offset, length, enc));
+}
+
+static VALUE stream_to_diffs(const DMPEditStream *stream, rb_encoding *enc)
+{
+    const VALUE diffs = rb_ary_new_capa(stream->count);
+    long i;
+
+    for(i = 0; i < stream->count; i++)
+    {
+        if(stream->ops[i].chars != NULL)
+        {
+            rb_ary_push(diffs, edit_op_node(&stream->ops[i], 0, stream->ops[i].length, enc));
+        }
+    }
+
+    return diffs;
+}
+
+// Group the edits into patches with up to patch_margin characters of the known context around them.
+// Same layout as patch_make: start1 and start2 are locations in the text the earlier patches produced.
+static VALUE stream_to_patches(const DMPEditStream *stream, long margin, rb_encoding *enc)
+{
+    const VALUE patches = rb_ary_new();
+    VALUE diffs         = Qnil;
+    long position       = 0;
+    long start          = 0;
+    long length1        = 0;
+    long length2        = 0;
+    long context, i;
+
+    for(i = 0; i < stream->count; i++)
+    {
+        const DMPEditOp *op = &stream->ops[i];
+
+        if(op->operation != DMP_DIFF_EQUAL)
+        {
+            if(NIL_P(diffs))
+            {
+                // A new patch, with the tail of the previous equality as context
+                const DMPEditOp *previous = i > 0 ? &stream->ops[i - 1] : NULL;
+
+                diffs   = rb_ary_new();
+                context = previous != NULL && previous->chars != NULL ? DMP_MIN(margin, previous->length) : 0;
+                if(context > 0)
+                {
+                    rb_ary_push(diffs, edit_op_node(previous, previous->length - context, context, enc));
+                }
+                start   = position - context;
+                length1 = context;
+                length2 = context;
+            }
+
+            rb_ary_push(diffs, edit_op_node(op, 0, op->length, enc));
+            if(op->operation == DMP_DIFF_DELETE)
+            {
+                length1 += op->length;
+            } else {
+                length2  += op->length;
+                position += op->length;
+            }
+            continue;
+        }
+
+        if(!NIL_P(diffs))
+        {
+            if(op->chars != NULL && op->length < 2 * margin &&
+               i + 1 < stream->count && stream->ops[i + 1].operation != DMP_DIFF_EQUAL)
+            {
+                // Small equality inside a patch.
+                rb_ary_push(diffs, edit_op_node(op, 0, op->length, enc));
+                length1 += op->length;
+                length2 += op->length;
+            } else {
+                // Time for a new patch.
+                context = op->chars != NULL ? DMP_MIN(margin, op->length) : 0;
+                if(context > 0)
+                {
+                    rb_ary_push(diffs, edit_op_node(op, 0, context, enc));
+                }
+                rb_ary_push(patches, dmp_new_patch(diffs, start, start, length1 + context, length2 + context));
+                diffs = Qnil;
+            }
+        }
+
+        if(op->length != DMP_EDIT_REST)
+        {
+            position += op->length;
+        }
+    }
+
+    return patches;
+}
+
+// Returns: whether the list holds DiffNodes rather than patches
+static bool diff_list_p(VALUE list)
+{
+    return RARRAY_LEN(list) > 0 && RTEST(rb_obj_is_kind_of(RARRAY_AREF(list, 0), dmp_diff_node_klass));
+}
+
+// Returns: the encoding of the non ASCII texts of the streams
+static rb_encoding *compose_encoding(const DMPEditStream *first, const DMPEditStream *second)
+{
+    if(first->enc != NULL && (!first->ascii_only || second->enc == NULL || second->ascii_only))
+    {
+        return first->enc;
+    }
+
+    return second->enc != NULL ? second->enc : rb_utf8_encoding();
+}
+
+static VALUE compose_body(VALUE data)
+{
+    DMPComposeArgs *args = (DMPComposeArgs *)data;
+    const bool diffs     = diff_list_p(args->first) || diff_list_p(args->second);
+    rb_encoding *enc;
+
+    if(diffs)
+    {
+        if((RARRAY_LEN(args->first) > 0 && !diff_list_p(args->first)) ||
+           (RARRAY_LEN(args->second) > 0 && !diff_list_p(args->second)))
+        {
+            rb_raise(rb_eArgError, "Can't combine a diff list with a patch list");
+        }
+
+        diffs_to_stream(args->first, &args->streams[0]);
+        diffs_to_stream(args->second, &args->streams[1]);
+    } else {
+        patches_to_stream(args->first, &args->streams[0]);
+        patches_to_stream(args->second, &args->streams[1]);
+    }
+
+    args->merge(&args->streams[0], &args->streams[1], &args->streams[2]);
+    stream_merge_edits(&args->streams[2], &args->streams[3]);
+    stream_merge_equalities(&args->streams[3], &args->streams[4]);
+
+    enc = compose_encoding(&args->streams[0], &args->streams[1]);
+
+    if(diffs)
+    {
+        return stream_to_diffs(&args->streams[4], enc);
+    }
+
+    return stream_to_patches(&args->streams[4], NUM2LONG(rb_iv_get(args->self, "@patch_margin")), enc);
+}
+
+static VALUE compose_cleanup(VALUE data)
+{
+    DMPComposeArgs *args = (DMPComposeArgs *)data;
+    int i;
+
+    for(i = 0; i < 5; i++)
+    {
+        stream_free(&args->streams[i]);
+    }
+
+    return Qnil;
+}
+
+static VALUE merge_lists(VALUE self, VALUE first, VALUE second, dmp_stream_merge merge)
+{
+    DMPComposeArgs args;
+
+    Check_Type(first, T_ARRAY);
+    Check_Type(second, T_ARRAY);
+
+    MEMZERO(&args, DMPComposeArgs, 1);
+    args.self   = self;
+    args.first  = first;
+    args.second = second;
+    args.merge  = merge;
+
+    return rb_ensure(compose_body, (VALUE)&args, compose_cleanup, (VALUE)&args);
+}
+
+// Compose two patch lists, or two diff lists, into one: the result makes the edits of first
+// followed by those of second. Only the edits and their context are walked, never the whole text.
+// Ruby equivalent code: patch_make(text1, patch_apply(second, patch_apply(first, text1)[0])[0])
+static VALUE patch_compose(VALUE self, VALUE first, VALUE second)
+{
+    return merge_lists(self, first, second, compose_streams);
+}
+
+// Rebase second onto first, two patch lists or diff lists made against the same text.
+// The result makes the edits of second to the text first produces, so patch_apply finds
+// every patch at its expected location unless both lists edit the same text.
+static VALUE patch_transform(VALUE self, VALUE first, VALUE second)
+{
+    return merge_lists(self, first, second, transform_streams);
+}
+
+// Returns: whether a patch shares context with the edits of the previous one.
+// Each of them is then only found in the text the previous patch produced.
+static bool patches_overlap(VALUE patches)
+{
+    long end = 0; // End of the previous patch in the text it produced
+    long i, start2;
+
+    for(i = 0; i < RARRAY_LEN(patches); i++)
+    {
+        const VALUE patch = RARRAY_AREF(patches, i);
+
+        dmp_check_patch(patch);
+        start2 = NUM2LONG(RSTRUCT_GET(patch, DMP_PATCH_START2));
+        if(i > 0 && start2 < end)
+        {
+            return true;
+        }
+        end = start2 + NUM2LONG(RSTRUCT_GET(patch, DMP_PATCH_LENGTH2));
+    }
+
+    return false;
+}
+
+// Push the inverse of the diffs in [from, to) with the given operation
+static void push_inverted(VALUE inverted, VALUE diffs, long from, long to, int operation)
+{
+    const VALUE symbol = operation == DMP_DIFF_INSERT ? dmp_delete_sym :
+                         operation == DMP_DIFF_DELETE ? dmp_insert_sym : dmp_equal_sym;
+    long i;
+
+    for(i = from; i < to; i++)
+    {
+        if(node_operation(RARRAY_AREF(diffs, i)) == operation)
+        {
+            rb_ary_push(inverted, dmp_new_node(symbol, rb_str_dup(RSTRUCT_GET(RARRAY_AREF(diffs, i), DMP_NODE_TEXT))));
+        }
+    }
+}
+
+static VALUE invert_body(VALUE data)
+{
+    DMPComposeArgs *args  = (DMPComposeArgs *)data;
+    DMPEditStream *stream = &args->streams[0];
+    long i;
+
+    patches_to_stream(args->first, stream);
+    // Swaps DMP_DIFF_INSERT and DMP_DIFF_DELETE
+    for(i = 0; i < stream->count; i++)
+    {
+        stream->ops[i].operation = -stream->ops[i].operation;
+    }
+
+    stream_merge_edits(stream, &args->streams[1]);
+    stream_merge_equalities(&args->streams[1], &args->streams[2]);
+
+    return stream_to_patches(&args->streams[2], NUM2LONG(rb_iv_get(args->self, "@patch_margin")),
+                             compose_encoding(stream, &args->streams[3]));
+}
+
+// Build the patches which revert a patch list, applied in the same order to the text it produced.
+// Insertions and deletions swap, and so do the two sides of every patch. A patch starts at start2
+// in the text with the earlier inverted patches applied, which is the text they were made against.
+// Patches sharing context with their neighbours are regrouped from the edit stream instead,
+// as that context isn't in the text once the previous patch is reverted.
+// Ruby equivalent code: patch_make(patch_apply(patches, text)[0], text)
+static VALUE patch_invert(VALUE self, VALUE patches)
+{
+    Check_Type(patches, T_ARRAY);
+
+    if(patches_overlap(patches))
+    {
+        DMPComposeArgs args;
+
+        MEMZERO(&args, DMPComposeArgs, 1);
+        args.self  = self;
+        args.first = patches;
+
+        return rb_ensure(invert_body, (VALUE)&args, compose_cleanup, (VALUE)&args);
+    }
+
+    const VALUE inverted = rb_ary_new_capa(RARRAY_LEN(patches));
+    long growth          = 0; // Length difference of the earlier patches
+    long i, j, end;
+
+    for(i = 0; i < RARRAY_LEN(patches); i++)
+    {
+        const VALUE patch  = RARRAY_AREF(patches, i);
+        const VALUE diffs  = RSTRUCT_GET(patch, DMP_PATCH_DIFFS);
+        const long start2  = NUM2LONG(RSTRUCT_GET(patch, DMP_PATCH_START2));
+        const long length1 = NUM2LONG(RSTRUCT_GET(patch, DMP_PATCH_LENGTH1));
+        const long length2 = NUM2LONG(RSTRUCT_GET(patch, DMP_PATCH_LENGTH2));
+        VALUE reverted;
+
+        Check_Type(diffs, T_ARRAY);
+        reverted = rb_ary_new_capa(RARRAY_LEN(diffs));
+
+        for(j = 0; j < RARRAY_LEN(diffs); j++)
+        {
+            dmp_check_node(RARRAY_AREF(diffs, j));
+        }
+
+        // Within every run of edits the deletions, the former insertions, go first like diff_cleanup_merge leaves them
+        for(j = 0; j < RARRAY_LEN(diffs); j = end)
+        {
+            end = j + 1;
+            if(node_operation(RARRAY_AREF(diffs, j)) == DMP_DIFF_EQUAL)
+            {
+                push_inverted(reverted, diffs, j, end, DMP_DIFF_EQUAL);
+                continue;
+            }
+
+            while(end < RARRAY_LEN(diffs) && node_operation(RARRAY_AREF(diffs, end)) != DMP_DIFF_EQUAL)
+            {
+                end++;
+            }
+
+            push_inverted(reverted, diffs, j, end, DMP_DIFF_INSERT);
+            push_inverted(reverted, diffs, j, end, DMP_DIFF_DELETE);
+        }
+
+        rb_ary_push(inverted, dmp_new_patch(reverted, start2, start2 - growth, length2, length1));
+        growth += length2 - length1;
+    }
+
+    return inverted;
+}
@@ -0,0 +1,33 @@
+#ifndef FAST_DIFF_MATCH_PATCH_COMPOSE_H
+#define FAST_DIFF_MATCH_PATCH_COMPOSE_H
+
+#include "diff.h"
+
+// Length of the equality ending every edit stream, it retains the rest of the text
+#define DMP_EDIT_REST           LONG_MAX
+
+// One operation of an edit stream.
+// The text between patches isn't part of them, equalities over it have no chars.
+typedef struct DMPEditOp
+{
+    int operation;      // DMP_DIFF_*
+    long length;
+    const long *chars;  // NULL when the text is unknown
+} DMPEditOp;
+
+// The operations of a patch list or diff list over its whole source text
+typedef struct DMPEditStream
+{
+    DMPEditOp *ops;
+    long count;
+    long capa;
+    long **buffers;     // Codepoint buffers owned by the stream
+    long buffer_count;
+    long buffer_capa;
+    rb_encoding *enc;   // Encoding of the first non ASCII diff text, or else the first one
+    bool ascii_only;    // All diff texts are ASCII only
+} DMPEditStream;
+
+extern void dmp_init_compose();
+
+#endif //FAST_DIFF_MATCH_PATCH_COMPOSE_H
@@ -0,0 +1,490 @@
+#include <stddef.h>
+#include "fast_diff_match_patch.h"
+#include "dictionary.h"
+#include "token.h"
+#include "hash.h"
+
+#ifdef HAVE_PTHREAD_H
+#define DICTIONARY_LOCK(dict)   (pthread_mutex_lock(&(dict)->mutex))
+#define DICTIONARY_UNLOCK(dict) (pthread_mutex_unlock(&(dict)->mutex))
+#else
+#define DICTIONARY_LOCK(dict)
+#define DICTIONARY_UNLOCK(dict)
+#endif
+
+#ifdef RUBY_TYPED_FROZEN_SHAREABLE
+#define DICTIONARY_SHAREABLE    RUBY_TYPED_FROZEN_SHAREABLE
+#else
+#define DICTIONARY_SHAREABLE    0
+#endif
+
+// Bytes counted against max_bytes for a line of the given length
+#define ENTRY_SIZE(length)      (offsetof(DMPLineEntry, text) + (size_t)(length))
+
+// A running lines_to_chars, the ids of both texts back to back
+typedef struct DMPDictionaryCall
+{
+    VALUE self;
+    long *ids;
+    long count1;
+    long count2;
+} DMPDictionaryCall;
+
+static VALUE dictionary_initialize(VALUE self, VALUE max_bytes);
+static VALUE dictionary_lines_to_chars(VALUE self, VALUE text1, VALUE text2);
+static VALUE dictionary_aref(VALUE self, VALUE id);
+static VALUE dictionary_clear(VALUE self);
+static VALUE dictionary_stats(VALUE self);
+
+static void dictionary_free(void *data);
+static size_t dictionary_memsize(const void *data);
+
+static const rb_data_type_t dictionary_type = {
+    "FastDiffMatchPatch::LineDictionary",
+    { NULL, dictionary_free, dictionary_memsize, },
+    NULL, NULL, RUBY_TYPED_FREE_IMMEDIATELY | DICTIONARY_SHAREABLE
+};
+
+static VALUE dictionary_alloc(VALUE klass);
+
+void dmp_init_dictionary()
+{
+    const VALUE dictionary_klass = rb_define_class_under(dmp_klass, "LineDictionary", rb_cObject);
+
+    rb_define_alloc_func(dictionary_klass, dictionary_alloc);
+    rb_define_method(dictionary_klass, "initialize", RUBY_METHOD_FUNC(dictionary_initialize), 1);
+    rb_define_method(dictionary_klass, "lines_to_chars", RUBY_METHOD_FUNC(dictionary_lines_to_chars), 2);
+    rb_define_method(dictionary_klass, "[]", RUBY_METHOD_FUNC(dictionary_aref), 1);
+    rb_define_method(dictionary_klass, "clear", RUBY_METHOD_FUNC(dictionary_clear), 0);
+    rb_define_method(dictionary_klass, "stats", RUBY_METHOD_FUNC(dictionary_stats), 0);
+}
+
+static void dictionary_free_lines(DMPLineDictionary *dict)
+{
+    DMPLineEntry *entry = dict->newest;
+    DMPLineEntry *older = NULL;
+
+    while(entry != NULL)
+    {
+        older = entry->older;
+        DMP_NATIVE_FREE(entry);
+        entry = older;
+    }
+
+    memset(dict->buckets, 0, sizeof(DMPLineEntry *) * (size_t)dict->bucket_count);
+    memset(dict->lines, 0, sizeof(DMPLineEntry *) * (size_t)dict->lines_capa);
+    dict->free_count = 0;
+    dict->next_id    = 1;
+    dict->newest     = NULL;
+    dict->oldest     = NULL;
+    dict->count      = 0;
+    dict->bytes      = 0;
+}
+
+static void dictionary_free(void *data)
+{
+    DMPLineDictionary *dict = data;
+
+    if(dict->buckets != NULL)
+    {
+        dictionary_free_lines(dict);
+        DMP_NATIVE_FREE(dict->buckets);
+        DMP_NATIVE_FREE(dict->lines);
+        DMP_NATIVE_FREE(dict->free_ids);
+    }
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_destroy(&dict->mutex);
+#endif
+    xfree(dict);
+}
+
+static size_t dictionary_memsize(const void *data)
+{
+    const DMPLineDictionary *dict = data;
+    return sizeof(DMPLineDictionary) + sizeof(DMPLineEntry *) * (size_t)dict->bucket_count +
+           (sizeof(DMPLineEntry *) + sizeof(long)) * (size_t)dict->lines_capa + dict->bytes;
+}
+
+static VALUE dictionary_alloc(VALUE klass)
+{
+    DMPLineDictionary *dict;
+    const VALUE self = TypedData_Make_Struct(klass, DMPLineDictionary, &dictionary_type, dict);
+
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_init(&dict->mutex, NULL);
+#endif
+    dict->bucket_count = DMP_DICTIONARY_BUCKETS;
+    dict->buckets      = DMP_NATIVE_ALLOC_N(DMPLineEntry *, dict->bucket_count);
+    memset(dict->buckets, 0, sizeof(DMPLineEntry *) * (size_t)dict->bucket_count);
+    dict->lines_capa   = DMP_DICTIONARY_BUCKETS;
+    dict->lines        = DMP_NATIVE_ALLOC_N(DMPLineEntry *, dict->lines_capa);
+    memset(dict->lines, 0, sizeof(DMPLineEntry *) * (size_t)dict->lines_capa);
+    dict->free_ids     = DMP_NATIVE_ALLOC_N(long, dict->lines_capa);
+    dict->next_id      = 1;
+
+    return self;
+}
+
+static DMPLineDictionary *get_dictionary(VALUE self)
+{
+    DMPLineDictionary *dict;
+
+    TypedData_Get_Struct(self, DMPLineDictionary, &dictionary_type, dict);
+    return dict;
+}
+
+// Keeps lines and their ids across diffs of the revisions of a document. Once the lines take more
+// than max_bytes, the ones least recently used are evicted and their ids handed out again.
+// Ruby equivalent code: LineDictionary.new(16 * 1024 * 1024)
+static VALUE dictionary_initialize(VALUE self, VALUE max_bytes)
+{
+    DMPLineDictionary *dict = get_dictionary(self);
+    const long limit        = NUM2LONG(max_bytes);
+
+    if(limit <= 0)
+    {
+        rb_raise(rb_eArgError, "max_bytes must be positive");
+    }
+
+    dict->max_bytes = (size_t)limit;
+    return self;
+}
+
+// All of the functions below are called with the dictionary mutex held
+
+static DMPLineEntry **dictionary_bucket(const DMPLineDictionary *dict, uint64_t hash)
+{
+    return &dict->buckets[hash & (uint64_t)(dict->bucket_count - 1)];
+}
+
+static void dictionary_push_newest(DMPLineDictionary *dict, DMPLineEntry *entry)
+{
+    entry->older = dict->newest;
+    entry->newer = NULL;
+
+    if(dict->newest != NULL)
+    {
+        dict->newest->newer = entry;
+    } else {
+        dict->oldest = entry;
+    }
+    dict->newest = entry;
+}
+
+static void dictionary_unlink_order(DMPLineDictionary *dict, DMPLineEntry *entry)
+{
+    if(entry->newer != NULL)
+    {
+        entry->newer->older = entry->older;
+    } else {
+        dict->newest = entry->older;
+    }
+
+    if(entry->older != NULL)
+    {
+        entry->older->newer = entry->newer;
+    } else {
+        dict->oldest = entry->newer;
+    }
+}
+
+static void dictionary_remove(DMPLineDictionary *dict, DMPLineEntry *entry)
+{
+    DMPLineEntry **link = dictionary_bucket(dict, entry->hash);
+
+    while(*link != entry)
+    {
+        link = &(*link)->next;
+    }
+    *link = entry->next;
+
+    dictionary_unlink_order(dict, entry);
+    dict->lines[entry->id]              = NULL;
+    dict->free_ids[dict->free_count++]  = entry->id;
+    dict->bytes -= ENTRY_SIZE(entry->length);
+    dict->count--;
+    dict->evictions++;
+    DMP_NATIVE_FREE(entry);
+}
+
+// Returns: whether the least recently used line could be evicted. Lines of the running call
+// are kept, and nothing is evicted while other calls may still look their ids up.
+static bool dictionary_evict_oldest(DMPLineDictionary *dict)
+{
+    if(dict->active != 1 || dict->oldest == NULL || dict->oldest->generation == dict->generation)
+    {
+        return false;
+    }
+
+    dictionary_remove(dict, dict->oldest);
+    return true;
+}
+
+// Doubles the buckets and spreads the lines over them again
+static void dictionary_grow(DMPLineDictionary *dict)
+{
+    DMPLineEntry *entry = NULL;
+    DMPLineEntry **bucket = NULL;
+
+    dict->bucket_count *= 2;
+    dict->buckets       = dmp_native_realloc(dict->buckets, sizeof(DMPLineEntry *) * (size_t)dict->bucket_count);
+    memset(dict->buckets, 0, sizeof(DMPLineEntry *) * (size_t)dict->bucket_count);
+
+    for(entry = dict->newest; entry != NULL; entry = entry->older)
+    {
+        bucket      = dictionary_bucket(dict, entry->hash);
+        entry->next = *bucket;
+        *bucket     = entry;
+    }
+}
+
+// Returns: an unused id, evicting a line when all of them are taken. 0 when none is left.
+static long dictionary_new_id(DMPLineDictionary *dict)
+{
+    long capa;
+    long id;
+
+    if(dict->free_count == 0 && dict->next_id > DMP_DICTIONARY_MAX_ID && !dictionary_evict_oldest(dict))
+    {
+        return 0;
+    }
+
+    if(dict->free_count > 0)
+    {
+        return dict->free_ids[--dict->free_count];
+    }
+
+    // The surrogates can't be encoded as characters of the token strings
+    if(dict->next_id == DMP_TOKEN_SURROGATE_MIN)
+    {
+        dict->next_id = DMP_TOKEN_SURROGATE_MAX + 1;
+    }
+    id = dict->next_id++;
+
+    if(id >= dict->lines_capa)
+    {
+        capa = dict->lines_capa * 2 > DMP_DICTIONARY_MAX_ID + 1 ? DMP_DICTIONARY_MAX_ID + 1 : dict->lines_capa * 2;
+        dict->lines    = dmp_native_realloc(dict->lines, sizeof(DMPLineEntry *) * (size_t)capa);
+        dict->free_ids = dmp_native_realloc(dict->free_ids, sizeof(long) * (size_t)capa);
+        memset(dict->lines + dict->lines_capa, 0, sizeof(DMPLineEntry *) * (size_t)(capa - dict->lines_capa));
+        dict->lines_capa = capa;
+    }
+
+    return id;
+}
+
+// Returns: the id of the line, which is added when it is new and marked as used by the running call.
+// 0 when the dictionary is out of ids.
+static long dictionary_intern(DMPLineDictionary *dict, const char *ptr, long length, int encoding)
+{
+    const uint64_t hash = dmp_hash_bytes(ptr, (size_t)length, 0);
+    DMPLineEntry *entry = *dictionary_bucket(dict, hash);
+    DMPLineEntry **bucket = NULL;
+    long id;
+
+    // Only the hash of a colliding line matches, never its bytes
+    while(entry != NULL && (entry->hash != hash || entry->length != length || memcmp(entry->text, ptr, (size_t)length) != 0))
+    {
+        entry = entry->next;
+    }
+
+    if(entry != NULL)
+    {
+        dictionary_unlink_order(dict, entry);
+        dictionary_push_newest(dict, entry);
+        entry->generation = dict->generation;
+        dict->hits++;
+        return entry->id;
+    }
+
+    id = dictionary_new_id(dict);
+    if(id == 0)
+    {
+        return 0;
+    }
+
+    entry             = (DMPLineEntry *)DMP_NATIVE_ALLOC_N(char, ENTRY_SIZE(length));
+    entry->hash       = hash;
+    entry->generation = dict->generation;
+    entry->id         = id;
+    entry->length     = length;
+    entry->encoding   = encoding;
+    memcpy(entry->text, ptr, (size_t)length);
+
+    bucket      = dictionary_bucket(dict, hash);
+    entry->next = *bucket;
+    *bucket     = entry;
+    dictionary_push_newest(dict, entry);
+    dict->lines[id] = entry;
+    dict->bytes += ENTRY_SIZE(length);
+    dict->count++;
+    dict->misses++;
+
+    if(dict->count > dict->bucket_count)
+    {
+        dictionary_grow(dict);
+    }
+
+    return id;
+}
+
+// Returns: the number of lines of the text, their ids are stored in ids. -1 when the dictionary is out of ids.
+static long dictionary_text_ids(DMPLineDictionary *dict, VALUE text, long *ids)
+{
+    rb_encoding *enc     = rb_enc_get(text);
+    const int encoding   = rb_enc_to_index(enc);
+    const char *ptr      = RSTRING_PTR(text);
+    const char *end      = RSTRING_END(text);
+    const char *next     = NULL;
+    long count           = 0;
+
+    while(ptr < end)
+    {
+        next         = dmp_line_end(ptr, end, enc);
+        ids[count]   = dictionary_intern(dict, ptr, next - ptr, encoding);
+        if(ids[count++] == 0)
+        {
+            return -1;
+        }
+        ptr = next;
+    }
+
+    return count;
+}
+
+static VALUE dictionary_yield(VALUE data)
+{
+    const DMPDictionaryCall *call = (const DMPDictionaryCall *)data;
+    const VALUE chars1 = dmp_chars_to_rb_str(call->ids, call->count1, rb_utf8_encoding());
+    const VALUE chars2 = dmp_chars_to_rb_str(call->ids + call->count1, call->count2, rb_utf8_encoding());
+
+    return rb_yield_values(3, chars1, chars2, call->self);
+}
+
+static VALUE dictionary_release(VALUE data)
+{
+    const DMPDictionaryCall *call = (const DMPDictionaryCall *)data;
+    DMPLineDictionary *dict = get_dictionary(call->self);
+
+    DICTIONARY_LOCK(dict);
+    dict->active--;
+    DICTIONARY_UNLOCK(dict);
+    xfree(call->ids);
+
+    return Qnil;
+}
+
+// Like diff_lines_to_chars, with the ids of the dictionary instead of new ones. Yields both texts
+// reduced to one character per line, and the dictionary, which maps the ids back to the lines
+// for diff_chars_to_lines. The ids stay valid until the block returns.
+// Returns: the result of the block
+// Ruby equivalent code:
+//   chars = [text1, text2].map do |text|
+//     text.each_line.map { |line| (@line_hash[line] ||= (@line_array << line).length - 1).chr(Encoding::UTF_8) }.join
+//   end
+//   yield(*chars, self)
+static VALUE dictionary_lines_to_chars(VALUE self, VALUE text1, VALUE text2)
+{
+    DMPLineDictionary *dict = get_dictionary(self);
+    DMPDictionaryCall call;
+
+    StringValue(text1);
+    StringValue(text2);
+    rb_need_block();
+
+    call.self   = self;
+    call.ids    = ALLOC_N(long, (size_t)(RSTRING_LEN(text1) + RSTRING_LEN(text2)));
+    call.count1 = 0;
+    call.count2 = 0;
+
+    DICTIONARY_LOCK(dict);
+    dict->active++;
+    dict->generation++;
+    call.count1 = dictionary_text_ids(dict, text1, call.ids);
+    if(call.count1 >= 0)
+    {
+        call.count2 = dictionary_text_ids(dict, text2, call.ids + call.count1);
+    }
+
+    while(dict->bytes > dict->max_bytes && dictionary_evict_oldest(dict))
+    {
+    }
+    DICTIONARY_UNLOCK(dict);
+
+    if(call.count1 < 0 || call.count2 < 0)
+    {
+        dictionary_release((VALUE)&call);
+        rb_raise(rb_eRangeError, "LineDictionary is out of line ids");
+    }
+
+    RB_GC_GUARD(text1);
+    RB_GC_GUARD(text2);
+    return rb_ensure(dictionary_yield, (VALUE)&call, dictionary_release, (VALUE)&call);
+}
+
+// Returns: the line of an id handed out by a running lines_to_chars, nil for unused ids
+// Ruby equivalent code: @line_array[id]
+static VALUE dictionary_aref(VALUE self, VALUE id)
+{
+    DMPLineDictionary *dict   = get_dictionary(self);
+    const long index          = NUM2LONG(id);
+    const DMPLineEntry *entry = NULL;
+
+    DICTIONARY_LOCK(dict);
+    if(index > 0 && index < dict->lines_capa)
+    {
+        entry = dict->lines[index];
+    }
+    DICTIONARY_UNLOCK(dict);
+
+    // The line can't be evicted before the block that got its id returns
+    return entry != NULL ? rb_enc_str_new(entry->text, entry->length, rb_enc_from_index(entry->encoding)) : Qnil;
+}
+
+static VALUE dictionary_clear(VALUE self)
+{
+    DMPLineDictionary *dict = get_dictionary(self);
+    long active;
+
+    DICTIONARY_LOCK(dict);
+    active = dict->active;
+    if(active == 0)
+    {
+        dictionary_free_lines(dict);
+    }
+    DICTIONARY_UNLOCK(dict);
+
+    if(active != 0)
+    {
+        rb_raise(rb_eRuntimeError, "LineDictionary is in use");
+    }
+
+    return self;
+}
+
+// Ruby equivalent code: { hits:, misses:, evictions:, lines:, bytes:, max_bytes: }
+static VALUE dictionary_stats(VALUE self)
+{
+    DMPLineDictionary *dict = get_dictionary(self);
+    const VALUE stats       = rb_hash_new();
+    unsigned long hits, misses, evictions;
+    long count;
+    size_t bytes;
+
+    DICTIONARY_LOCK(dict);
+    hits      = dict->hits;
+    misses    = dict->misses;
+    evictions = dict->evictions;
+    count     = dict->count;
+    bytes     = dict->bytes;
+    DICTIONARY_UNLOCK(dict);
+
+    rb_hash_aset(stats, ID2SYM(rb_intern("hits")), ULONG2NUM(hits));
+    rb_hash_aset(stats, ID2SYM(rb_intern("misses")), ULONG2NUM(misses));
+    rb_hash_aset(stats, ID2SYM(rb_intern("evictions")), ULONG2NUM(evictions));
+    rb_hash_aset(stats, ID2SYM(rb_intern("lines")), LONG2NUM(count));
+    rb_hash_aset(stats, ID2SYM(rb_intern("bytes")), SIZET2NUM(bytes));
+    rb_hash_aset(stats, ID2SYM(rb_intern("max_bytes")), SIZET2NUM(dict->max_bytes));
+
+    return stats;
+}
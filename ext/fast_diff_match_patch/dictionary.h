@@ -0,0 +1,59 @@
+#ifndef FAST_DIFF_MATCH_PATCH_DICTIONARY_H
+#define FAST_DIFF_MATCH_PATCH_DICTIONARY_H
+
+#include <stdint.h>
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+// Buckets of a new dictionary, doubled whenever the lines outnumber them
+#define DMP_DICTIONARY_BUCKETS  256
+
+// Highest id of a line, the last Unicode code point
+#define DMP_DICTIONARY_MAX_ID   0x10FFFF
+
+// One interned line. Its bytes are allocated along with the entry.
+typedef struct DMPLineEntry
+{
+    uint64_t hash;                  // dmp_hash_bytes of the line, picks the bucket
+    struct DMPLineEntry *next;      // Next entry of the same bucket
+    struct DMPLineEntry *newer;     // Neighbours in least recently used order
+    struct DMPLineEntry *older;
+    unsigned long generation;       // Last call of lines_to_chars that used the line
+    long id;
+    long length;
+    int encoding;                   // Encoding index of the text the line was first seen in
+    char text[1];
+} DMPLineEntry;
+
+// A FastDiffMatchPatch::LineDictionary. Lines keep their id until they are evicted, which
+// only happens while no other lines_to_chars block is running, so the ids handed to a block
+// stay valid until it returns. Frozen ones are shared between Ractors, so every access takes the mutex.
+typedef struct DMPLineDictionary
+{
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_t mutex;
+#endif
+    DMPLineEntry **buckets;
+    long bucket_count;
+    DMPLineEntry **lines;           // Entry of every id, NULL for free ids
+    long lines_capa;
+    long *free_ids;                 // Ids of evicted lines, reused before new ones
+    long free_count;
+    long next_id;                   // Lowest id never handed out
+    long count;                     // Number of lines
+    DMPLineEntry *newest;
+    DMPLineEntry *oldest;           // Evicted first
+    size_t bytes;                   // Sum of the entry sizes
+    size_t max_bytes;
+    unsigned long generation;
+    long active;                    // Number of running lines_to_chars blocks
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+} DMPLineDictionary;
+
+extern void dmp_init_dictionary();
+
+#endif //FAST_DIFF_MATCH_PATCH_DICTIONARY_H
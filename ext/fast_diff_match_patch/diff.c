@@ -1,159 +1,1311 @@
 
 #include "fast_diff_match_patch.h"
 #include "diff.h"
+#include "cancel.h"
+#include "pool.h"
+#include <sys/time.h>
 
-static VALUE diff_bisect(VALUE self, VALUE text1, VALUE text2, VALUE deadline);
+static VALUE diff_bisect(int argc, VALUE *argv, VALUE self);
+static VALUE diff_main_parallel(int argc, VALUE *argv, VALUE self);
+static VALUE diff_pairs(VALUE self, VALUE pairs, VALUE threads);
+static VALUE diff_base_pairs(VALUE self, VALUE base, VALUE candidates, VALUE threads);
 
 void dmp_init_diff()
 {
-    rb_define_method(dmp_klass, "diff_bisect", RUBY_METHOD_FUNC(diff_bisect), 3);
+    rb_define_method(dmp_klass, "diff_bisect", RUBY_METHOD_FUNC(diff_bisect), -1);
+    rb_define_method(dmp_klass, "diff_main_parallel", RUBY_METHOD_FUNC(diff_main_parallel), -1);
+    rb_define_method(dmp_klass, "diff_pairs", RUBY_METHOD_FUNC(diff_pairs), 2);
+    rb_define_method(dmp_klass, "diff_base_pairs", RUBY_METHOD_FUNC(diff_base_pairs), 3);
 }
 
-// Converts ruby object into integer
-// Ruby equivalent code: "1337".to_i
-static long rb_to_i(VALUE object)
+// Returns the current wall clock time in seconds
+// Ruby equivalent code: Time.now.to_f
+double dmp_time_now()
 {
-    return FIX2LONG(RB_FUNC_CALL(object, dmp_to_i_id));
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (double)now.tv_sec + (double)now.tv_usec / 1e6;
 }
 
-// Returns the current time, converted to an integer
-// Ruby equivalent code: Time.now.to_i
-static long time_now()
+// Native diff engine
+// The functions below mirror the Ruby diff_main family on codepoint arrays.
+// They never allocate Ruby objects so they may run without the GVL.
+
+void dmp_diff_list_init(DMPDiffList *list)
 {
-    return rb_to_i(RB_FUNC_CALL(dmp_time_klass, dmp_time_now_id));
+    list->items = NULL;
+    list->count = 0;
+    list->capa  = 0;
 }
 
-// Find the 'middle snake' of a diff, split the problem in two
-// and return the recursively constructed diff.
-// See Myers 1986 paper: An O(ND) Difference Algorithm and Its Variations.
+void dmp_diff_list_free(DMPDiffList *list)
+{
+    DMP_NATIVE_FREE(list->items);
+    dmp_diff_list_init(list);
+}
+
+// Inserts a diff at the given index, growing the list when needed
+static void diff_list_insert(DMPDiffList *list, long index, int operation, long start, long length)
+{
+    if(list->count == list->capa)
+    {
+        list->capa  = list->capa == 0 ? 16 : list->capa * 2;
+        list->items = dmp_native_realloc(list->items, sizeof(DMPDiff) * (size_t)list->capa);
+    }
+
+    if(index < list->count)
+    {
+        memmove(list->items + index + 1, list->items + index, sizeof(DMPDiff) * (size_t)(list->count - index));
+    }
+
+    list->items[index].operation = operation;
+    list->items[index].start     = start;
+    list->items[index].length    = length;
+    list->count++;
+}
+
+// Ruby equivalent code: diffs << DiffNode.new(operation, text)
+static void diff_list_push(DMPDiffList *list, int operation, long start, long length)
+{
+    diff_list_insert(list, list->count, operation, start, length);
+}
+
+// Ruby equivalent code: diffs[index, count] = []
+static void diff_list_remove(DMPDiffList *list, long index, long count)
+{
+    memmove(list->items + index, list->items + index + count, sizeof(DMPDiff) * (size_t)(list->count - index - count));
+    list->count -= count;
+}
+
+// Characters of a diff operation inside the root texts
+static const long *diff_chars(const DMPDiffContext *ctx, const DMPDiff *diff)
+{
+    return (diff->operation == DMP_DIFF_INSERT ? ctx->text2.chars : ctx->text1.chars) + diff->start;
+}
+
+// Builds a view on part of a text without copying it
+// Ruby equivalent code: text[start, length]
+static DMPString str_view(const DMPString text, long start, long length)
+{
+    const DMPString view = { (unsigned int)length, text.chars + start };
+    return view;
+}
+
+static bool chars_equal(const long *text1, const long *text2, long length)
+{
+    return length == 0 || memcmp(text1, text2, sizeof(long) * (size_t)length) == 0;
+}
+
+// Ruby equivalent code: diff_common_prefix(text1, text2)
+static long common_prefix(const long *text1, long length1, const long *text2, long length2)
+{
+    const long length = DMP_MIN(length1, length2);
+    long i = 0;
+
+    while(i < length && DMP_CMP(text1[i], text2[i]))
+    {
+        i++;
+    }
+
+    return i;
+}
+
+// Ruby equivalent code: diff_common_suffix(text1, text2)
+static long common_suffix(const long *text1, long length1, const long *text2, long length2)
+{
+    const long length = DMP_MIN(length1, length2);
+    long i = 0;
+
+    while(i < length && DMP_CMP(text1[length1 - i - 1], text2[length2 - i - 1]))
+    {
+        i++;
+    }
 
-static VALUE diff_bisect(VALUE self, VALUE text1, VALUE text2, VALUE deadline) {
-    DMPString dmp_text2       = rb_str_to_dmp_hash(text2);
-    DMPString dmp_text1       = rb_str_to_dmp_hash(text1);
-    const long deadline_l     = deadline == Qnil ? Qnil : rb_to_i(deadline);
-    const int text1_length    = dmp_text1.size;
-    const int text2_length    = dmp_text2.size;
-    const int delta           = text1_length - text2_length;
-    const int max_d           = (text1_length + text2_length + 1) / 2;
-    const int v_offset        = max_d;
-    const int v_length        = 2 * max_d;
-    const bool front          = (delta % 2 != 0);
-
-    int v1[v_length];
-    int v2[v_length];
-    int k1start   = 0;
-    int k1end     = 0;
-    int k2start   = 0;
-    int k2end     = 0;
-    int k1_offset = 0;
-    int k2_offset = 0;
-    int x1        = 0;
-    int x2        = 0;
-    int y1        = 0;
-    int y2        = 0;
-    int d         = 0;
-    int k1        = 0;
-    int k2        = 0;
-
-    memset(v1, -1, v_length * sizeof(int));
-    memset(v2, -1, v_length * sizeof(int));
-    v1[v_offset + 1] = 0;
-    v2[v_offset + 1] = 0;
-
-    for(d = 0; d < max_d; d++)
-    {
-        if(deadline_l != Qnil && time_now() >= deadline_l)
+    return i;
+}
+
+// Find the first instance of the pattern at or after the given position
+// Ruby equivalent code: text.index(pattern, pos)
+static long str_index(const DMPString text, const DMPString pattern, long pos)
+{
+    long i = 0;
+
+    if(pattern.size == 0)
+    {
+        return pos <= (long)text.size ? pos : -1;
+    }
+
+    for(i = pos; i + (long)pattern.size <= (long)text.size; i++)
+    {
+        if(DMP_CMP(text.chars[i], pattern.chars[0]) && chars_equal(text.chars + i, pattern.chars, pattern.size))
         {
-            break;
+            return i;
         }
+    }
+
+    return -1;
+}
+
+typedef struct DMPHalfMatch
+{
+    long long_a;   // Length of the long text prefix
+    long long_b;   // Start of the long text suffix
+    long short_a;  // Length of the short text prefix
+    long short_b;  // Start of the short text suffix
+    long common;   // Length of the common middle
+} DMPHalfMatch;
 
-        for(k1 = -d + k1start; k1 <= d - k1end; k1 += 2)
+// Does a substring of short_text exist within long_text such that the
+// substring is at least half the length of long_text?
+// Ruby equivalent code: diff_half_match_index(long_text, short_text, index)
+static bool half_match_index(const DMPString long_text, const DMPString short_text, long index, DMPHalfMatch *hm)
+{
+    const DMPString seed = str_view(long_text, index, DMP_MIN((long)long_text.size / 4, (long)long_text.size - index));
+    long j = -1;
+    long prefix_length, suffix_length;
+
+    hm->common = 0;
+    while((j = str_index(short_text, seed, j + 1)) != -1)
+    {
+        prefix_length = common_prefix(long_text.chars + index, long_text.size - index, short_text.chars + j, short_text.size - j);
+        suffix_length = common_suffix(long_text.chars, index, short_text.chars, j);
+
+        if(hm->common < suffix_length + prefix_length)
         {
-            k1_offset = v_offset + k1;
-            if(k1 == -d || (k1 != d && v1[k1_offset - 1] < v1[k1_offset + 1]))
+            hm->common  = suffix_length + prefix_length;
+            hm->long_a  = index - suffix_length;
+            hm->long_b  = index + prefix_length;
+            hm->short_a = j - suffix_length;
+            hm->short_b = j + prefix_length;
+        }
+    }
+
+    return hm->common * 2 >= (long)long_text.size;
+}
+
+// Do the two texts share a substring which is at least half the length of the longer text?
+// Ruby equivalent code: diff_half_match(text1, text2)
+static bool half_match(const DMPString text1, const DMPString text2, DMPString parts[4], long *common)
+{
+    const bool text1_longer   = text1.size > text2.size;
+    const DMPString long_text  = text1_longer ? text1 : text2;
+    const DMPString short_text = text1_longer ? text2 : text1;
+    DMPHalfMatch hm1, hm2, hm;
+    bool found1, found2;
+
+    if(long_text.size < 4 || short_text.size * 2 < long_text.size)
+    {
+        return false;
+    }
+
+    // First check if the second quarter is the seed for a half-match.
+    found1 = half_match_index(long_text, short_text, (long_text.size + 3) / 4, &hm1);
+    // Check again based on the third quarter.
+    found2 = half_match_index(long_text, short_text, (long_text.size + 1) / 2, &hm2);
+
+    if(!found1 && !found2)
+    {
+        return false;
+    } else if(!found1 || !found2) {
+        hm = found2 ? hm2 : hm1;
+    } else {
+        hm = hm1.common > hm2.common ? hm1 : hm2;
+    }
+
+    parts[text1_longer ? 0 : 2] = str_view(long_text, 0, hm.long_a);
+    parts[text1_longer ? 1 : 3] = str_view(long_text, hm.long_b, long_text.size - hm.long_b);
+    parts[text1_longer ? 2 : 0] = str_view(short_text, 0, hm.short_a);
+    parts[text1_longer ? 3 : 1] = str_view(short_text, hm.short_b, short_text.size - hm.short_b);
+    *common = hm.common;
+
+    return true;
+}
+
+// Offsets of two views inside the root texts
+#define DMP_OFFSET1(ctx, text) ((long)((text).chars - (ctx)->text1.chars))
+#define DMP_OFFSET2(ctx, text) ((long)((text).chars - (ctx)->text2.chars))
+
+static void bisect_half_task(void *data, long index)
+{
+    DMPBisectHalf *half = (DMPBisectHalf *)data + index;
+    dmp_diff_main(half->ctx, half->text1, half->text2, &half->diffs);
+}
+
+// Given the location of the 'middle snake', split the diff in two parts and recurse.
+// Both halves are independent, large ones are computed on the worker pool and
+// appended in order afterwards, so the result is the same as the serial run.
+static void diff_bisect_split(const DMPDiffContext *ctx, const DMPString text1, const DMPString text2,
+                              long x, long y, DMPDiffList *diffs)
+{
+    DMPBisectHalf halves[2] = {
+        { ctx, str_view(text1, 0, x), str_view(text2, 0, y), { NULL, 0, 0 } },
+        { ctx, str_view(text1, x, text1.size - x), str_view(text2, y, text2.size - y), { NULL, 0, 0 } }
+    };
+    const long min_size = dmp_pool_min_parallel_size();
+    long i, j;
+
+    if(halves[0].text1.size + halves[0].text2.size < min_size ||
+       halves[1].text1.size + halves[1].text2.size < min_size)
+    {
+        // Compute both diffs serially.
+        dmp_diff_main(ctx, halves[0].text1, halves[0].text2, diffs);
+        dmp_diff_main(ctx, halves[1].text1, halves[1].text2, diffs);
+        return;
+    }
+
+    dmp_pool_run(2, bisect_half_task, halves);
+
+    for(i = 0; i < 2; i++)
+    {
+        for(j = 0; j < halves[i].diffs.count; j++)
+        {
+            diff_list_push(diffs, halves[i].diffs.items[j].operation, halves[i].diffs.items[j].start, halves[i].diffs.items[j].length);
+        }
+        dmp_diff_list_free(&halves[i].diffs);
+    }
+}
+
+// Extend every forward diagonal (v1) by one edit.
+// With check set, stop at the first one overlapping the reverse frontier of the previous d.
+// Returns: true when the middle snake was found
+static bool bisect_forward_pass(DMPBisectState *state, bool check)
+{
+    const long *text1 = state->text1.chars;
+    const long *text2 = state->text2.chars;
+    const long text1_length = state->text1.size;
+    const long text2_length = state->text2.size;
+    const long v_offset = state->v_offset;
+    const long d = state->d;
+    long *v1 = state->v1;
+    const long *v2 = state->v2;
+    long k1_offset, k2_offset, x1, x2, y1, k1;
+
+    for(k1 = -d + state->k1start; k1 <= d - state->k1end; k1 += 2)
+    {
+        k1_offset = v_offset + k1;
+        if(k1 == -d || (k1 != d && v1[k1_offset - 1] < v1[k1_offset + 1]))
+        {
+            x1 = v1[k1_offset + 1];
+        } else {
+            x1 = v1[k1_offset - 1] + 1;
+        }
+
+        y1 = x1 - k1;
+        while(x1 < text1_length && y1 < text2_length && DMP_CMP(text1[x1], text2[y1]))
+        {
+            x1++;
+            y1++;
+        }
+
+        v1[k1_offset] = x1;
+        if(x1 > text1_length)
+        {
+            state->k1end += 2;
+        } else if(y1 > text2_length) {
+            state->k1start += 2;
+        } else if(check) {
+            k2_offset = v_offset + state->delta - k1;
+            if(k2_offset >= 0 && k2_offset < state->v_length && v2[k2_offset] != -1)
             {
-                x1 = v1[k1_offset + 1];
-            } else {
-                x1 = v1[k1_offset - 1] + 1;
+                x2 = text1_length - v2[k2_offset];
+                if(x1 >= x2)
+                {
+                    state->x = x1;
+                    state->y = y1;
+                    return true;
+                }
             }
+        }
+    }
+
+    return false;
+}
+
+// Overlap test of a reverse diagonal against the forward frontier of the same d
+static bool bisect_reverse_overlap(DMPBisectState *state, long k2)
+{
+    const long k1_offset = state->v_offset + state->delta - k2;
+    const long x2        = state->text1.size - state->v2[state->v_offset + k2];
+    long x1;
+
+    if(k1_offset >= 0 && k1_offset < state->v_length && state->v1[k1_offset] != -1)
+    {
+        x1 = state->v1[k1_offset];
+        if(x1 >= x2)
+        {
+            state->x = x1;
+            state->y = state->v_offset + x1 - k1_offset;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Extend every reverse diagonal (v2) by one edit, see bisect_forward_pass.
+// Records the diagonals visited so the overlap test can also run after the pass.
+static bool bisect_reverse_pass(DMPBisectState *state, bool check)
+{
+    const long *text1 = state->text1.chars;
+    const long *text2 = state->text2.chars;
+    const long text1_length = state->text1.size;
+    const long text2_length = state->text2.size;
+    const long v_offset = state->v_offset;
+    const long d = state->d;
+    long *v2 = state->v2;
+    long k2_offset, x2, y2, k2;
+
+    state->k2_first = -d + state->k2start;
+    state->k2_last  = state->k2_first - 2;
+
+    for(k2 = state->k2_first; k2 <= d - state->k2end; k2 += 2)
+    {
+        k2_offset = v_offset + k2;
+        if(k2 == -d || (k2 != d && v2[k2_offset - 1] < v2[k2_offset + 1]))
+        {
+            x2 = v2[k2_offset + 1];
+        } else {
+            x2 = v2[k2_offset - 1] + 1;
+        }
+
+        y2 = x2 - k2;
+        while(x2 < text1_length && y2 < text2_length &&
+              DMP_CMP(text1[text1_length - x2 - 1], text2[text2_length - y2 - 1]))
+        {
+            x2++;
+            y2++;
+        }
+
+        v2[k2_offset]  = x2;
+        state->k2_last = k2;
+        if(x2 > text1_length)
+        {
+            state->k2end += 2;
+        } else if(y2 > text2_length) {
+            state->k2start += 2;
+        } else if(check && bisect_reverse_overlap(state, k2)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Runs the forward pass as index 0 and the reverse pass as index 1.
+// The forward pass only reads reverse diagonals of the previous d, which the reverse pass doesn't write,
+// the reverse overlap test needs the finished forward pass and runs afterwards.
+static void bisect_pass_task(void *data, long index)
+{
+    DMPBisectState *state = data;
+
+    if(index == 0)
+    {
+        state->found = bisect_forward_pass(state, state->front);
+    } else {
+        bisect_reverse_pass(state, false);
+    }
+}
+
+// Concurrent version of one d iteration, finds the same snake as the serial one
+static bool bisect_parallel_step(DMPBisectState *state)
+{
+    long k2;
+
+    dmp_pool_run(2, bisect_pass_task, state);
+    if(state->found || state->front)
+    {
+        return state->found;
+    }
+
+    // Same order as the serial reverse pass, the first overlapping diagonal wins
+    for(k2 = state->k2_first; k2 <= state->k2_last; k2 += 2)
+    {
+        if(state->v2[state->v_offset + k2] <= (long)state->text1.size &&
+           state->v2[state->v_offset + k2] - k2 <= (long)state->text2.size &&
+           bisect_reverse_overlap(state, k2))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
 
-            y1 = x1 - k1;
-            while(x1 < text1_length &&
-                  y1 < text2_length &&
-                  DMP_CMP(dmp_text1.chars[x1], dmp_text2.chars[y1]))
+// Find the 'middle snake' of a diff, split the problem in two
+// and append the recursively constructed diff.
+// Same algorithm as the diff_bisect Ruby method, recursing natively instead of diff_bisect_split.
+static void native_diff_bisect(const DMPDiffContext *ctx, const DMPString text1, const DMPString text2, DMPDiffList *diffs)
+{
+    DMPBisectState state;
+    long i;
+
+    state.text1    = text1;
+    state.text2    = text2;
+    state.delta    = (long)text1.size - (long)text2.size;
+    state.front    = (state.delta % 2 != 0);
+    state.v_offset = ((long)text1.size + (long)text2.size + 1) / 2;
+    state.v_length = 2 * state.v_offset;
+    state.v1       = dmp_native_alloc(sizeof(long) * (size_t)state.v_length * 2);
+    state.v2       = state.v1 + state.v_length;
+    state.k1start  = state.k1end = state.k2start = state.k2end = 0;
+    state.found    = false;
+
+    for(i = 0; i < state.v_length * 2; i++)
+    {
+        state.v1[i] = -1;
+    }
+    state.v1[state.v_offset + 1] = 0;
+    state.v2[state.v_offset + 1] = 0;
+
+    // max_d is v_offset
+    for(state.d = 0; state.d < state.v_offset; state.d++)
+    {
+        if((ctx->deadline > 0 && dmp_time_now() >= ctx->deadline) || DMP_CANCELLED(ctx->cancel))
+        {
+            break;
+        }
+
+        // Two threads only pay off once the frontiers are wide
+        if(ctx->parallel_passes && state.d >= DMP_BISECT_PASSES_MIN_D)
+        {
+            if(bisect_parallel_step(&state))
             {
-                x1++;
-                y1++;
+                goto split;
             }
+            continue;
+        }
 
-            v1[k1_offset] = x1;
-            if(x1 > text1_length)
+        if(bisect_forward_pass(&state, state.front) || bisect_reverse_pass(&state, !state.front))
+        {
+            goto split;
+        }
+    }
+
+    // Diff took too long and hit the deadline, was cancelled or
+    // number of diffs equals number of characters, no commonality at all.
+    DMP_NATIVE_FREE(state.v1);
+    dmp_progress_add(ctx->progress, ctx->cancel, text1.size + text2.size);
+    diff_list_push(diffs, DMP_DIFF_DELETE, DMP_OFFSET1(ctx, text1), text1.size);
+    diff_list_push(diffs, DMP_DIFF_INSERT, DMP_OFFSET2(ctx, text2), text2.size);
+    return;
+
+split:
+    // Ruby equivalent code: diff_bisect_split(text1, text2, x1, y1, deadline)
+    DMP_NATIVE_FREE(state.v1);
+    diff_bisect_split(ctx, text1, text2, state.x, state.y, diffs);
+}
+
+// Find the differences between two texts. Assumes that the texts do not
+// have any common prefix or suffix.
+// Ruby equivalent code: diff_compute(text1, text2, false, deadline)
+static void diff_compute(const DMPDiffContext *ctx, const DMPString text1, const DMPString text2, DMPDiffList *diffs)
+{
+    const bool text1_longer    = text1.size > text2.size;
+    const DMPString long_text  = text1_longer ? text1 : text2;
+    const DMPString short_text = text1_longer ? text2 : text1;
+    const int operation        = text1_longer ? DMP_DIFF_DELETE : DMP_DIFF_INSERT;
+    const long long_offset     = text1_longer ? DMP_OFFSET1(ctx, text1) : DMP_OFFSET2(ctx, text2);
+    DMPString parts[4];
+    long sub_index, common;
+
+    if(text1.size == 0)
+    {
+        // Just add some text (speedup).
+        diff_list_push(diffs, DMP_DIFF_INSERT, DMP_OFFSET2(ctx, text2), text2.size);
+        dmp_progress_add(ctx->progress, ctx->cancel, text2.size);
+        return;
+    }
+
+    if(text2.size == 0)
+    {
+        // Just delete some text (speedup).
+        diff_list_push(diffs, DMP_DIFF_DELETE, DMP_OFFSET1(ctx, text1), text1.size);
+        dmp_progress_add(ctx->progress, ctx->cancel, text1.size);
+        return;
+    }
+
+    sub_index = str_index(long_text, short_text, 0);
+    if(sub_index != -1)
+    {
+        // Shorter text is inside the longer text (speedup).
+        diff_list_push(diffs, operation, long_offset, sub_index);
+        diff_list_push(diffs, DMP_DIFF_EQUAL, DMP_OFFSET1(ctx, text1) + (text1_longer ? sub_index : 0), short_text.size);
+        diff_list_push(diffs, operation, long_offset + sub_index + short_text.size, long_text.size - sub_index - short_text.size);
+        dmp_progress_add(ctx->progress, ctx->cancel, text1.size + text2.size);
+        return;
+    }
+
+    if(short_text.size == 1)
+    {
+        // Single character string.
+        // After the previous speedup, the character can't be an equality.
+        diff_list_push(diffs, DMP_DIFF_DELETE, DMP_OFFSET1(ctx, text1), text1.size);
+        diff_list_push(diffs, DMP_DIFF_INSERT, DMP_OFFSET2(ctx, text2), text2.size);
+        dmp_progress_add(ctx->progress, ctx->cancel, text1.size + text2.size);
+        return;
+    }
+
+    // Check to see if the problem can be split in two.
+    if(ctx->half_match && half_match(text1, text2, parts, &common))
+    {
+        // Send both pairs off for separate processing.
+        dmp_progress_add(ctx->progress, ctx->cancel, 2 * common);
+        dmp_diff_main(ctx, parts[0], parts[2], diffs);
+        diff_list_push(diffs, DMP_DIFF_EQUAL, DMP_OFFSET1(ctx, parts[0]) + parts[0].size, common);
+        dmp_diff_main(ctx, parts[1], parts[3], diffs);
+        return;
+    }
+
+    native_diff_bisect(ctx, text1, text2, diffs);
+}
+
+// Find the differences between two texts and append them to the diff list.
+// Simplifies the problem by stripping any common prefix or suffix off the texts before diffing.
+// Ruby equivalent code: diffs.concat(diff_main(text1, text2, false, deadline))
+void dmp_diff_main(const DMPDiffContext *ctx, DMPString text1, DMPString text2, DMPDiffList *diffs)
+{
+    DMPDiffList middle;
+    long prefix_length, suffix_length, i;
+
+    // Check for equality (speedup).
+    if(text1.size == text2.size && chars_equal(text1.chars, text2.chars, text1.size))
+    {
+        if(text1.size > 0)
+        {
+            diff_list_push(diffs, DMP_DIFF_EQUAL, DMP_OFFSET1(ctx, text1), text1.size);
+        }
+        dmp_progress_add(ctx->progress, ctx->cancel, 2 * (long)text1.size);
+        return;
+    }
+
+    // Trim off common prefix and suffix (speedup).
+    prefix_length = common_prefix(text1.chars, text1.size, text2.chars, text2.size);
+    suffix_length = common_suffix(text1.chars + prefix_length, text1.size - prefix_length,
+                                  text2.chars + prefix_length, text2.size - prefix_length);
+    dmp_progress_add(ctx->progress, ctx->cancel, 2 * (prefix_length + suffix_length));
+
+    dmp_diff_list_init(&middle);
+    if(prefix_length > 0)
+    {
+        diff_list_push(&middle, DMP_DIFF_EQUAL, DMP_OFFSET1(ctx, text1), prefix_length);
+    }
+
+    // Compute the diff on the middle block.
+    diff_compute(ctx,
+                 str_view(text1, prefix_length, text1.size - prefix_length - suffix_length),
+                 str_view(text2, prefix_length, text2.size - prefix_length - suffix_length),
+                 &middle);
+
+    // Restore the suffix.
+    if(suffix_length > 0)
+    {
+        diff_list_push(&middle, DMP_DIFF_EQUAL, DMP_OFFSET1(ctx, text1) + text1.size - suffix_length, suffix_length);
+    }
+
+    dmp_diff_cleanup_merge(ctx, &middle);
+
+    for(i = 0; i < middle.count; i++)
+    {
+        diff_list_push(diffs, middle.items[i].operation, middle.items[i].start, middle.items[i].length);
+    }
+    dmp_diff_list_free(&middle);
+}
+
+// Reorder and merge like edit sections. Merge equalities.
+// Any edit section can move as long as it doesn't cross an equality.
+// Ruby equivalent code: diff_cleanup_merge(diffs)
+void dmp_diff_cleanup_merge(const DMPDiffContext *ctx, DMPDiffList *diffs)
+{
+    long pointer       = 0;
+    long count_delete  = 0;
+    long count_insert  = 0;
+    long delete_start  = 0;
+    long delete_length = 0;
+    long insert_start  = 0;
+    long insert_length = 0;
+    long end1          = 0;
+    long position, common_length, i;
+    bool changes;
+    DMPDiff *prev, *diff, *next;
+
+    // Add a dummy entry at the end, it sits at the end of the text1 range of the diffs
+    for(i = diffs->count - 1; i >= 0; i--)
+    {
+        if(diffs->items[i].operation != DMP_DIFF_INSERT)
+        {
+            end1 = diffs->items[i].start + diffs->items[i].length;
+            break;
+        }
+    }
+    diff_list_push(diffs, DMP_DIFF_EQUAL, end1, 0);
+
+    while(pointer < diffs->count)
+    {
+        diff = &diffs->items[pointer];
+
+        if(diff->operation == DMP_DIFF_INSERT)
+        {
+            insert_start   = count_insert == 0 ? diff->start : insert_start;
+            insert_length += diff->length;
+            count_insert++;
+            pointer++;
+        } else if(diff->operation == DMP_DIFF_DELETE) {
+            delete_start   = count_delete == 0 ? diff->start : delete_start;
+            delete_length += diff->length;
+            count_delete++;
+            pointer++;
+        } else {
+            // Upon reaching an equality, check for prior redundancies.
+            if(count_delete + count_insert > 1)
             {
-                k1end += 2;
-            } else if(y1 > text2_length) {
-                k1start += 2;
-            } else if(front) {
-                k2_offset = v_offset + delta - k1;
-                if(k2_offset >= 0 && k2_offset < v_length && v2[k2_offset] != -1)
+                if(count_delete != 0 && count_insert != 0)
                 {
-                    x2 = text1_length - v2[k2_offset];
-                    if(x1 >= x2)
+                    // Factor out any common prefixies.
+                    common_length = common_prefix(ctx->text2.chars + insert_start, insert_length,
+                                                  ctx->text1.chars + delete_start, delete_length);
+                    if(common_length != 0)
                     {
-                        FREE_DMP_STR2(dmp_text1, dmp_text2);
-                        return rb_funcall(self, dmp_diff_bisect_split_id, 5, text1, text2, INT2FIX(x1), INT2FIX(y1), deadline);
+                        position = pointer - count_delete - count_insert;
+                        if(position > 0 && diffs->items[position - 1].operation == DMP_DIFF_EQUAL)
+                        {
+                            diffs->items[position - 1].length += common_length;
+                        } else {
+                            diff_list_insert(diffs, 0, DMP_DIFF_EQUAL, delete_start, common_length);
+                            pointer++;
+                        }
+                        insert_start  += common_length;
+                        insert_length -= common_length;
+                        delete_start  += common_length;
+                        delete_length -= common_length;
                     }
+
+                    // Factor out any common suffixies.
+                    common_length = common_suffix(ctx->text2.chars + insert_start, insert_length,
+                                                  ctx->text1.chars + delete_start, delete_length);
+                    if(common_length != 0)
+                    {
+                        diffs->items[pointer].start  -= common_length;
+                        diffs->items[pointer].length += common_length;
+                        insert_length -= common_length;
+                        delete_length -= common_length;
+                    }
+                }
+
+                // Delete the offending records and add the merged ones, unless factoring emptied them.
+                position = pointer - count_delete - count_insert;
+                pointer  = position;
+                diff_list_remove(diffs, position, count_delete + count_insert);
+                if(insert_length != 0)
+                {
+                    diff_list_insert(diffs, position, DMP_DIFF_INSERT, insert_start, insert_length);
+                    pointer++;
+                }
+                if(delete_length != 0)
+                {
+                    diff_list_insert(diffs, position, DMP_DIFF_DELETE, delete_start, delete_length);
+                    pointer++;
                 }
             }
+
+            if(pointer > 0 && diffs->items[pointer - 1].operation == DMP_DIFF_EQUAL)
+            {
+                // Merge this equality with the previous one.
+                diffs->items[pointer - 1].length += diffs->items[pointer].length;
+                diff_list_remove(diffs, pointer, 1);
+            } else {
+                pointer++;
+            }
+
+            count_insert  = 0;
+            count_delete  = 0;
+            delete_length = 0;
+            insert_length = 0;
         }
+    }
+
+    // Remove the dummy entry at the end.
+    if(diffs->count > 0 && diffs->items[diffs->count - 1].length == 0)
+    {
+        diffs->count--;
+    }
+
+    // Second pass: look for single edits surrounded on both sides by equalities
+    // which can be shifted sideways to eliminate an equality.
+    // e.g: A<ins>BA</ins>C -> <ins>AB</ins>AC
+    changes = false;
+    pointer = 1;
+
+    // Intentionally ignore the first and last element (don't need checking).
+    while(pointer < diffs->count - 1)
+    {
+        prev = &diffs->items[pointer - 1];
+        diff = &diffs->items[pointer];
+        next = &diffs->items[pointer + 1];
 
-        for(k2 = -d + k2start; k2 <= d - k2end; k2 += 2)
+        if(prev->operation == DMP_DIFF_EQUAL && next->operation == DMP_DIFF_EQUAL)
         {
-            k2_offset = v_offset + k2;
-            if(k2 == -d || (k2 != d && v2[k2_offset - 1] < v2[k2_offset + 1]))
+            // This is a single edit surrounded by equalities.
+            if(prev->length == 0 ? diff->length == 0 :
+               prev->length <= diff->length &&
+               chars_equal(diff_chars(ctx, diff) + diff->length - prev->length, diff_chars(ctx, prev), prev->length))
             {
-                x2 = v2[k2_offset + 1];
-            } else {
-                x2 = v2[k2_offset - 1] + 1;
+                // Shift the edit over the previous equality.
+                changes       = true;
+                diff->start  -= prev->length;
+                next->start  -= prev->length;
+                next->length += prev->length;
+                diff_list_remove(diffs, pointer - 1, 1);
+            } else if(next->length <= diff->length &&
+                      chars_equal(diff_chars(ctx, diff), diff_chars(ctx, next), next->length)) {
+                // Shift the edit over the next equality.
+                changes       = true;
+                prev->length += next->length;
+                diff->start  += next->length;
+                diff_list_remove(diffs, pointer + 1, 1);
             }
+        }
+        pointer++;
+    }
+
+    // If shifts were made, the diff needs reordering and another shift sweep.
+    if(changes)
+    {
+        dmp_diff_cleanup_merge(ctx, diffs);
+    }
+}
+
+// Character classes of the semantic score, looked up in the Onigmo tables of the
+// encoding like the POSIX bracket expressions of the Ruby version. Invalid bytes
+// belong to no class.
+#define DMP_CHAR_IS(ctype, c, enc) ((c) >= 0 && ONIGENC_IS_CODE_CTYPE((enc), (OnigCodePoint)(c), (ctype)))
+
+// Ruby equivalent code: text =~ /\n\r?\n$/
+static bool has_line_end(const long *text, long length)
+{
+    long i, j;
+
+    for(i = 0; i < length; i++)
+    {
+        if(text[i] != '\n') continue;
+
+        j = i + 1;
+        if(j < length && text[j] == '\r') j++;
+        if(j < length && text[j] == '\n' && (j + 1 == length || text[j + 1] == '\n')) return true;
+    }
+
+    return false;
+}
+
+// Ruby equivalent code: text =~ /^\r?\n\r?\n/
+static bool has_line_start(const long *text, long length)
+{
+    long i, j;
+
+    for(i = 0; i < length; i++)
+    {
+        if(i > 0 && text[i - 1] != '\n') continue;
 
-            y2 = x2 - k2;
-            while(x2 < text1_length &&
-                  y2 < text2_length &&
-                  DMP_CMP(dmp_text1.chars[text1_length - x2 - 1],
-                          dmp_text2.chars[text2_length - y2 - 1])
-                    )
+        j = i;
+        if(j < length && text[j] == '\r') j++;
+        if(!(j < length && text[j] == '\n')) continue;
+        j++;
+        if(j < length && text[j] == '\r') j++;
+        if(j < length && text[j] == '\n') return true;
+    }
+
+    return false;
+}
+
+// Given two strings, compute a score representing whether the
+// internal boundary falls on logical boundaries.
+// Scores range from 5 (best) to 0 (worst).
+// Ruby equivalent code: diff_cleanup_semantic_score(one, two)
+static int semantic_score(rb_encoding *enc, const long *one, long one_length, const long *two, long two_length)
+{
+    long one_char, two_char;
+    int score = 0;
+
+    if(one_length == 0 || two_length == 0)
+    {
+        return 5; // Edges are the best.
+    }
+
+    one_char = one[one_length - 1];
+    two_char = two[0];
+
+    // One point for non-alphanumeric.
+    if(!DMP_CHAR_IS(ONIGENC_CTYPE_ALNUM, one_char, enc) || !DMP_CHAR_IS(ONIGENC_CTYPE_ALNUM, two_char, enc))
+    {
+        score++;
+        // Two points for whitespace.
+        if(DMP_CHAR_IS(ONIGENC_CTYPE_SPACE, one_char, enc) || DMP_CHAR_IS(ONIGENC_CTYPE_SPACE, two_char, enc))
+        {
+            score++;
+            // Three points for line breaks.
+            if(DMP_CHAR_IS(ONIGENC_CTYPE_CNTRL, one_char, enc) || DMP_CHAR_IS(ONIGENC_CTYPE_CNTRL, two_char, enc))
             {
-                x2++;
-                y2++;
+                score++;
+                // Four points for blank lines.
+                if(has_line_end(one, one_length) || has_line_start(two, two_length))
+                {
+                    score++;
+                }
             }
+        }
+    }
+
+    return score;
+}
+
+// Look for single edits surrounded on both sides by equalities
+// which can be shifted sideways to align the edit to a word boundary.
+// e.g: The c<ins>at c</ins>ame. -> The <ins>cat </ins>came.
+// Ruby equivalent code: diff_cleanup_semantic_lossless(diffs)
+void dmp_diff_cleanup_semantic_lossless(const DMPDiffContext *ctx, DMPDiffList *diffs)
+{
+    const long *text1 = ctx->text1.chars;
+    const long *edit_text;
+    DMPDiff *prev, *diff, *next;
+    long pointer = 1;
+    long shift, best_shift, common_offset;
+    int score, best_score;
+    bool drop_prev, drop_next;
+
+    // Intentionally ignore the first and last element (don't need checking).
+    while(pointer < diffs->count - 1)
+    {
+        prev = &diffs->items[pointer - 1];
+        diff = &diffs->items[pointer];
+        next = &diffs->items[pointer + 1];
+
+        if(prev->operation == DMP_DIFF_EQUAL && next->operation == DMP_DIFF_EQUAL)
+        {
+            // This is a single edit surrounded by equalities. Rather than building the
+            // strings, `shift` tracks how far the edit moved relative to its start.
+            edit_text = diff->operation == DMP_DIFF_INSERT ? ctx->text2.chars : text1;
+
+            // First, shift the edit as far left as possible.
+            common_offset = common_suffix(text1 + prev->start, prev->length, edit_text + diff->start, diff->length);
+            shift         = -common_offset;
 
-            v2[k2_offset] = x2;
-            if(x2 > text1_length)
+            // Second, step character by character right, looking for the best fit.
+            best_shift = shift;
+            best_score = semantic_score(ctx->enc, text1 + prev->start, prev->length + shift, edit_text + diff->start + shift, diff->length) +
+                         semantic_score(ctx->enc, edit_text + diff->start + shift, diff->length, text1 + next->start + shift, next->length - shift);
+
+            while(diff->length > 0 && next->length - shift > 0 &&
+                  DMP_CMP(edit_text[diff->start + shift], text1[next->start + shift]))
             {
-                k2end += 2;
-            } else if(y2 > text2_length) {
-                k2start += 2;
-            } else if(!front) {
-                k1_offset = v_offset + delta - k2;
-                if(k1_offset >= 0 && k1_offset < v_length && v1[k1_offset] != -1)
+                shift++;
+                score = semantic_score(ctx->enc, text1 + prev->start, prev->length + shift, edit_text + diff->start + shift, diff->length) +
+                        semantic_score(ctx->enc, edit_text + diff->start + shift, diff->length, text1 + next->start + shift, next->length - shift);
+
+                // The >= encourages trailing rather than leading whitespace on edits.
+                if(score >= best_score)
                 {
-                    x1 = v1[k1_offset];
-                    y1 = v_offset + x1 - k1_offset;
-                    x2 = text1_length - x2;
-                    if(x1 >= x2) {
-                        FREE_DMP_STR2(dmp_text1, dmp_text2);
-                        return rb_funcall(self, dmp_diff_bisect_split_id, 5, text1, text2, INT2FIX(x1), INT2FIX(y1), deadline);
-                    }
+                    best_score = score;
+                    best_shift = shift;
+                }
+            }
+
+            if(best_shift != 0)
+            {
+                // We have an improvement, save it back to the diff.
+                diff->start  += best_shift;
+                next->start  += best_shift;
+                next->length -= best_shift;
+                prev->length += best_shift;
+                drop_prev     = prev->length == 0;
+                drop_next     = next->length == 0;
+
+                if(drop_next)
+                {
+                    diff_list_remove(diffs, pointer + 1, 1);
+                    pointer--;
+                }
+
+                if(drop_prev)
+                {
+                    diff_list_remove(diffs, pointer - (drop_next ? 0 : 1), 1);
+                    pointer--;
                 }
             }
         }
+
+        pointer++;
     }
+}
 
+// Compute the Levenshtein distance; the number of inserted, deleted or substituted characters.
+// Ruby equivalent code: diff_levenshtein(diffs)
+long dmp_diff_levenshtein(const DMPDiffList *diffs)
+{
+    long levenshtein = 0;
+    long insertions  = 0;
+    long deletions   = 0;
+    long i;
 
-    FREE_DMP_STR2(dmp_text1, dmp_text2);
-    return rb_ary_new_from_args(
-            2,
-            rb_funcall(self, dmp_new_delete_node_id, 1, text1),
-            rb_funcall(self, dmp_new_insert_node_id, 1, text2)
-    );
-}
\ No newline at end of file
+    for(i = 0; i < diffs->count; i++)
+    {
+        if(diffs->items[i].operation == DMP_DIFF_INSERT)
+        {
+            insertions += diffs->items[i].length;
+        } else if(diffs->items[i].operation == DMP_DIFF_DELETE) {
+            deletions += diffs->items[i].length;
+        } else {
+            // A deletion and an insertion is one substitution.
+            levenshtein += DMP_MAX(insertions, deletions);
+            insertions   = 0;
+            deletions    = 0;
+        }
+    }
+
+    return levenshtein + DMP_MAX(insertions, deletions);
+}
+
+// Translate a location in text1 to the equivalent location in text2.
+// Ruby equivalent code: diff_index(diffs, loc)
+long dmp_diff_index(const DMPDiffList *diffs, long loc)
+{
+    long chars1      = 0;
+    long chars2      = 0;
+    long last_chars1 = 0;
+    long last_chars2 = 0;
+    long i;
+
+    for(i = 0; i < diffs->count; i++)
+    {
+        if(diffs->items[i].operation != DMP_DIFF_INSERT) chars1 += diffs->items[i].length;
+        if(diffs->items[i].operation != DMP_DIFF_DELETE) chars2 += diffs->items[i].length;
+
+        // Overshot the location.
+        if(chars1 > loc) break;
+
+        last_chars1 = chars1;
+        last_chars2 = chars2;
+    }
+
+    // The location was deleted.
+    if(i != diffs->count && diffs->items[i].operation == DMP_DIFF_DELETE)
+    {
+        return last_chars2;
+    }
+
+    // Add the remaining character length.
+    return last_chars2 + (loc - last_chars1);
+}
+
+// Ruby equivalent code: deadline.to_f
+static double deadline_seconds(VALUE deadline)
+{
+    struct timespec time;
+
+    if(NIL_P(deadline))
+    {
+        return 0;
+    }
+
+    time = rb_time_timespec(deadline);
+    return (double)time.tv_sec + (double)time.tv_nsec / 1e9;
+}
+
+// Set up a native diff of two Ruby strings with the settings of the instance.
+// text1 is only converted when its codepoints aren't given as chars1.
+static void diff_context(VALUE self, VALUE text1, VALUE text2, double deadline, const DMPString *chars1,
+                         DMPCancel *cancel, DMPDiffContext *ctx)
+{
+    StringValue(text1);
+    StringValue(text2);
+
+    ctx->enc        = rb_enc_check(text1, text2);
+    ctx->half_match = NUM2DBL(rb_iv_get(self, "@diff_timeout")) > 0;
+    ctx->parallel_passes = RTEST(rb_iv_get(self, "@diff_parallel_passes"));
+    ctx->deadline   = deadline;
+    ctx->cancel     = cancel;
+    ctx->progress   = NULL;
+    ctx->text1      = chars1 != NULL ? *chars1 : rb_str_to_dmp_chars(text1);
+    ctx->text2      = rb_str_to_dmp_chars(text2);
+}
+
+// Build the DiffNodes of a native diff list
+static VALUE diff_list_to_nodes(const DMPDiffContext *ctx, const DMPDiffList *diffs)
+{
+    const VALUE result = rb_ary_new_capa(diffs->count);
+    long i;
+
+    for(i = 0; i < diffs->count; i++)
+    {
+        const DMPDiff *diff = &diffs->items[i];
+        const VALUE operation = diff->operation == DMP_DIFF_INSERT ? dmp_insert_sym :
+                                diff->operation == DMP_DIFF_DELETE ? dmp_delete_sym : dmp_equal_sym;
+
+        rb_ary_push(result, dmp_new_node(operation, dmp_chars_to_rb_str(diff_chars(ctx, diff), diff->length, ctx->enc)));
+    }
+
+    return result;
+}
+
+static void *bisect_without_gvl(void *data)
+{
+    const DMPDiffContext *ctx = ((void **)data)[0];
+    DMPDiffList *diffs        = ((void **)data)[1];
+
+    native_diff_bisect(ctx, ctx->text1, ctx->text2, diffs);
+    return NULL;
+}
+
+// Find the 'middle snake' of a diff, split the problem in two
+// and return the recursively constructed diff.
+// See Myers 1986 paper: An O(ND) Difference Algorithm and Its Variations.
+// Runs on the native engine with the GVL released, recursing without diff_bisect_split.
+// Resolved characters are added to the optional Progress.
+// Ruby equivalent code: diff_bisect(text1, text2, deadline, cancel = nil, progress = nil)
+static VALUE diff_bisect(int argc, VALUE *argv, VALUE self)
+{
+    DMPDiffContext ctx;
+    DMPDiffList diffs;
+    DMPCancel cancel = { false, NULL, 0 };
+    void *job[2]     = { &ctx, &diffs };
+    VALUE text1, text2, deadline, token, progress, result;
+
+    rb_scan_args(argc, argv, "32", &text1, &text2, &deadline, &token, &progress);
+    cancel.token = dmp_cancel_token(token);
+
+    diff_context(self, text1, text2, deadline_seconds(deadline), NULL, &cancel, &ctx);
+    ctx.progress = dmp_progress_get(progress);
+    dmp_diff_list_init(&diffs);
+    dmp_without_gvl(bisect_without_gvl, job, &cancel);
+
+    // Stopped early, the native buffers go before anything is raised
+    if(DMP_CANCELLED(&cancel))
+    {
+        dmp_diff_list_free(&diffs);
+        FREE_DMP_STR2(ctx.text1, ctx.text2);
+        dmp_check_cancel(&cancel);
+        return diff_bisect(argc, argv, self);
+    }
+
+    result = diff_list_to_nodes(&ctx, &diffs);
+    dmp_diff_list_free(&diffs);
+    FREE_DMP_STR2(ctx.text1, ctx.text2);
+
+    return result;
+}
+
+static void diff_pair_task(void *data, long index)
+{
+    const DMPDiffPairs *pairs = data;
+    DMPDiffPair *pair         = &pairs->items[index];
+
+    // Each pair of a batch gets the whole timeout from the moment it starts
+    if(pairs->timeout > 0)
+    {
+        pair->ctx.deadline = dmp_time_now() + pairs->timeout;
+    }
+    dmp_diff_main(&pair->ctx, pair->ctx.text1, pair->ctx.text2, &pair->diffs);
+}
+
+static void diff_pairs_free(DMPDiffPairs *pairs)
+{
+    long i;
+
+    for(i = 0; i < pairs->count; i++)
+    {
+        dmp_diff_list_free(&pairs->items[i].diffs);
+        xfree(pairs->items[i].ctx.text2.chars);
+        if(pairs->base.chars == NULL)
+        {
+            xfree(pairs->items[i].ctx.text1.chars);
+        }
+    }
+    xfree(pairs->items);
+    pairs->items = NULL;
+    pairs->count = 0;
+}
+
+static void *diff_pairs_without_gvl(void *data)
+{
+    DMPDiffPairs *pairs = data;
+
+    dmp_pool_run_limited(pairs->count, diff_pair_task, pairs, pairs->threads);
+    return NULL;
+}
+
+// Check pairs[offset, count] before anything is allocated
+// Returns: the [text1, text2] string pairs
+static VALUE check_pairs(VALUE pairs, long offset, long count)
+{
+    const VALUE checked = rb_ary_new_capa(count);
+    VALUE pair, text1, text2;
+    long i;
+
+    for(i = offset; i < offset + count; i++)
+    {
+        pair = rb_check_array_type(RARRAY_AREF(pairs, i));
+        if(NIL_P(pair) || RARRAY_LEN(pair) != 2)
+        {
+            rb_raise(rb_eArgError, "expected [text1, text2] pairs");
+        }
+        text1 = RARRAY_AREF(pair, 0);
+        text2 = RARRAY_AREF(pair, 1);
+        StringValue(text1);
+        StringValue(text2);
+        rb_enc_check(text1, text2);
+        rb_ary_push(checked, rb_assoc_new(text1, text2));
+    }
+
+    return checked;
+}
+
+// Convert the checked pairs and diff them with the GVL released
+// Returns: the diffs of every pair
+static VALUE diff_checked_pairs(VALUE self, VALUE checked, double deadline, DMPDiffPairs *job)
+{
+    VALUE result, pair;
+    long i;
+
+    job->items = ALLOC_N(DMPDiffPair, (size_t)RARRAY_LEN(checked));
+    for(job->count = 0; job->count < RARRAY_LEN(checked); job->count++)
+    {
+        pair = RARRAY_AREF(checked, job->count);
+        diff_context(self, RARRAY_AREF(pair, 0), RARRAY_AREF(pair, 1), deadline,
+                     job->base.chars != NULL ? &job->base : NULL, &job->cancel, &job->items[job->count].ctx);
+        job->items[job->count].ctx.progress = job->progress;
+        dmp_diff_list_init(&job->items[job->count].diffs);
+    }
+
+    job->cancel.interrupted = false;
+    dmp_without_gvl(diff_pairs_without_gvl, job, &job->cancel);
+
+    // Stopped early, the native buffers go before anything is raised
+    if(DMP_CANCELLED(&job->cancel))
+    {
+        diff_pairs_free(job);
+        dmp_check_cancel(&job->cancel);
+        return diff_checked_pairs(self, checked, deadline, job);
+    }
+
+    result = rb_ary_new_capa(job->count);
+    for(i = 0; i < job->count; i++)
+    {
+        rb_ary_push(result, diff_list_to_nodes(&job->items[i].ctx, &job->items[i].diffs));
+    }
+    diff_pairs_free(job);
+
+    return result;
+}
+
+// Diff every [text1, text2] pair concurrently on the worker pool with the GVL released.
+// Returns: the diffs of every pair, each the same as diff_main(text1, text2, false, deadline)
+// Ruby equivalent code: diff_main_parallel(pairs, deadline, cancel = nil, progress = nil)
+static VALUE diff_main_parallel(int argc, VALUE *argv, VALUE self)
+{
+    DMPDiffPairs job = { 0, NULL, 0, 0, { 0, NULL }, { false, NULL, 0 }, NULL };
+    VALUE pairs, deadline, token, progress;
+
+    rb_scan_args(argc, argv, "22", &pairs, &deadline, &token, &progress);
+    Check_Type(pairs, T_ARRAY);
+    job.cancel.token = dmp_cancel_token(token);
+    job.progress     = dmp_progress_get(progress);
+
+    return diff_checked_pairs(self, check_pairs(pairs, 0, RARRAY_LEN(pairs)), deadline_seconds(deadline), &job);
+}
+
+// Diff the pairs DMP_BATCH_CHUNK at a time, so only one chunk is converted at once.
+// The diffs of every pair are the same as diff_main(text1, text2, false), with its own @diff_timeout.
+// With a block the diffs and index of every pair are yielded once its chunk is done, in input order.
+// Returns: the diffs of every pair, or nil with a block
+static VALUE diff_pairs(VALUE self, VALUE pairs, VALUE threads)
+{
+    const double timeout = NUM2DBL(rb_iv_get(self, "@diff_timeout"));
+    const bool yield     = rb_block_given_p();
+    DMPDiffPairs job     = { 0, NULL, NUM2LONG(threads), timeout, { 0, NULL }, { false, NULL, 0 }, NULL };
+    VALUE result         = Qnil;
+    VALUE chunk;
+    long offset, count, i;
+
+    Check_Type(pairs, T_ARRAY);
+    if(!yield)
+    {
+        result = rb_ary_new_capa(RARRAY_LEN(pairs));
+    }
+
+    for(offset = 0; offset < RARRAY_LEN(pairs); offset += count)
+    {
+        count = DMP_MIN(RARRAY_LEN(pairs) - offset, DMP_BATCH_CHUNK);
+        chunk = diff_checked_pairs(self, check_pairs(pairs, offset, count), 0, &job);
+
+        for(i = 0; i < count; i++)
+        {
+            if(yield)
+            {
+                rb_yield_values(2, RARRAY_AREF(chunk, i), LONG2NUM(offset + i));
+            } else {
+                rb_ary_push(result, RARRAY_AREF(chunk, i));
+            }
+        }
+    }
+
+    return result;
+}
+
+// Check candidates[offset, count] before anything is allocated
+// Returns: the [base, candidate] string pairs
+static VALUE check_candidates(VALUE base, VALUE candidates, long offset, long count)
+{
+    const VALUE checked = rb_ary_new_capa(count);
+    VALUE candidate;
+    long i;
+
+    for(i = offset; i < offset + count; i++)
+    {
+        candidate = RARRAY_AREF(candidates, i);
+        StringValue(candidate);
+        rb_enc_check(base, candidate);
+        rb_ary_push(checked, rb_assoc_new(base, candidate));
+    }
+
+    return checked;
+}
+
+static VALUE diff_base_body(VALUE data)
+{
+    VALUE *args       = (VALUE *)data;
+    DMPDiffPairs *job = (DMPDiffPairs *)args[3];
+    const VALUE result = rb_ary_new_capa(RARRAY_LEN(args[2]));
+    long offset, count;
+
+    for(offset = 0; offset < RARRAY_LEN(args[2]); offset += count)
+    {
+        count = DMP_MIN(RARRAY_LEN(args[2]) - offset, DMP_BATCH_CHUNK);
+        rb_ary_concat(result, diff_checked_pairs(args[0], check_candidates(args[1], args[2], offset, count), 0, job));
+    }
+
+    return result;
+}
+
+static VALUE diff_base_cleanup(VALUE data)
+{
+    DMPDiffPairs *job = (DMPDiffPairs *)((VALUE *)data)[3];
+
+    diff_pairs_free(job);
+    xfree(job->base.chars);
+    return Qnil;
+}
+
+// Diff one base text against every candidate, the base is converted to codepoints once and shared by all diffs.
+// The candidates are converted DMP_BATCH_CHUNK at a time and diffed on up to the given number of threads.
+// Returns: the diffs of every candidate, each the same as diff_main(base, candidate, false) with its own @diff_timeout
+static VALUE diff_base_pairs(VALUE self, VALUE base, VALUE candidates, VALUE threads)
+{
+    DMPDiffPairs job = { 0, NULL, NUM2LONG(threads), NUM2DBL(rb_iv_get(self, "@diff_timeout")), { 0, NULL }, { false, NULL, 0 }, NULL };
+    VALUE args[4]    = { self, base, candidates, (VALUE)&job };
+
+    StringValue(base);
+    Check_Type(candidates, T_ARRAY);
+    args[1]  = base;
+    job.base = rb_str_to_dmp_chars(base);
+
+    // The base buffer outlives every chunk, it's freed even when a candidate raises
+    return rb_ensure(diff_base_body, (VALUE)args, diff_base_cleanup, (VALUE)args);
+}
@@ -1,6 +1,105 @@
 #ifndef FAST_DIFF_MATCH_PATCH_DIFF_H
 #define FAST_DIFF_MATCH_PATCH_DIFF_H
 
+#include "progress.h"
+
+#define DMP_DIFF_DELETE         -1
+#define DMP_DIFF_EQUAL           0
+#define DMP_DIFF_INSERT          1
+
+// A single native diff operation. The text is not copied:
+// equalities and deletions point into text1, insertions into text2.
+typedef struct DMPDiff
+{
+    int operation;
+    long start;
+    long length;
+} DMPDiff;
+
+typedef struct DMPDiffList
+{
+    DMPDiff *items;
+    long count;
+    long capa;
+} DMPDiffList;
+
+// Root texts and settings shared by every level of a native diff.
+// All DMPDiff starts are offsets into text1 and text2.
+typedef struct DMPDiffContext
+{
+    DMPString text1;
+    DMPString text2;
+    rb_encoding *enc;     // Encoding of the codepoints
+    double deadline;      // Absolute time in seconds, 0 for no deadline
+    DMPCancel *cancel;       // Gives up like the deadline once cancelled, NULL to never stop
+    DMPProgress *progress;   // Resolved characters are added here, NULL to not report
+    bool half_match;      // Ruby equivalent code: diff_timeout.positive?
+    bool parallel_passes; // Ruby equivalent code: diff_parallel_passes
+} DMPDiffContext;
+
+// One side of a split bisect, diffed into its own list so both sides can run concurrently
+typedef struct DMPBisectHalf
+{
+    const DMPDiffContext *ctx;
+    DMPString text1;
+    DMPString text2;
+    DMPDiffList diffs;
+} DMPBisectHalf;
+
+// Bisect iterations (d) below this stay serial even with parallel_passes set
+#define DMP_BISECT_PASSES_MIN_D 256
+
+// Myers search state of one bisect, shared by the forward and reverse passes
+typedef struct DMPBisectState
+{
+    DMPString text1;
+    DMPString text2;
+    long delta;
+    bool front;         // Overlaps are found by the forward pass
+    long v_offset;      // Also max_d
+    long v_length;
+    long *v1;           // Forward frontier, furthest x of each diagonal
+    long *v2;           // Reverse frontier
+    long k1start, k1end, k2start, k2end;
+    long d;
+    long k2_first;      // Reverse diagonals visited in iteration d
+    long k2_last;
+    bool found;
+    long x;             // Middle snake
+    long y;
+} DMPBisectState;
+
+// Number of texts patch_apply_padded or pairs diff_pairs converts to codepoints at a time
+#define DMP_BATCH_CHUNK         256
+
+// One independent diff of diff_main_parallel or diff_batch
+typedef struct DMPDiffPair
+{
+    DMPDiffContext ctx;
+    DMPDiffList diffs;
+} DMPDiffPair;
+
+typedef struct DMPDiffPairs
+{
+    long count;
+    DMPDiffPair *items;
+    long threads;   // Most pairs diffed at once, 0 for the whole pool
+    double timeout; // Seconds per pair from the moment it starts, 0 to keep each ctx.deadline
+    DMPString base; // Codepoints of a text1 shared by all pairs, chars are NULL when each pair has its own
+    DMPCancel cancel;
+    DMPProgress *progress;
+} DMPDiffPairs;
+
 extern void dmp_init_diff();
 
+// Native diff engine, none of these touch Ruby objects and are safe to run without the GVL
+extern double dmp_time_now();
+extern void dmp_diff_list_init(DMPDiffList *list);
+extern void dmp_diff_list_free(DMPDiffList *list);
+extern void dmp_diff_main(const DMPDiffContext *ctx, DMPString text1, DMPString text2, DMPDiffList *diffs);
+extern void dmp_diff_cleanup_merge(const DMPDiffContext *ctx, DMPDiffList *diffs);
+extern void dmp_diff_cleanup_semantic_lossless(const DMPDiffContext *ctx, DMPDiffList *diffs);
+extern long dmp_diff_levenshtein(const DMPDiffList *diffs);
+extern long dmp_diff_index(const DMPDiffList *diffs, long loc);
+
 #endif //FAST_DIFF_MATCH_PATCH_DIFF_H
@@ -0,0 +1,429 @@
+#include "fast_diff_match_patch.h"
+#include "document.h"
+#include "token.h"
+#include "hash.h"
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static VALUE document_initialize(VALUE self, VALUE text);
+static VALUE document_load(VALUE klass, VALUE binary);
+static VALUE document_dump(VALUE self);
+static VALUE document_text(VALUE self);
+static VALUE document_bytesize(VALUE self);
+static VALUE document_line_count(VALUE self);
+static VALUE document_content_hash(VALUE self);
+static VALUE document_encoding(VALUE self);
+static VALUE document_mapped_p(VALUE self);
+static VALUE diff_documents_to_chars(VALUE self, VALUE document1, VALUE document2);
+#ifdef HAVE_SYS_MMAN_H
+static VALUE document_map(VALUE klass, VALUE path);
+#endif
+
+static void document_free(void *data);
+static size_t document_memsize(const void *data);
+
+static const rb_data_type_t document_type = {
+    "FastDiffMatchPatch::TokenizedDocument",
+    { NULL, document_free, document_memsize, },
+    NULL, NULL, RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+static VALUE document_alloc(VALUE klass);
+
+void dmp_init_document()
+{
+    const VALUE document_klass = rb_define_class_under(dmp_klass, "TokenizedDocument", rb_cObject);
+
+    rb_define_alloc_func(document_klass, document_alloc);
+    rb_define_singleton_method(document_klass, "load", RUBY_METHOD_FUNC(document_load), 1);
+#ifdef HAVE_SYS_MMAN_H
+    rb_define_singleton_method(document_klass, "map", RUBY_METHOD_FUNC(document_map), 1);
+#endif
+    rb_define_method(document_klass, "initialize", RUBY_METHOD_FUNC(document_initialize), 1);
+    rb_define_method(document_klass, "dump", RUBY_METHOD_FUNC(document_dump), 0);
+    rb_define_method(document_klass, "text", RUBY_METHOD_FUNC(document_text), 0);
+    rb_define_method(document_klass, "bytesize", RUBY_METHOD_FUNC(document_bytesize), 0);
+    rb_define_method(document_klass, "line_count", RUBY_METHOD_FUNC(document_line_count), 0);
+    rb_define_method(document_klass, "content_hash", RUBY_METHOD_FUNC(document_content_hash), 0);
+    rb_define_method(document_klass, "encoding", RUBY_METHOD_FUNC(document_encoding), 0);
+    rb_define_method(document_klass, "mapped?", RUBY_METHOD_FUNC(document_mapped_p), 0);
+
+    rb_define_private_method(dmp_klass, "diff_documents_to_chars", RUBY_METHOD_FUNC(diff_documents_to_chars), 2);
+}
+
+static void document_release(DMPDocument *document)
+{
+    if(document->data == NULL)
+    {
+        return;
+    }
+
+#ifdef HAVE_SYS_MMAN_H
+    if(document->mapped)
+    {
+        munmap(document->data, document->size);
+    } else {
+        DMP_NATIVE_FREE(document->data);
+    }
+#else
+    DMP_NATIVE_FREE(document->data);
+#endif
+
+    memset(document, 0, sizeof(DMPDocument));
+}
+
+static void document_free(void *data)
+{
+    document_release(data);
+    xfree(data);
+}
+
+static size_t document_memsize(const void *data)
+{
+    const DMPDocument *document = data;
+    return sizeof(DMPDocument) + (document->mapped ? 0 : document->size);
+}
+
+static VALUE document_alloc(VALUE klass)
+{
+    DMPDocument *document;
+
+    return TypedData_Make_Struct(klass, DMPDocument, &document_type, document);
+}
+
+static DMPDocument *get_document(VALUE self)
+{
+    DMPDocument *document;
+
+    TypedData_Get_Struct(self, DMPDocument, &document_type, document);
+    if(document->data == NULL)
+    {
+        rb_raise(rb_eRuntimeError, "uninitialized TokenizedDocument");
+    }
+
+    return document;
+}
+
+static uint64_t document_size(uint64_t line_count, uint64_t text_size)
+{
+    return sizeof(DMPDocumentHeader) + sizeof(uint64_t) * (line_count + 1) + sizeof(uint64_t) * line_count +
+           DMP_DOCUMENT_ALIGN(sizeof(uint32_t) * line_count) + text_size;
+}
+
+// Points the sections into the data, which must hold a header
+static void document_layout(DMPDocument *document)
+{
+    const char *data = document->data;
+    uint64_t line_count;
+
+    document->header  = (const DMPDocumentHeader *)data;
+    line_count        = document->header->line_count;
+    document->offsets = (const uint64_t *)(data + sizeof(DMPDocumentHeader));
+    document->hashes  = document->offsets + line_count + 1;
+    document->ids     = (const uint32_t *)(document->hashes + line_count);
+    document->text    = (const char *)document->ids + DMP_DOCUMENT_ALIGN(sizeof(uint32_t) * line_count);
+}
+
+static uint32_t swap32(uint32_t value)
+{
+    return ((value & 0xFF) << 24) | ((value & 0xFF00) << 8) | ((value >> 8) & 0xFF00) | (value >> 24);
+}
+
+// Raises unless the data is a whole document, afterwards the sections are used without further checks.
+// The content hash isn't verified, that would read the whole text.
+static void document_check(DMPDocument *document)
+{
+    const DMPDocumentHeader *header = document->data;
+    uint64_t line_count, i;
+
+    if(document->size < sizeof(DMPDocumentHeader) || memcmp(header->magic, DMP_DOCUMENT_MAGIC, DMP_DOCUMENT_MAGIC_LEN) != 0)
+    {
+        rb_raise(rb_eArgError, "Invalid tokenized document: missing header");
+    }
+
+    if(header->version != DMP_DOCUMENT_VERSION)
+    {
+        if(swap32(header->version) == DMP_DOCUMENT_VERSION)
+        {
+            rb_raise(rb_eArgError, "Invalid tokenized document: written with another byte order");
+        }
+        rb_raise(rb_eArgError, "Invalid tokenized document: unsupported version %u", (unsigned int)header->version);
+    }
+
+    if(memchr(header->encoding, '\0', DMP_DOCUMENT_ENCODING_LEN) == NULL ||
+       (document->encoding = rb_enc_find_index(header->encoding)) < 0)
+    {
+        rb_raise(rb_eArgError, "Invalid tokenized document: unknown encoding");
+    }
+
+    line_count = header->line_count;
+    if(line_count > document->size / sizeof(uint64_t) || header->text_size > document->size ||
+       document_size(line_count, header->text_size) != document->size || header->distinct_count > line_count)
+    {
+        rb_raise(rb_eArgError, "Invalid tokenized document: size mismatch");
+    }
+
+    document_layout(document);
+    if(document->offsets[0] != 0 || document->offsets[line_count] != header->text_size)
+    {
+        rb_raise(rb_eArgError, "Invalid tokenized document: line offsets don't cover the text");
+    }
+
+    for(i = 0; i < line_count; i++)
+    {
+        if(document->offsets[i] > document->offsets[i + 1] || document->ids[i] >= header->distinct_count)
+        {
+            rb_raise(rb_eArgError, "Invalid tokenized document: corrupt line %lu", (unsigned long)i);
+        }
+    }
+}
+
+// Splits the text into lines and hashes them, once for every later diff
+// Ruby equivalent code: TokenizedDocument.new("alpha\nbeta\n")
+static VALUE document_initialize(VALUE self, VALUE text)
+{
+    DMPDocument *document;
+    DMPDocumentHeader *header;
+    rb_encoding *enc;
+    const char *ptr, *end, *next;
+    uint64_t *offsets, *hashes;
+    uint32_t *ids;
+    char *copy;
+    DMPTokenTable table;
+    DMPToken *token = NULL;
+    uint64_t line_count = 0, distinct_count = 0, i;
+    size_t size;
+
+    TypedData_Get_Struct(self, DMPDocument, &document_type, document);
+    StringValue(text);
+
+    enc = rb_enc_get(text);
+    if(strlen(rb_enc_name(enc)) >= DMP_DOCUMENT_ENCODING_LEN)
+    {
+        rb_raise(rb_eArgError, "unsupported encoding: %s", rb_enc_name(enc));
+    }
+
+    // Ruby equivalent code: text.each_line.count
+    ptr = RSTRING_PTR(text);
+    end = RSTRING_END(text);
+    while(ptr < end)
+    {
+        ptr = dmp_line_end(ptr, end, enc);
+        line_count++;
+    }
+
+    document_release(document);
+    size           = (size_t)document_size(line_count, (uint64_t)RSTRING_LEN(text));
+    document->data = DMP_NATIVE_ALLOC_N(char, size);
+    document->size = size;
+    memset(document->data, 0, size);
+
+    header = document->data;
+    memcpy(header->magic, DMP_DOCUMENT_MAGIC, DMP_DOCUMENT_MAGIC_LEN);
+    header->version      = DMP_DOCUMENT_VERSION;
+    header->content_hash = dmp_content_hash(RSTRING_PTR(text), (size_t)RSTRING_LEN(text));
+    header->text_size    = (uint64_t)RSTRING_LEN(text);
+    header->line_count   = line_count;
+    strcpy(header->encoding, rb_enc_name(enc));
+
+    document_layout(document);
+    document->encoding = rb_enc_to_index(enc);
+    offsets = (uint64_t *)document->offsets;
+    hashes  = (uint64_t *)document->hashes;
+    ids     = (uint32_t *)document->ids;
+    copy    = (char *)document->text;
+    memcpy(copy, RSTRING_PTR(text), (size_t)RSTRING_LEN(text));
+
+    // Lines are interned from the copy, which lives as long as the document
+    dmp_token_table_init(&table, 0);
+    ptr = copy;
+    end = copy + RSTRING_LEN(text);
+    for(i = 0; i < line_count; i++)
+    {
+        next  = dmp_line_end(ptr, end, enc);
+        token = dmp_token_intern(&table, ptr, next - ptr, (long)distinct_count + 1);
+        if(token->id == (long)distinct_count + 1)
+        {
+            distinct_count++;
+        }
+
+        offsets[i] = (uint64_t)(ptr - copy);
+        hashes[i]  = token->hash;
+        ids[i]     = (uint32_t)(token->id - 1);
+        ptr        = next;
+    }
+    offsets[line_count]    = header->text_size;
+    header->distinct_count = distinct_count;
+    dmp_token_table_free(&table);
+
+    return self;
+}
+
+// Reads a document from the bytes produced by dump
+static VALUE document_load(VALUE klass, VALUE binary)
+{
+    const VALUE self = rb_obj_alloc(klass);
+    DMPDocument *document;
+
+    TypedData_Get_Struct(self, DMPDocument, &document_type, document);
+    StringValue(binary);
+
+    document->size = (size_t)RSTRING_LEN(binary);
+    document->data = DMP_NATIVE_ALLOC_N(char, document->size);
+    memcpy(document->data, RSTRING_PTR(binary), document->size);
+    document_check(document);
+
+    return self;
+}
+
+#ifdef HAVE_SYS_MMAN_H
+// Maps a document file read only, its pages are shared with every other process mapping it
+static VALUE document_map(VALUE klass, VALUE path)
+{
+    const VALUE self = rb_obj_alloc(klass);
+    DMPDocument *document;
+    struct stat info;
+    void *data;
+    int fd;
+
+    TypedData_Get_Struct(self, DMPDocument, &document_type, document);
+    FilePathValue(path);
+
+    fd = open(RSTRING_PTR(path), O_RDONLY);
+    if(fd < 0)
+    {
+        rb_sys_fail_str(path);
+    }
+
+    if(fstat(fd, &info) != 0)
+    {
+        close(fd);
+        rb_sys_fail_str(path);
+    }
+
+    if(info.st_size < (off_t)sizeof(DMPDocumentHeader))
+    {
+        close(fd);
+        rb_raise(rb_eArgError, "Invalid tokenized document: missing header");
+    }
+
+    data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED)
+    {
+        rb_sys_fail_str(path);
+    }
+
+    document->data   = data;
+    document->size   = (size_t)info.st_size;
+    document->mapped = true;
+    document_check(document);
+
+    return self;
+}
+#endif
+
+// Returns: the binary form of the document, as read by load
+static VALUE document_dump(VALUE self)
+{
+    const DMPDocument *document = get_document(self);
+    return rb_str_new(document->data, (long)document->size);
+}
+
+static VALUE document_text(VALUE self)
+{
+    const DMPDocument *document = get_document(self);
+    return rb_enc_str_new(document->text, (long)document->header->text_size, rb_enc_from_index(document->encoding));
+}
+
+static VALUE document_bytesize(VALUE self)
+{
+    return ULL2NUM(get_document(self)->header->text_size);
+}
+
+static VALUE document_line_count(VALUE self)
+{
+    return ULL2NUM(get_document(self)->header->line_count);
+}
+
+static VALUE document_content_hash(VALUE self)
+{
+    return ULL2NUM(get_document(self)->header->content_hash);
+}
+
+static VALUE document_encoding(VALUE self)
+{
+    return rb_enc_from_encoding(rb_enc_from_index(get_document(self)->encoding));
+}
+
+static VALUE document_mapped_p(VALUE self)
+{
+    return get_document(self)->mapped ? Qtrue : Qfalse;
+}
+
+// Same as tokens_to_chars for lines, taking the lines and their hashes from the document.
+// Lines repeated within the document are interned only once.
+static VALUE document_to_chars(const DMPDocument *document, DMPTokenTable *table, VALUE line_array)
+{
+    const uint64_t line_count = document->header->line_count;
+    rb_encoding *enc          = rb_enc_from_index(document->encoding);
+    long *line_ids            = ALLOC_N(long, (size_t)DMP_MAX(document->header->distinct_count, 1));
+    long *chars               = ALLOC_N(long, (size_t)DMP_MAX(line_count, 1));
+    const DMPToken *token     = NULL;
+    uint64_t i;
+    long next_id, length;
+    VALUE result;
+
+    memset(line_ids, 0, sizeof(long) * (size_t)DMP_MAX(document->header->distinct_count, 1));
+    for(i = 0; i < line_count; i++)
+    {
+        if(line_ids[document->ids[i]] == 0)
+        {
+            if(RARRAY_LEN(line_array) == DMP_TOKEN_SURROGATE_MIN)
+            {
+                rb_ary_resize(line_array, DMP_TOKEN_SURROGATE_MAX + 1);
+            }
+
+            next_id = RARRAY_LEN(line_array);
+            length  = (long)(document->offsets[i + 1] - document->offsets[i]);
+            token   = dmp_token_intern_hashed(table, document->hashes[i], document->text + document->offsets[i], length, next_id);
+            if(token->id == next_id)
+            {
+                rb_ary_push(line_array, rb_enc_str_new(document->text + document->offsets[i], length, enc));
+            }
+            line_ids[document->ids[i]] = token->id;
+        }
+
+        chars[i] = line_ids[document->ids[i]];
+    }
+
+    result = dmp_chars_to_rb_str(chars, (long)line_count, rb_utf8_encoding());
+    xfree(line_ids);
+    xfree(chars);
+
+    return result;
+}
+
+// Same as diff_lines_to_chars(document1.text, document2.text), the lines are neither split nor hashed again
+static VALUE diff_documents_to_chars(VALUE self, VALUE document1, VALUE document2)
+{
+    const DMPDocument *documents[2] = { get_document(document1), get_document(document2) };
+    const VALUE line_array          = rb_ary_new_from_args(1, rb_str_new_cstr(""));
+    DMPTokenTable table;
+    VALUE chars1, chars2;
+
+    // The stored hashes are unseeded content hashes
+    dmp_token_table_init(&table, 0);
+    chars1 = document_to_chars(documents[0], &table, line_array);
+    chars2 = document_to_chars(documents[1], &table, line_array);
+    dmp_token_table_free(&table);
+
+    RB_GC_GUARD(document1);
+    RB_GC_GUARD(document2);
+    return rb_ary_new_from_args(3, chars1, chars2, line_array);
+}
@@ -0,0 +1,46 @@
+#ifndef FAST_DIFF_MATCH_PATCH_DOCUMENT_H
+#define FAST_DIFF_MATCH_PATCH_DOCUMENT_H
+
+#include <stdint.h>
+
+// File layout of a tokenized document, all sections 8 byte aligned:
+//   DMPDocumentHeader
+//   uint64_t offsets[line_count + 1]   Byte offset of every line, then the text size
+//   uint64_t hashes[line_count]        content_hash of every line
+//   uint32_t ids[line_count]           Index of every line among the distinct lines, in order of appearance
+//   char text[text_size]
+// Integers are stored in the byte order of the writer, other platforms reject the file.
+#define DMP_DOCUMENT_MAGIC          "DMPT"
+#define DMP_DOCUMENT_MAGIC_LEN      4
+#define DMP_DOCUMENT_VERSION        1
+#define DMP_DOCUMENT_ENCODING_LEN   32
+#define DMP_DOCUMENT_ALIGN(size)    (((size) + 7) & ~(uint64_t)7)
+
+typedef struct DMPDocumentHeader
+{
+    char magic[DMP_DOCUMENT_MAGIC_LEN];
+    uint32_t version;
+    uint64_t content_hash;      // Ruby equivalent code: content_hash(text)
+    uint64_t text_size;         // Ruby equivalent code: text.bytesize
+    uint64_t line_count;
+    uint64_t distinct_count;    // Number of distinct lines
+    char encoding[DMP_DOCUMENT_ENCODING_LEN]; // Name of the encoding of the text, NUL padded
+} DMPDocumentHeader;
+
+// A FastDiffMatchPatch::TokenizedDocument, either built in memory or mapped from a file
+typedef struct DMPDocument
+{
+    void *data;
+    size_t size;
+    bool mapped;                // data is a read only file mapping, else malloc'd
+    const DMPDocumentHeader *header;
+    const uint64_t *offsets;
+    const uint64_t *hashes;
+    const uint32_t *ids;
+    const char *text;
+    int encoding;
+} DMPDocument;
+
+extern void dmp_init_document();
+
+#endif //FAST_DIFF_MATCH_PATCH_DOCUMENT_H
@@ -31,6 +31,11 @@ puts ">>>>> Creating Makefile for #{type} version #{RUBY_VERSION} on #{platform}
   end
 end
 
+have_header("ruby/thread.h")
+have_header("pthread.h")
+have_header("sys/mman.h")
+have_func("rb_ext_ractor_safe", "ruby.h")
+
 $CPPFLAGS += " -D DMP_DEBUG" if ENV["CI"] || ENV["DMP_DEBUG"]
 $CPPFLAGS += " -Wall"
 
@@ -1,41 +1,67 @@
 #include "fast_diff_match_patch.h"
 #include "diff.h"
 #include "match.h"
+#include "patch.h"
+#include "compose.h"
+#include "sync.h"
+#include "hash.h"
+#include "cancel.h"
+#include "progress.h"
+#include "pool.h"
+#include "cache.h"
+#include "token.h"
+#include "document.h"
+#include "dictionary.h"
+
+#ifdef HAVE_RUBY_THREAD_H
+#include "ruby/thread.h"
+#endif
+
+// Written once by Init and only read afterwards, so they're shared by all Ractors.
+// Settings live in the instance variables of each FastDiffMatchPatch instead.
 
 // Ruby Class instance ID's
 VALUE dmp_klass;
-VALUE dmp_time_klass;
-
-// Ruby function reference ID's
-ID dmp_new_delete_node_id;
-ID dmp_new_insert_node_id;
-ID dmp_diff_bisect_split_id;
-ID dmp_time_now_id;
-ID dmp_to_i_id;
-ID dmp_chars_id;
+VALUE dmp_diff_node_klass;
+VALUE dmp_temp_patch_klass;
+VALUE dmp_cancelled_klass;
 
-// DMP Class instance variables
-double dmp_match_threshold;
-unsigned int dmp_match_distance;
-unsigned int dmp_max_bits;
+// Ruby operation symbols
+VALUE dmp_insert_sym;
+VALUE dmp_delete_sym;
+VALUE dmp_equal_sym;
 
 
 void Init_fast_diff_match_patch()
 {
+#ifdef HAVE_RB_EXT_RACTOR_SAFE
+    // There is no mutable global Ruby state, methods may run in any Ractor
+    rb_ext_ractor_safe(true);
+#endif
+
     rb_require("time");
 
     dmp_klass                = rb_define_class("FastDiffMatchPatch", rb_cObject);
-    dmp_time_klass           = rb_const_get(rb_cObject, rb_intern("Time"));
-    dmp_new_delete_node_id   = rb_intern("new_delete_node");
-    dmp_new_insert_node_id   = rb_intern("new_insert_node");
-    dmp_diff_bisect_split_id = rb_intern("diff_bisect_split");
-    dmp_time_now_id          = rb_intern("now");
-    dmp_to_i_id              = rb_intern("to_i");
-    dmp_chars_id             = rb_intern("chars");
+    dmp_diff_node_klass      = rb_const_get(dmp_klass, rb_intern("DiffNode"));
+    dmp_temp_patch_klass     = rb_const_get(dmp_klass, rb_intern("TempPatch"));
+    dmp_insert_sym           = ID2SYM(rb_intern("INSERT"));
+    dmp_delete_sym           = ID2SYM(rb_intern("DELETE"));
+    dmp_equal_sym            = ID2SYM(rb_intern("EQUAL"));
 
     // Append functions to the DMP Class instance
     dmp_init_diff();
     dmp_init_match();
+    dmp_init_patch();
+    dmp_init_compose();
+    dmp_init_sync();
+    dmp_init_hash();
+    dmp_init_cancel();
+    dmp_init_progress();
+    dmp_init_pool();
+    dmp_init_cache();
+    dmp_init_token();
+    dmp_init_document();
+    dmp_init_dictionary();
 }
 
 // Free's (N) number of DMPString character allocations
@@ -53,25 +79,183 @@ void free_dmp_str(int count, ...)
     va_end(list);
 }
 
-// Convert UTF8 Ruby string into hash values
-// Ruby equivalent code:  #=> "ὂ᭚".chars => ["ὂ", "᭚"].map(&:hash) #=> [2688663840084111788, -346891196368687346]
-DMPString rb_str_to_dmp_hash(const VALUE text)
+// Builds a new DiffNode instance
+// Ruby equivalent code: DiffNode.new(:EQUAL, "text")
+VALUE dmp_new_node(VALUE operation, VALUE text)
+{
+    VALUE args[2] = { operation, text };
+    return rb_class_new_instance(2, args, dmp_diff_node_klass);
+}
+
+// Builds a new TempPatch instance
+// Ruby equivalent code: TempPatch.new(diffs, start1, start2, length1, length2)
+VALUE dmp_new_patch(VALUE diffs, long start1, long start2, long length1, long length2)
+{
+    VALUE args[5] = { diffs, LONG2NUM(start1), LONG2NUM(start2), LONG2NUM(length1), LONG2NUM(length2) };
+    return rb_class_new_instance(5, args, dmp_temp_patch_klass);
+}
+
+// Raises a TypeError unless the value is a DiffNode
+void dmp_check_node(VALUE diff)
+{
+    if(!RTEST(rb_obj_is_kind_of(diff, dmp_diff_node_klass)))
+    {
+        rb_raise(rb_eTypeError, "wrong argument type %"PRIsVALUE" (expected DiffNode)", rb_obj_class(diff));
+    }
+}
+
+// Raises a TypeError unless the value is a TempPatch
+void dmp_check_patch(VALUE patch)
+{
+    if(!RTEST(rb_obj_is_kind_of(patch, dmp_temp_patch_klass)))
+    {
+        rb_raise(rb_eTypeError, "wrong argument type %"PRIsVALUE" (expected TempPatch)", rb_obj_class(patch));
+    }
+}
+
+
+// Convert a Ruby string into its codepoints.
+// Invalid bytes are stored as -1 - byte so the string can be rebuilt byte for byte.
+// Ruby equivalent code: "ὂ᭚".codepoints #=> [8002, 6998]
+DMPString rb_str_to_dmp_chars(const VALUE text)
+{
+    rb_encoding *enc      = rb_enc_get(text);
+    const char *ptr       = RSTRING_PTR(text);
+    const char *end       = RSTRING_END(text);
+    const bool ascii_only = rb_enc_asciicompat(enc) && rb_enc_str_asciionly_p(text);
+    DMPString dmp_chars   = { 0, ALLOC_N(long, (size_t)RSTRING_LEN(text)) };
+    int len               = 0;
+
+    while(ptr < end)
+    {
+        if(ascii_only)
+        {
+            dmp_chars.chars[dmp_chars.size++] = (unsigned char)*ptr++;
+            continue;
+        }
+
+        len = rb_enc_precise_mbclen(ptr, end, enc);
+        if(MBCLEN_CHARFOUND_P(len))
+        {
+            dmp_chars.chars[dmp_chars.size++] = (long)rb_enc_mbc_to_codepoint(ptr, end, enc);
+            ptr += MBCLEN_CHARFOUND_LEN(len);
+        } else {
+            dmp_chars.chars[dmp_chars.size++] = -1 - (long)(unsigned char)*ptr++;
+        }
+    }
+
+    return dmp_chars;
+}
+
+// Build a Ruby string from codepoints produced by rb_str_to_dmp_chars
+// Ruby equivalent code: [8002, 6998].pack("U*") #=> "ὂ᭚"
+VALUE dmp_chars_to_rb_str(const long *chars, long size, rb_encoding *enc)
+{
+    long bytes = 0;
+    long i     = 0;
+    char *ptr  = NULL;
+    VALUE str;
+
+    for(i = 0; i < size; i++)
+    {
+        bytes += chars[i] < 0 ? 1 : rb_enc_codelen((unsigned int)chars[i], enc);
+    }
+
+    str = rb_enc_str_new(NULL, bytes, enc);
+    ptr = RSTRING_PTR(str);
+
+    for(i = 0; i < size; i++)
+    {
+        if(chars[i] < 0)
+        {
+            *ptr++ = (char)(-1 - chars[i]);
+        } else {
+            ptr += rb_enc_mbcput((unsigned int)chars[i], ptr, enc);
+        }
+    }
+
+    return str;
+}
+
+// malloc which aborts the process on exhaustion; can't raise NoMemoryError without the GVL
+void *dmp_native_alloc(size_t size)
+{
+    return dmp_native_realloc(NULL, size);
+}
+
+void *dmp_native_realloc(void *ptr, size_t size)
+{
+    void *result = realloc(ptr, size == 0 ? 1 : size);
+
+    if(result == NULL)
+    {
+        fprintf(stderr, "[FATAL] fast_diff_match_patch: failed to allocate %lu bytes\n", (unsigned long)size);
+        abort();
+    }
+
+    return result;
+}
+
+#ifdef HAVE_RUBY_THREAD_H
+typedef struct DMPBlockingCall
+{
+    void *(*func)(void *);
+    void *data;
+    bool ran;
+} DMPBlockingCall;
+
+static void *blocking_call(void *data)
+{
+    DMPBlockingCall *call = data;
+
+    call->ran = true;
+    return call->func(call->data);
+}
+
+// Unblock function, called by Ruby when the thread is interrupted while it runs without the GVL
+static void blocking_unblock(void *data)
 {
-    // Ruby equivalent code: "Hey".chars #=> ['H', 'e', 'y']
-    const VALUE char_array      = RB_FUNC_CALL(text, dmp_chars_id);
-    const unsigned int str_len  = (uint)RARRAY_LENINT(char_array);
-    const DMPString dmp_hash    = { str_len, ALLOC_N(long, (size_t)str_len) };
+    ((DMPCancel *)data)->interrupted = true;
+}
+#endif
 
-    unsigned int i         = 0;
-    VALUE char_hash_value  = 0;
-    VALUE char_ary_idx     = INT2FIX(0);
+// Runs func with the GVL released so other Ruby threads keep running.
+// func must not touch Ruby objects or raise, it polls cancel to give up early.
+// Nothing is raised here so the caller can free its buffers first, then call dmp_check_cancel.
+void *dmp_without_gvl(void *(*func)(void *), void *data, DMPCancel *cancel)
+{
+#ifdef HAVE_RUBY_THREAD_H
+    DMPBlockingCall call = { func, data, false };
+    void *result         = rb_thread_call_without_gvl2(blocking_call, &call, blocking_unblock, cancel);
 
-    for(i = 0; i < str_len; char_ary_idx = INT2FIX(++i))
+    if(!call.ran)
     {
-        // Ruby equivalent code: "H".hash #=> -479202348279020166
-        char_hash_value   = rb_str_hash(RB_ARRAY_REF(char_array, char_ary_idx));
-        dmp_hash.chars[i] = RB_FIX2LONG(char_hash_value);
+        // An interrupt was already pending, the work gives up right away
+        cancel->interrupted = true;
+        result = func(data);
     }
 
-    return dmp_hash;
-}
\ No newline at end of file
+    return result;
+#else
+    return func(data);
+#endif
+}
+
+// Raise once native work stopped early: the exception of a callback, Cancelled for a cancelled token,
+// or the pending interrupt.
+// Some interrupts don't raise (e.g. a trap handler), the caller then runs the work again.
+void dmp_check_cancel(const DMPCancel *cancel)
+{
+    if(cancel->state != 0)
+    {
+        rb_jump_tag(cancel->state);
+    }
+    if(cancel->token != NULL && *cancel->token)
+    {
+        rb_raise(dmp_cancelled_klass, "cancelled");
+    }
+    if(cancel->interrupted)
+    {
+        rb_thread_check_ints();
+    }
+}
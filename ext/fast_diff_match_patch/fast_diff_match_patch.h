@@ -3,40 +3,64 @@
 
 #include <stdbool.h>
 #include "ruby.h"
+#include "ruby/encoding.h"
 
 #define DMP_CMP(x, y)                    ( x == y )
-#define DMP_MAX(x, y)                    ( x > y ? x : y )
-#define DMP_MIN(x, y)                    ( x > y ? y : x )
+#define DMP_MAX(x, y)                    ((x) > (y) ? (x) : (y))
+#define DMP_MIN(x, y)                    ((x) > (y) ? (y) : (x))
 
-#define RB_FUNC_CALL(caller, func_id)    ( rb_funcall(caller, func_id, 0) )
-#define RB_ARRAY_REF(rb_array, rb_index) ( rb_ary_aref(1, &rb_index, rb_array) )
+// Struct member positions of DiffNode and TempPatch (see diff_node.rb)
+#define DMP_NODE_OPERATION               0
+#define DMP_NODE_TEXT                    1
+#define DMP_PATCH_DIFFS                  0
+#define DMP_PATCH_START1                 1
+#define DMP_PATCH_START2                 2
+#define DMP_PATCH_LENGTH1                3
+#define DMP_PATCH_LENGTH2                4
 
 #define FREE_DMP_STR2(x, y)              (FREE_DMP_STR_N(2, &x, &y))
 #define FREE_DMP_STR_N(count, ...)       (free_dmp_str(count, __VA_ARGS__))
 
+// Code running without the GVL can't use xmalloc, these wrap the system allocator instead
+#define DMP_NATIVE_ALLOC_N(type, n)      ((type*)dmp_native_alloc(sizeof(type) * (size_t)(n)))
+#define DMP_NATIVE_FREE(ptr)             (free(ptr))
+
 typedef struct DMPString {
     unsigned int size;
     long *chars;
 } DMPString;
 
+// Stop request polled by native code running without the GVL
+typedef struct DMPCancel {
+    volatile bool interrupted;  // Ruby interrupted the thread, e.g. Thread#raise or Timeout
+    const volatile bool *token; // Flag of a CancellationToken, NULL without one
+    int state;                  // Tag of an exception raised with the GVL taken back, e.g. by a progress callback
+} DMPCancel;
+
+#define DMP_CANCELLED(cancel)            ( (cancel) != NULL && ((cancel)->interrupted || (cancel)->state != 0 || \
+                                                                ((cancel)->token != NULL && *(cancel)->token)) )
+
 extern void free_dmp_str(int count, ...);
-extern DMPString rb_str_to_dmp_hash(VALUE text);
+extern DMPString rb_str_to_dmp_chars(VALUE text);
+extern VALUE dmp_chars_to_rb_str(const long *chars, long size, rb_encoding *enc);
+extern void *dmp_native_alloc(size_t size);
+extern void *dmp_native_realloc(void *ptr, size_t size);
+extern void *dmp_without_gvl(void *(*func)(void *), void *data, DMPCancel *cancel);
+extern void dmp_check_cancel(const DMPCancel *cancel);
+extern VALUE dmp_new_node(VALUE operation, VALUE text);
+extern VALUE dmp_new_patch(VALUE diffs, long start1, long start2, long length1, long length2);
+extern void dmp_check_node(VALUE diff);
+extern void dmp_check_patch(VALUE patch);
 
 // Ruby Class instance ID's
 extern VALUE dmp_klass;
-extern VALUE dmp_time_klass;
-
-// Ruby function reference ID's
-extern ID dmp_new_delete_node_id;
-extern ID dmp_new_insert_node_id;
-extern ID dmp_diff_bisect_split_id;
-extern ID dmp_time_now_id;
-extern ID dmp_to_i_id;
-extern ID dmp_chars_id;
-
-// DMP Class instance variables
-extern double dmp_match_threshold;
-extern unsigned int dmp_match_distance;
-extern unsigned int dmp_max_bits;
+extern VALUE dmp_diff_node_klass;
+extern VALUE dmp_temp_patch_klass;
+extern VALUE dmp_cancelled_klass;
+
+// Ruby operation symbols
+extern VALUE dmp_insert_sym;
+extern VALUE dmp_delete_sym;
+extern VALUE dmp_equal_sym;
 
 #endif /* FAST_DIFF_MATCH_PATCH_H */
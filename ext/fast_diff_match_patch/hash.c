@@ -0,0 +1,183 @@
+#include "fast_diff_match_patch.h"
+#include "hash.h"
+
+#define DMP_HASH_PRIME1         0x9E3779B185EBCA87ULL
+#define DMP_HASH_PRIME2         0xC2B2AE3D27D4EB4FULL
+#define DMP_HASH_PRIME3         0x165667B19E3779F9ULL
+#define DMP_HASH_PRIME4         0x85EBCA77C2B2AE63ULL
+#define DMP_HASH_PRIME5         0x27D4EB2F165667C5ULL
+
+#define DMP_ROTL64(x, r)        (((x) << (r)) | ((x) >> (64 - (r))))
+
+static VALUE content_hash(int argc, VALUE *argv, VALUE self);
+
+void dmp_init_hash()
+{
+    rb_define_method(dmp_klass, "content_hash", RUBY_METHOD_FUNC(content_hash), -1);
+    rb_define_singleton_method(dmp_klass, "content_hash", RUBY_METHOD_FUNC(content_hash), -1);
+}
+
+// Little endian loads, the hash must not depend on the platform
+static uint64_t read64(const unsigned char *ptr)
+{
+    return  (uint64_t)ptr[0]        | ((uint64_t)ptr[1] << 8)  | ((uint64_t)ptr[2] << 16) | ((uint64_t)ptr[3] << 24) |
+           ((uint64_t)ptr[4] << 32) | ((uint64_t)ptr[5] << 40) | ((uint64_t)ptr[6] << 48) | ((uint64_t)ptr[7] << 56);
+}
+
+static uint64_t read32(const unsigned char *ptr)
+{
+    return (uint64_t)ptr[0] | ((uint64_t)ptr[1] << 8) | ((uint64_t)ptr[2] << 16) | ((uint64_t)ptr[3] << 24);
+}
+
+static uint64_t hash_round(uint64_t lane, uint64_t input)
+{
+    lane += input * DMP_HASH_PRIME2;
+    lane  = DMP_ROTL64(lane, 31);
+    return lane * DMP_HASH_PRIME1;
+}
+
+static uint64_t hash_merge(uint64_t hash, uint64_t lane)
+{
+    hash ^= hash_round(0, lane);
+    return hash * DMP_HASH_PRIME1 + DMP_HASH_PRIME4;
+}
+
+// Feed whole stripes to the four lanes
+static void hash_stripes(DMPHashState *state, const unsigned char *ptr, size_t count)
+{
+    uint64_t lane0 = state->lanes[0];
+    uint64_t lane1 = state->lanes[1];
+    uint64_t lane2 = state->lanes[2];
+    uint64_t lane3 = state->lanes[3];
+    size_t i;
+
+    for(i = 0; i < count; i++, ptr += DMP_HASH_STRIPE)
+    {
+        lane0 = hash_round(lane0, read64(ptr));
+        lane1 = hash_round(lane1, read64(ptr + 8));
+        lane2 = hash_round(lane2, read64(ptr + 16));
+        lane3 = hash_round(lane3, read64(ptr + 24));
+    }
+
+    state->lanes[0] = lane0;
+    state->lanes[1] = lane1;
+    state->lanes[2] = lane2;
+    state->lanes[3] = lane3;
+}
+
+void dmp_hash_init(DMPHashState *state, uint64_t seed)
+{
+    state->lanes[0] = seed + DMP_HASH_PRIME1 + DMP_HASH_PRIME2;
+    state->lanes[1] = seed + DMP_HASH_PRIME2;
+    state->lanes[2] = seed;
+    state->lanes[3] = seed - DMP_HASH_PRIME1;
+    state->seed     = seed;
+    state->total    = 0;
+    state->buffered = 0;
+}
+
+void dmp_hash_update(DMPHashState *state, const void *data, size_t length)
+{
+    const unsigned char *ptr = data;
+    size_t fill;
+
+    state->total += length;
+
+    if(state->buffered > 0)
+    {
+        fill = DMP_MIN(length, DMP_HASH_STRIPE - state->buffered);
+        memcpy(state->buffer + state->buffered, ptr, fill);
+        state->buffered += fill;
+        ptr             += fill;
+        length          -= fill;
+
+        if(state->buffered < DMP_HASH_STRIPE)
+        {
+            return;
+        }
+        hash_stripes(state, state->buffer, 1);
+        state->buffered = 0;
+    }
+
+    hash_stripes(state, ptr, length / DMP_HASH_STRIPE);
+    ptr    += length - length % DMP_HASH_STRIPE;
+    length %= DMP_HASH_STRIPE;
+
+    memcpy(state->buffer, ptr, length);
+    state->buffered = length;
+}
+
+uint64_t dmp_hash_digest(const DMPHashState *state)
+{
+    const unsigned char *ptr = state->buffer;
+    const unsigned char *end = state->buffer + state->buffered;
+    uint64_t hash;
+
+    if(state->total >= DMP_HASH_STRIPE)
+    {
+        hash = DMP_ROTL64(state->lanes[0], 1) + DMP_ROTL64(state->lanes[1], 7) +
+               DMP_ROTL64(state->lanes[2], 12) + DMP_ROTL64(state->lanes[3], 18);
+        hash = hash_merge(hash, state->lanes[0]);
+        hash = hash_merge(hash, state->lanes[1]);
+        hash = hash_merge(hash, state->lanes[2]);
+        hash = hash_merge(hash, state->lanes[3]);
+    } else {
+        hash = state->seed + DMP_HASH_PRIME5;
+    }
+
+    hash += state->total;
+
+    for(; ptr + 8 <= end; ptr += 8)
+    {
+        hash ^= hash_round(0, read64(ptr));
+        hash  = DMP_ROTL64(hash, 27) * DMP_HASH_PRIME1 + DMP_HASH_PRIME4;
+    }
+
+    if(ptr + 4 <= end)
+    {
+        hash ^= read32(ptr) * DMP_HASH_PRIME1;
+        hash  = DMP_ROTL64(hash, 23) * DMP_HASH_PRIME2 + DMP_HASH_PRIME3;
+        ptr  += 4;
+    }
+
+    for(; ptr < end; ptr++)
+    {
+        hash ^= *ptr * DMP_HASH_PRIME5;
+        hash  = DMP_ROTL64(hash, 11) * DMP_HASH_PRIME1;
+    }
+
+    // Avalanche
+    hash ^= hash >> 33;
+    hash *= DMP_HASH_PRIME2;
+    hash ^= hash >> 29;
+    hash *= DMP_HASH_PRIME3;
+    hash ^= hash >> 32;
+
+    return hash;
+}
+
+uint64_t dmp_hash_bytes(const void *data, size_t length, uint64_t seed)
+{
+    DMPHashState state;
+
+    dmp_hash_init(&state, seed);
+    dmp_hash_update(&state, data, length);
+    return dmp_hash_digest(&state);
+}
+
+uint64_t dmp_content_hash(const void *data, size_t length)
+{
+    return dmp_hash_bytes(data, length, 0);
+}
+
+// Stable 64 bit hash of the bytes of the text, the same in every process and on every platform.
+// A seed gives an independent hash function, e.g. one per tenant of a shared cache.
+// Ruby equivalent code: XXH64(text.b, seed = 0)
+static VALUE content_hash(int argc, VALUE *argv, VALUE self)
+{
+    VALUE text, seed;
+
+    rb_scan_args(argc, argv, "11", &text, &seed);
+    StringValue(text);
+    return ULL2NUM(dmp_hash_bytes(RSTRING_PTR(text), (size_t)RSTRING_LEN(text), NIL_P(seed) ? 0 : NUM2ULL(seed)));
+}
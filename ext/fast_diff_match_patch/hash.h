@@ -0,0 +1,29 @@
+#ifndef FAST_DIFF_MATCH_PATCH_HASH_H
+#define FAST_DIFF_MATCH_PATCH_HASH_H
+
+#include <stdint.h>
+
+// Bytes consumed per round, one 64 bit word for each of the four independent lanes
+#define DMP_HASH_STRIPE         32
+
+// Streaming state of the content hash (the xxHash64 algorithm).
+// The lanes don't depend on each other, so compilers can keep them in vector registers.
+typedef struct DMPHashState
+{
+    uint64_t lanes[4];
+    uint64_t seed;
+    uint64_t total;                          // Number of bytes hashed so far
+    unsigned char buffer[DMP_HASH_STRIPE];   // Bytes left over from the last update
+    size_t buffered;
+} DMPHashState;
+
+extern void dmp_init_hash();
+
+// Safe to call without the GVL
+extern void dmp_hash_init(DMPHashState *state, uint64_t seed);
+extern void dmp_hash_update(DMPHashState *state, const void *data, size_t length);
+extern uint64_t dmp_hash_digest(const DMPHashState *state);
+extern uint64_t dmp_hash_bytes(const void *data, size_t length, uint64_t seed);
+extern uint64_t dmp_content_hash(const void *data, size_t length);
+
+#endif //FAST_DIFF_MATCH_PATCH_HASH_H
@@ -8,16 +8,20 @@ void dmp_init_match()
     rb_define_method(dmp_klass, "match_bitap", RUBY_METHOD_FUNC(match_bitap), 3);
 }
 
-// Set the extern global variables with the current instance variable settings
-static void set_instance_vars(VALUE self)
+// Read the matching settings from the instance variables
+DMPMatchConfig dmp_match_config(VALUE self)
 {
-    dmp_match_threshold = RFLOAT_VALUE(rb_iv_get(self, "@match_threshold"));
-    dmp_match_distance  = FIX2UINT(rb_iv_get(self, "@match_distance"));
-    dmp_max_bits        = FIX2UINT(rb_iv_get(self, "@match_max_bits"));
+    DMPMatchConfig config;
+
+    config.threshold = NUM2DBL(rb_iv_get(self, "@match_threshold"));
+    config.distance  = FIX2UINT(rb_iv_get(self, "@match_distance"));
+    config.max_bits  = FIX2UINT(rb_iv_get(self, "@match_max_bits"));
+
+    return config;
 }
 
 // Free's DMPHash structure and all of its nested child elements
-static void destroy_hash(DMP_HT *hash)
+void destroy_hash(DMP_HT *hash)
 {
     unsigned int i = 0;
 
@@ -43,10 +47,10 @@ static void destroy_hash(DMP_HT *hash)
 static DMP_HT *new_hash(const unsigned int size)
 {
     unsigned int i = 0;
-    DMP_HT *hash  = ALLOC(DMP_HT);
+    DMP_HT *hash  = DMP_NATIVE_ALLOC_N(DMP_HT, 1);
     hash->size     = size;
     hash->count    = 0;
-    hash->values   = ALLOC_N(DMP_HT_ELM*, size);
+    hash->values   = DMP_NATIVE_ALLOC_N(DMP_HT_ELM*, size);
 
     for(i = 0; i < hash->size; i++)
     {
@@ -87,7 +91,7 @@ static void hash_insert(DMP_HT *hash, const long key, const long value)
 
     // Deal with possible collision by inserting the element to the head of the link list
     int idx              = DMP_HASH_KEY(hash, key);
-    DMP_HT_ELM *new_elem = ALLOC(DMP_HT_ELM);
+    DMP_HT_ELM *new_elem = DMP_NATIVE_ALLOC_N(DMP_HT_ELM, 1);
     new_elem->next       = hash->values[idx];
     new_elem->key        = key;
     new_elem->value      = value;
@@ -148,18 +152,18 @@ static int rindex_of(const DMPString text, const DMPString pattern, const int po
 
 // Calculates score based current location and matching distance.
 // Returns: floating point value on calculated score
-static double match_bitap_score(const int start, const int end, const DMPString pattern, const int location)
+static double match_bitap_score(const DMPMatchConfig *config, const int start, const int end, const DMPString pattern, const int location)
 {
     double accuracy  = ((double) start) / pattern.size;
     double proximity = location - end;
     proximity        = proximity < 0.0 ? proximity * -1 : proximity;
 
-    if(dmp_match_distance == 0)
+    if(config->distance == 0)
     {
         return proximity == 0.0 ? accuracy : 1.0;
     }
 
-    return accuracy + (proximity / dmp_match_distance);
+    return accuracy + (proximity / config->distance);
 }
 
 // Generates a hash table for each pattern character; bit shifting like minded characters based on latest position.
@@ -171,7 +175,7 @@ static double match_bitap_score(const int start, const int end, const DMPString
 //    end
 //
 // Returns: struct DMP_HT* #=> Hash table containing each character with bit shifted results.
-static DMP_HT *generate_pattern_hash(const DMPString pattern)
+DMP_HT *dmp_match_alphabet(const DMPString pattern)
 {
     DMP_HT *alphabet    = new_hash(pattern.size);
     DMP_HT_ELM *element = NULL;
@@ -195,18 +199,20 @@ static DMP_HT *generate_pattern_hash(const DMPString pattern)
 }
 
 // Performs a fuzzy search for the pattern in side the text.
-// Returns: index of the matched pattern.
-static VALUE match_bitap(VALUE rb_self, VALUE rb_text, VALUE rb_pattern, VALUE rb_loc)
+// The pattern must not be longer than config->max_bits. When the caller already compiled
+// the pattern with dmp_match_alphabet it can pass it in, otherwise alphabet is NULL.
+// Safe to call without the GVL.
+// Returns: index of the matched pattern or -1.
+long dmp_match_bitap(const DMPMatchConfig *config, const DMPString text, const DMPString pattern, const long location,
+                     const DMP_HT *alphabet)
 {
-    set_instance_vars(rb_self);
-    const DMPString pattern = rb_str_to_dmp_hash(rb_pattern);
-    const DMPString text    = rb_str_to_dmp_hash(rb_text);
-    const int loc           = FIX2UINT(rb_loc);
+    const int loc           = (int)location;
     const int max_rd        = pattern.size + text.size + 2;
     const int match_mask    = 1 << (pattern.size - 1);
-    DMP_HT *alpha           = generate_pattern_hash(pattern);
+    DMP_HT *compiled        = alphabet == NULL ? dmp_match_alphabet(pattern) : NULL;
+    const DMP_HT *alpha     = alphabet == NULL ? compiled : alphabet;
     DMP_HT_ELM *element     = NULL;
-    double score_threshold  = dmp_match_threshold;
+    double score_threshold  = config->threshold;
     double best_score       = 0;
     double tmp_score        = 0;
     long   alpha_value      = 0;
@@ -217,26 +223,19 @@ static VALUE match_bitap(VALUE rb_self, VALUE rb_text, VALUE rb_pattern, VALUE r
     int    j, finish, start;
     unsigned int i;
 
-    VALUE last_rd[max_rd];
-    VALUE rd[max_rd];
-
-
-    if(pattern.size > dmp_max_bits) {
-        FREE_DMP_HT(alpha);
-        FREE_DMP_STR2(pattern, text);
-        rb_raise(rb_eArgError, "Pattern is too large for this application");
-    }
+    VALUE *last_rd          = DMP_NATIVE_ALLOC_N(VALUE, max_rd * 2);
+    VALUE *rd               = last_rd + max_rd;
 
     best_loc = index_of(text, pattern, loc);
     if(best_loc != Qnil)
     {
-        best_score        = match_bitap_score(0, best_loc, pattern, loc);
+        best_score        = match_bitap_score(config, 0, best_loc, pattern, loc);
         score_threshold   = DMP_MIN(best_score, score_threshold);
         best_loc          = rindex_of(text, pattern, loc + pattern.size);
 
         if(best_loc != Qnil)
         {
-            best_score      = match_bitap_score(0, best_loc, pattern, loc);
+            best_score      = match_bitap_score(config, 0, best_loc, pattern, loc);
             score_threshold = DMP_MIN(best_score, score_threshold);
         }
     }
@@ -253,7 +252,7 @@ static VALUE match_bitap(VALUE rb_self, VALUE rb_text, VALUE rb_pattern, VALUE r
 
         while(bin_min < bin_mid)
         {
-            if(match_bitap_score(i, loc + bin_mid, pattern, loc) <= score_threshold)
+            if(match_bitap_score(config, i, loc + bin_mid, pattern, loc) <= score_threshold)
             {
                 bin_min = bin_mid;
             } else {
@@ -274,7 +273,8 @@ static VALUE match_bitap(VALUE rb_self, VALUE rb_text, VALUE rb_pattern, VALUE r
 
         for(j = finish; j >= start; j--)
         {
-            element      = hash_lookup(alpha, text.chars[j-1]);
+            // Past the end of the text nothing matches
+            element      = j - 1 < (int)text.size ? hash_lookup(alpha, text.chars[j-1]) : NULL;
             alpha_value  = element == NULL ? 0 : element->value;
 
             if(i == 0)
@@ -292,7 +292,7 @@ static VALUE match_bitap(VALUE rb_self, VALUE rb_text, VALUE rb_pattern, VALUE r
                 continue;
             }
 
-            tmp_score = match_bitap_score(i, j-1, pattern, loc);
+            tmp_score = match_bitap_score(config, i, j-1, pattern, loc);
 
             if (tmp_score <= score_threshold)
             {
@@ -312,7 +312,7 @@ static VALUE match_bitap(VALUE rb_self, VALUE rb_text, VALUE rb_pattern, VALUE r
 
         }
 
-        if(match_bitap_score(i + 1, loc, pattern, loc) > score_threshold)
+        if(match_bitap_score(config, i + 1, loc, pattern, loc) > score_threshold)
         {
             break; // No hope for a (better) match at greater error levels.
         }
@@ -322,8 +322,50 @@ static VALUE match_bitap(VALUE rb_self, VALUE rb_text, VALUE rb_pattern, VALUE r
         MEMCPY(last_rd, rd, VALUE, max_rd);
     }
 
-    FREE_DMP_HT(alpha);
+    if(compiled != NULL)
+    {
+        FREE_DMP_HT(compiled);
+    }
+    DMP_NATIVE_FREE(last_rd);
+    return best_loc;
+}
+
+// Locate the best instance of 'pattern' in 'text' near 'loc'. Safe to call without the GVL.
+// Ruby equivalent code: match_main(text, pattern, loc)
+long dmp_match_main(const DMPMatchConfig *config, const DMPString text, const DMPString pattern, long loc,
+                    const DMP_HT *alphabet)
+{
+    loc = DMP_MAX(0, DMP_MIN(loc, (long)text.size));
+
+    if(text.size == pattern.size && memcmp(text.chars, pattern.chars, sizeof(long) * text.size) == 0)
+    {
+        return 0; // Shortcut (potentially not guaranteed by the algorithm)
+    } else if(text.size == 0) {
+        return -1; // Nothing to match.
+    } else if(loc + (long)pattern.size <= (long)text.size &&
+              memcmp(text.chars + loc, pattern.chars, sizeof(long) * pattern.size) == 0) {
+        return loc; // Perfect match at the perfect spot!
+    }
+
+    return dmp_match_bitap(config, text, pattern, loc, alphabet);
+}
+
+// Performs a fuzzy search for the pattern in side the text.
+// Returns: index of the matched pattern.
+static VALUE match_bitap(VALUE rb_self, VALUE rb_text, VALUE rb_pattern, VALUE rb_loc)
+{
+    const DMPMatchConfig config = dmp_match_config(rb_self);
+    const DMPString pattern     = rb_str_to_dmp_chars(rb_pattern);
+    const DMPString text        = rb_str_to_dmp_chars(rb_text);
+    long best_loc               = -1;
+
+    if(pattern.size > config.max_bits) {
+        FREE_DMP_STR2(pattern, text);
+        rb_raise(rb_eArgError, "Pattern is too large for this application");
+    }
+
+    best_loc = dmp_match_bitap(&config, text, pattern, FIX2UINT(rb_loc), NULL);
     FREE_DMP_STR2(pattern, text);
-    return INT2FIX(best_loc);
+    return LONG2FIX(best_loc);
 }
 
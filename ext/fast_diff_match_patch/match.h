@@ -20,7 +20,18 @@ typedef struct DMP_HT
     DMP_HT_ELM **values;
 } DMP_HT;
 
+typedef struct DMPMatchConfig
+{
+    double threshold;      // @match_threshold
+    unsigned int distance; // @match_distance
+    unsigned int max_bits; // @match_max_bits
+} DMPMatchConfig;
 
 extern void dmp_init_match();
+extern DMPMatchConfig dmp_match_config(VALUE self);
+extern DMP_HT *dmp_match_alphabet(DMPString pattern);
+extern void destroy_hash(DMP_HT *hash);
+extern long dmp_match_bitap(const DMPMatchConfig *config, DMPString text, DMPString pattern, long loc, const DMP_HT *alphabet);
+extern long dmp_match_main(const DMPMatchConfig *config, DMPString text, DMPString pattern, long loc, const DMP_HT *alphabet);
 
 #endif //FAST_DIFF_MATCH_PATCH_MATCH_H
@@ -0,0 +1,1440 @@
+#include "fast_diff_match_patch.h"
+#include "patch.h"
+#include "cancel.h"
+#include "pool.h"
+
+static VALUE patch_to_binary(VALUE self, VALUE patches);
+static VALUE patch_from_binary(int argc, VALUE *argv, VALUE self);
+static VALUE patch_split_max(VALUE self, VALUE patches);
+static VALUE patch_add_context(VALUE self, VALUE patch, VALUE text);
+static VALUE patch_apply_parallel(int argc, VALUE *argv, VALUE self);
+static VALUE patch_apply_padded(VALUE self, VALUE patches, VALUE texts, VALUE null_padding);
+
+void dmp_init_patch()
+{
+    rb_define_method(dmp_klass, "patch_to_binary", RUBY_METHOD_FUNC(patch_to_binary), 1);
+    rb_define_method(dmp_klass, "patch_from_binary", RUBY_METHOD_FUNC(patch_from_binary), -1);
+    rb_define_method(dmp_klass, "patch_split_max", RUBY_METHOD_FUNC(patch_split_max), 1);
+    rb_define_method(dmp_klass, "patch_add_context", RUBY_METHOD_FUNC(patch_add_context), 2);
+    rb_define_method(dmp_klass, "patch_apply_parallel", RUBY_METHOD_FUNC(patch_apply_parallel), -1);
+    rb_define_method(dmp_klass, "patch_apply_padded", RUBY_METHOD_FUNC(patch_apply_padded), 3);
+}
+
+// Appends an unsigned LEB128 encoded integer to the buffer
+// e.g. 300 #=> "\xAC\x02"
+static void write_varint(VALUE buffer, unsigned long value)
+{
+    char bytes[10];
+    int  len = 0;
+
+    do
+    {
+        bytes[len] = (char)(value & 0x7F);
+        value    >>= 7;
+
+        if(value != 0)
+        {
+            bytes[len] |= (char)0x80;
+        }
+        len++;
+    } while(value != 0);
+
+    rb_str_buf_cat(buffer, bytes, len);
+}
+
+// Reads an unsigned LEB128 encoded integer and advances the reader
+static unsigned long read_varint(DMPReader *reader)
+{
+    unsigned long value = 0;
+    unsigned int shift  = 0;
+
+    while(reader->ptr < reader->end && shift < 64)
+    {
+        const unsigned char byte = *reader->ptr++;
+        value |= (unsigned long)(byte & 0x7F) << shift;
+
+        if((byte & 0x80) == 0)
+        {
+            return value;
+        }
+        shift += 7;
+    }
+
+    rb_raise(rb_eArgError, "Invalid binary patch: truncated integer at byte %ld", (long)(reader->ptr - reader->start));
+}
+
+// Reads a varint holding a coordinate or a count, rejecting values which don't fit a long
+static long read_varint_long(DMPReader *reader)
+{
+    const long offset         = (long)(reader->ptr - reader->start);
+    const unsigned long value = read_varint(reader);
+
+    if(value > (unsigned long)LONG_MAX)
+    {
+        rb_raise(rb_eArgError, "Invalid binary patch: integer out of range at byte %ld", offset);
+    }
+
+    return (long)value;
+}
+
+// Fetch a patch coordinate, rejecting values which cannot be stored as unsigned integers
+static unsigned long patch_coord(VALUE patch, int member)
+{
+    const long value = NUM2LONG(RSTRUCT_GET(patch, member));
+
+    if(value < 0)
+    {
+        rb_raise(rb_eArgError, "Invalid patch coordinate: %ld", value);
+    }
+
+    return (unsigned long)value;
+}
+
+// Maps a DiffNode operation onto its binary tag
+static unsigned long operation_tag(VALUE operation)
+{
+    if(operation == dmp_equal_sym)  return DMP_BINARY_OP_EQUAL;
+    if(operation == dmp_delete_sym) return DMP_BINARY_OP_DELETE;
+    if(operation == dmp_insert_sym) return DMP_BINARY_OP_INSERT;
+
+    rb_raise(rb_eArgError, "Invalid patch operation: %"PRIsVALUE, operation);
+}
+
+// Serializes a list of patches into a compact binary string.
+// Layout (all integers are unsigned LEB128 varints):
+//   "DMP" version
+//   patch_count
+//   per patch: start1 start2 length1 length2 diff_count
+//   per diff:  (byte_length << 2 | op_tag) raw_utf8_bytes
+static VALUE patch_to_binary(VALUE self, VALUE patches)
+{
+    Check_Type(patches, T_ARRAY);
+
+    const long patch_count = RARRAY_LEN(patches);
+    VALUE buffer           = rb_str_buf_new(patch_count * 16 + DMP_BINARY_MAGIC_LEN + 1);
+    const char version     = DMP_BINARY_VERSION;
+    long i, j;
+
+    rb_str_buf_cat(buffer, DMP_BINARY_MAGIC, DMP_BINARY_MAGIC_LEN);
+    rb_str_buf_cat(buffer, &version, 1);
+    write_varint(buffer, (unsigned long)patch_count);
+
+    for(i = 0; i < patch_count; i++)
+    {
+        const VALUE patch = RARRAY_AREF(patches, i);
+        VALUE diffs;
+        long diff_count;
+
+        dmp_check_patch(patch);
+        diffs = RSTRUCT_GET(patch, DMP_PATCH_DIFFS);
+        Check_Type(diffs, T_ARRAY);
+        diff_count = RARRAY_LEN(diffs);
+
+        write_varint(buffer, patch_coord(patch, DMP_PATCH_START1));
+        write_varint(buffer, patch_coord(patch, DMP_PATCH_START2));
+        write_varint(buffer, patch_coord(patch, DMP_PATCH_LENGTH1));
+        write_varint(buffer, patch_coord(patch, DMP_PATCH_LENGTH2));
+        write_varint(buffer, (unsigned long)diff_count);
+
+        for(j = 0; j < diff_count; j++)
+        {
+            const VALUE diff = RARRAY_AREF(diffs, j);
+            unsigned long tag;
+            VALUE text;
+
+            dmp_check_node(diff);
+            tag  = operation_tag(RSTRUCT_GET(diff, DMP_NODE_OPERATION));
+            text = RSTRUCT_GET(diff, DMP_NODE_TEXT);
+
+            StringValue(text);
+            text = rb_str_conv_enc(text, rb_enc_get(text), rb_utf8_encoding());
+
+            write_varint(buffer, ((unsigned long)RSTRING_LEN(text) << DMP_BINARY_OP_BITS) | tag);
+            rb_str_buf_cat(buffer, RSTRING_PTR(text), RSTRING_LEN(text));
+        }
+    }
+
+    return buffer;
+}
+
+// Deserializes a binary string generated by `patch_to_binary`.
+// When zero_copy is truthy the diff texts share the (frozen) input buffer instead of copying their payloads.
+static VALUE patch_from_binary(int argc, VALUE *argv, VALUE self)
+{
+    VALUE data, zero_copy;
+    rb_scan_args(argc, argv, "11", &data, &zero_copy);
+    StringValue(data);
+
+    const bool shared   = RTEST(zero_copy);
+    const VALUE source  = shared ? rb_str_new_frozen(data) : data;
+    DMPReader reader    = {
+        (const unsigned char *)RSTRING_PTR(source),
+        (const unsigned char *)RSTRING_PTR(source),
+        (const unsigned char *)RSTRING_PTR(source) + RSTRING_LEN(source)
+    };
+    VALUE patches       = Qnil;
+    long patch_count, diff_count, i, j;
+
+    if(RSTRING_LEN(source) < DMP_BINARY_MAGIC_LEN + 1 ||
+       memcmp(reader.ptr, DMP_BINARY_MAGIC, DMP_BINARY_MAGIC_LEN) != 0)
+    {
+        rb_raise(rb_eArgError, "Invalid binary patch: missing header");
+    }
+
+    reader.ptr += DMP_BINARY_MAGIC_LEN;
+    if(*reader.ptr++ != DMP_BINARY_VERSION)
+    {
+        rb_raise(rb_eArgError, "Invalid binary patch: unsupported version %d", reader.ptr[-1]);
+    }
+
+    patch_count = read_varint_long(&reader);
+    patches     = rb_ary_new_capa(DMP_MIN(patch_count, RSTRING_LEN(source)));
+
+    for(i = 0; i < patch_count; i++)
+    {
+        const long start1  = read_varint_long(&reader);
+        const long start2  = read_varint_long(&reader);
+        const long length1 = read_varint_long(&reader);
+        const long length2 = read_varint_long(&reader);
+        VALUE diffs;
+
+        diff_count = read_varint_long(&reader);
+        diffs      = rb_ary_new_capa(DMP_MIN(diff_count, (long)(reader.end - reader.ptr)));
+
+        for(j = 0; j < diff_count; j++)
+        {
+            const unsigned long header = read_varint(&reader);
+            const unsigned long tag    = header & DMP_BINARY_OP_MASK;
+            const unsigned long size   = header >> DMP_BINARY_OP_BITS;
+            VALUE operation, text;
+
+            switch(tag)
+            {
+                case DMP_BINARY_OP_EQUAL:  operation = dmp_equal_sym;  break;
+                case DMP_BINARY_OP_DELETE: operation = dmp_delete_sym; break;
+                case DMP_BINARY_OP_INSERT: operation = dmp_insert_sym; break;
+                default:
+                    rb_raise(rb_eArgError, "Invalid binary patch: unknown operation tag %lu", tag);
+            }
+
+            if(size > (unsigned long)(reader.end - reader.ptr))
+            {
+                rb_raise(rb_eArgError, "Invalid binary patch: truncated payload at byte %ld", (long)(reader.ptr - reader.start));
+            }
+
+            if(shared)
+            {
+                text = rb_str_subseq(source, (long)(reader.ptr - reader.start), (long)size);
+                rb_enc_associate(text, rb_utf8_encoding());
+            } else {
+                text = rb_utf8_str_new((const char *)reader.ptr, (long)size);
+            }
+
+            if(rb_enc_str_coderange(text) == ENC_CODERANGE_BROKEN)
+            {
+                rb_raise(rb_eArgError, "Invalid binary patch: invalid UTF-8 payload at byte %ld", (long)(reader.ptr - reader.start));
+            }
+
+            reader.ptr += size;
+            rb_ary_push(diffs, dmp_new_node(operation, text));
+        }
+
+        rb_ary_push(patches, dmp_new_patch(diffs, start1, start2, length1, length2));
+    }
+
+    if(reader.ptr != reader.end)
+    {
+        rb_raise(rb_eArgError, "Invalid binary patch: %ld trailing bytes", (long)(reader.end - reader.ptr));
+    }
+
+    return patches;
+}
+
+// Counts the bytes spanned by (up to) the first N characters of a string, starting at the given byte offset
+static long str_head_bytes(VALUE str, long offset, long chars)
+{
+    rb_encoding *enc = rb_enc_get(str);
+    const char *ptr  = RSTRING_PTR(str) + offset;
+    const char *end  = RSTRING_END(str);
+    const char *p    = ptr;
+
+    if(rb_enc_mbmaxlen(enc) == 1 || rb_enc_str_asciionly_p(str))
+    {
+        return DMP_MIN(chars, (long)(end - ptr));
+    }
+
+    while(chars-- > 0 && p < end)
+    {
+        p += rb_enc_mbclen(p, end, enc);
+    }
+
+    return p - ptr;
+}
+
+// Counts the bytes spanned by (up to) the last N characters of a string
+static long str_tail_bytes(VALUE str, long chars)
+{
+    rb_encoding *enc  = rb_enc_get(str);
+    const char *start = RSTRING_PTR(str);
+    const char *end   = RSTRING_END(str);
+    const char *p     = end;
+
+    if(rb_enc_mbmaxlen(enc) == 1 || rb_enc_str_asciionly_p(str))
+    {
+        return DMP_MIN(chars, (long)(end - start));
+    }
+
+    while(chars-- > 0 && p > start)
+    {
+        p = rb_enc_left_char_head(start, p - 1, end, enc);
+    }
+
+    return end - p;
+}
+
+// Builds the trailing N characters of the destination text (all equalities and insertions) of a diff list
+// Ruby equivalent code: diff_text2(diffs)[-count..-1]
+static VALUE diffs_text2_tail(VALUE diffs, long count)
+{
+    VALUE pieces = rb_ary_new();
+    long i;
+
+    for(i = RARRAY_LEN(diffs) - 1; i >= 0 && count > 0; i--)
+    {
+        const VALUE diff = RARRAY_AREF(diffs, i);
+        const VALUE text = RSTRUCT_GET(diff, DMP_NODE_TEXT);
+        VALUE piece;
+        long bytes;
+
+        if(RSTRUCT_GET(diff, DMP_NODE_OPERATION) == dmp_delete_sym) continue;
+
+        bytes  = str_tail_bytes(text, count);
+        piece  = rb_str_subseq(text, RSTRING_LEN(text) - bytes, bytes);
+        count -= rb_str_strlen(piece);
+        rb_ary_push(pieces, piece);
+    }
+
+    return rb_ary_join(rb_ary_reverse(pieces), Qnil);
+}
+
+// Raises a TypeError unless the diffs are an Array of DiffNodes with String texts
+static void check_diffs(VALUE diffs)
+{
+    long i;
+
+    Check_Type(diffs, T_ARRAY);
+    for(i = 0; i < RARRAY_LEN(diffs); i++)
+    {
+        dmp_check_node(RARRAY_AREF(diffs, i));
+        Check_Type(RSTRUCT_GET(RARRAY_AREF(diffs, i), DMP_NODE_TEXT), T_STRING);
+    }
+}
+
+// Builds the leading N characters of the source text (all equalities and deletions) of the remaining diffs
+// Ruby equivalent code: diff_text1(diffs)[0...count]
+static VALUE diffs_text1_head(VALUE diffs, long index, long offset, long count)
+{
+    VALUE context = rb_str_new(0, 0);
+
+    for(; index < RARRAY_LEN(diffs) && count > 0; index++, offset = 0)
+    {
+        const VALUE diff = RARRAY_AREF(diffs, index);
+        const VALUE text = RSTRUCT_GET(diff, DMP_NODE_TEXT);
+        VALUE piece;
+        long bytes;
+
+        if(RSTRUCT_GET(diff, DMP_NODE_OPERATION) == dmp_insert_sym) continue;
+
+        bytes  = str_head_bytes(text, offset, count);
+        piece  = rb_str_subseq(text, offset, bytes);
+        count -= rb_str_strlen(piece);
+        rb_str_append(context, piece);
+    }
+
+    return context;
+}
+
+// Breaks up a single patch which is longer than the maximum limit of the match algorithm,
+// appending the smaller patches onto the result list.
+// The big patch's diffs are walked once with a cursor (index + consumed characters) instead of being shifted.
+static void split_big_patch(VALUE result, VALUE big_patch, const long patch_size, const long margin)
+{
+    const VALUE big_diffs = RSTRUCT_GET(big_patch, DMP_PATCH_DIFFS);
+    long start1           = NUM2LONG(RSTRUCT_GET(big_patch, DMP_PATCH_START1));
+    long start2           = NUM2LONG(RSTRUCT_GET(big_patch, DMP_PATCH_START2));
+    VALUE pre_context     = Qnil;
+    long pre_length       = 0;
+    long index            = 0; // Current diff of the big patch
+    long byte_offset      = 0; // Bytes of the current diff already emitted
+    long char_offset      = 0; // Characters of the current diff already emitted
+    long diff_count, diff_length;
+
+    check_diffs(big_diffs);
+    diff_count  = RARRAY_LEN(big_diffs);
+    diff_length = diff_count > 0 ? rb_str_strlen(RSTRUCT_GET(RARRAY_AREF(big_diffs, 0), DMP_NODE_TEXT)) : 0;
+
+    while(index < diff_count)
+    {
+        // Create one of several smaller patches.
+        VALUE diffs  = rb_ary_new();
+        long length1 = 0;
+        long length2 = 0;
+        bool empty   = true;
+        const long patch_start1 = start1 - pre_length;
+        const long patch_start2 = start2 - pre_length;
+
+        if(pre_length > 0)
+        {
+            length1 = length2 = pre_length;
+            rb_ary_push(diffs, dmp_new_node(dmp_equal_sym, pre_context));
+        }
+
+        while(index < diff_count && length1 < patch_size - margin)
+        {
+            const VALUE diff      = RARRAY_AREF(big_diffs, index);
+            const VALUE operation = RSTRUCT_GET(diff, DMP_NODE_OPERATION);
+            const VALUE text      = RSTRUCT_GET(diff, DMP_NODE_TEXT);
+            const long remaining  = diff_length - char_offset;
+            bool consumed         = true;
+
+            if(operation == dmp_insert_sym ||
+               (operation == dmp_delete_sym && RARRAY_LEN(diffs) == 1 &&
+                RSTRUCT_GET(RARRAY_AREF(diffs, 0), DMP_NODE_OPERATION) == dmp_equal_sym && remaining > 2 * patch_size))
+            {
+                // Insertions are harmless, and a large deletion is let through in one chunk.
+                if(char_offset > 0)
+                {
+                    RSTRUCT_SET(diff, DMP_NODE_TEXT, rb_str_subseq(text, byte_offset, RSTRING_LEN(text) - byte_offset));
+                }
+
+                if(operation == dmp_insert_sym)
+                {
+                    length2 += remaining;
+                    start2  += remaining;
+                } else {
+                    length1 += remaining;
+                    start1  += remaining;
+                }
+
+                empty = false;
+                rb_ary_push(diffs, diff);
+            } else {
+                // Deletion or equality.  Only take as much as we can stomach.
+                const long take  = DMP_MIN(patch_size - length1 - margin, remaining);
+                const long bytes = str_head_bytes(text, byte_offset, take);
+
+                length1 += take;
+                start1  += take;
+                if(operation == dmp_equal_sym)
+                {
+                    length2 += take;
+                    start2  += take;
+                } else {
+                    empty = false;
+                }
+
+                rb_ary_push(diffs, dmp_new_node(operation, rb_str_subseq(text, byte_offset, bytes)));
+
+                if(take < remaining)
+                {
+                    consumed     = false;
+                    byte_offset += bytes;
+                    char_offset += take;
+                }
+            }
+
+            if(consumed && ++index < diff_count)
+            {
+                byte_offset = char_offset = 0;
+                diff_length = rb_str_strlen(RSTRUCT_GET(RARRAY_AREF(big_diffs, index), DMP_NODE_TEXT));
+            }
+        }
+
+        // Compute the head context for the next patch.
+        pre_length  = length2 < margin ? 0 : margin;
+        pre_context = pre_length > 0 ? diffs_text2_tail(diffs, margin) : Qnil;
+
+        // Append the end context for this patch.
+        const VALUE post_context = diffs_text1_head(big_diffs, index, byte_offset, margin);
+        const long post_length   = rb_str_strlen(post_context);
+
+        if(post_length > 0)
+        {
+            const VALUE last = RARRAY_LEN(diffs) > 0 ? rb_ary_entry(diffs, -1) : Qnil;
+
+            length1 += post_length;
+            length2 += post_length;
+
+            if(last != Qnil && RSTRUCT_GET(last, DMP_NODE_OPERATION) == dmp_equal_sym)
+            {
+                RSTRUCT_SET(last, DMP_NODE_TEXT, rb_str_plus(RSTRUCT_GET(last, DMP_NODE_TEXT), post_context));
+            } else {
+                rb_ary_push(diffs, dmp_new_node(dmp_equal_sym, post_context));
+            }
+        }
+
+        if(!empty)
+        {
+            rb_ary_push(result, dmp_new_patch(diffs, patch_start1, patch_start2, length1, length2));
+        }
+    }
+}
+
+// Look through the patches and break up any which are longer than the
+// maximum limit of the match algorithm.
+// The split patches are emitted into a fresh list in one pass, which then replaces the contents of `patches`.
+static VALUE patch_split_max(VALUE self, VALUE patches)
+{
+    Check_Type(patches, T_ARRAY);
+
+    const long patch_size = NUM2LONG(rb_iv_get(self, "@match_max_bits"));
+    const long margin     = NUM2LONG(rb_iv_get(self, "@patch_margin"));
+    const long count      = RARRAY_LEN(patches);
+    VALUE result          = rb_ary_new_capa(count);
+    long i;
+
+    for(i = 0; i < count; i++)
+    {
+        const VALUE patch = RARRAY_AREF(patches, i);
+
+        dmp_check_patch(patch);
+        if(NUM2LONG(RSTRUCT_GET(patch, DMP_PATCH_LENGTH1)) > patch_size)
+        {
+            split_big_patch(result, patch, patch_size, margin);
+        } else {
+            rb_ary_push(result, patch);
+        }
+    }
+
+    rb_ary_replace(patches, result);
+    return Qnil;
+}
+
+// Moves a byte offset up to N characters towards the end of the text.
+// Returns: the new byte offset, `walked` is set to the number of characters passed.
+static long scan_forward(const DMPContextScan *scan, long offset, long chars, long *walked)
+{
+    const long size = scan->end - scan->text;
+    long count      = 0;
+
+    if(scan->single_byte)
+    {
+        count = DMP_MIN(chars, size - offset);
+        *walked = count;
+        return offset + count;
+    }
+
+    while(count < chars && offset < size)
+    {
+        offset += rb_enc_mbclen(scan->text + offset, scan->end, scan->enc);
+        count++;
+    }
+
+    *walked = count;
+    return offset;
+}
+
+// Moves a byte offset up to N characters towards the start of the text.
+// Returns: the new byte offset, `walked` is set to the number of characters passed.
+static long scan_backward(const DMPContextScan *scan, long offset, long chars, long *walked)
+{
+    long count = 0;
+
+    if(scan->single_byte)
+    {
+        count = DMP_MIN(chars, offset);
+        *walked = count;
+        return offset - count;
+    }
+
+    while(count < chars && offset > 0)
+    {
+        offset = rb_enc_left_char_head(scan->text, scan->text + offset - 1, scan->end, scan->enc) - scan->text;
+        count++;
+    }
+
+    *walked = count;
+    return offset;
+}
+
+// Fetch the pattern window for the given padding round, growing the window by `margin` characters
+// on both sides for every round not computed yet.
+static const DMPContextStep *context_step(DMPContextScan *scan, long round)
+{
+    while(scan->step_count <= round)
+    {
+        const DMPContextStep *last = &scan->steps[scan->step_count - 1];
+        DMPContextStep *next;
+        long left_walked, right_walked;
+
+        if(scan->step_count == scan->step_capa)
+        {
+            scan->step_capa *= 2;
+            REALLOC_N(scan->steps, DMPContextStep, scan->step_capa);
+            last = &scan->steps[scan->step_count - 1];
+        }
+
+        next         = &scan->steps[scan->step_count++];
+        next->left   = scan_backward(scan, last->left, scan->margin, &left_walked);
+        next->right  = scan_forward(scan, last->right, scan->margin, &right_walked);
+        next->length = last->length + left_walked + right_walked;
+    }
+
+    return &scan->steps[round];
+}
+
+// Does the pattern of the given padding round appear a second time, `shift` bytes away from itself?
+static bool context_repeats(const DMPContextScan *scan, const DMPContextStep *step, long shift)
+{
+    const long size  = scan->end - scan->text;
+    const long start = step->left + shift;
+
+    if(start < 0 || step->right + shift > size)
+    {
+        return false;
+    }
+
+    if(!scan->self_syncing &&
+       rb_enc_left_char_head(scan->text, scan->text + start, scan->end, scan->enc) != scan->text + start)
+    {
+        return false;
+    }
+
+    return memcmp(scan->text + start, scan->text + step->left, (size_t)(step->right - step->left)) == 0;
+}
+
+// Find the number of padding rounds needed before the pattern becomes unique within the text,
+// or grows beyond `max_length` characters.
+// Ruby equivalent code:
+//   padding += margin while text.index(pattern) != text.rindex(pattern) && pattern.length < max_length
+//
+// Rather than re-scanning the whole text in both directions for every round, every repeat of the
+// first non empty pattern is located in a single forward pass. A repeat of a wider pattern must
+// sit at the same byte shift as one of those repeats, so each one is only widened until it stops matching.
+static long context_rounds(DMPContextScan *scan)
+{
+    const DMPContextStep *step = context_step(scan, 0);
+    long rounds = 0;
+
+    // An empty pattern is found at both ends of the text, so it is never unique.
+    while(step->length == 0 && step->length < scan->max_length && scan->margin > 0)
+    {
+        step = context_step(scan, ++rounds);
+    }
+
+    if(step->length == 0 || step->length >= scan->max_length)
+    {
+        return rounds;
+    }
+
+    const long origin       = step->left;
+    const long pattern_size = step->right - step->left;
+    const char *pattern     = scan->text + origin;
+    const char *last        = scan->end - pattern_size;
+    const char *candidate   = scan->text;
+
+    while(candidate <= last && (candidate = memchr(candidate, *pattern, (size_t)(last - candidate + 1))) != NULL)
+    {
+        const long shift = (candidate - scan->text) - origin;
+
+        if(shift != 0 && memcmp(candidate, pattern, (size_t)pattern_size) == 0)
+        {
+            // Widen the pattern until this repeat no longer matches it.
+            while(context_repeats(scan, context_step(scan, rounds), shift))
+            {
+                if(context_step(scan, rounds)->length >= scan->max_length || scan->margin <= 0)
+                {
+                    return rounds;
+                }
+                rounds++;
+            }
+        }
+
+        candidate++;
+    }
+
+    return rounds;
+}
+
+// Increase the context until it is unique,
+// but don't let the pattern expand beyond match_max_bits.
+static VALUE patch_add_context(VALUE self, VALUE patch, VALUE text)
+{
+    dmp_check_patch(patch);
+    Check_Type(RSTRUCT_GET(patch, DMP_PATCH_DIFFS), T_ARRAY);
+    StringValue(text);
+    if(RSTRING_LEN(text) == 0) return Qnil;
+
+    const long margin   = NUM2LONG(rb_iv_get(self, "@patch_margin"));
+    const long max_bits = NUM2LONG(rb_iv_get(self, "@match_max_bits"));
+    const long start1   = NUM2LONG(RSTRUCT_GET(patch, DMP_PATCH_START1));
+    const long start2   = NUM2LONG(RSTRUCT_GET(patch, DMP_PATCH_START2));
+    const long length1  = NUM2LONG(RSTRUCT_GET(patch, DMP_PATCH_LENGTH1));
+    const long length2  = NUM2LONG(RSTRUCT_GET(patch, DMP_PATCH_LENGTH2));
+    rb_encoding *enc    = rb_enc_get(text);
+    DMPContextScan scan = {
+        RSTRING_PTR(text),
+        RSTRING_END(text),
+        enc,
+        rb_enc_mbmaxlen(enc) == 1 || rb_enc_str_asciionly_p(text),
+        rb_enc_mbmaxlen(enc) == 1 || rb_enc_to_index(enc) == rb_utf8_encindex(),
+        margin,
+        max_bits - 2 * margin,
+        1,
+        8,
+        ALLOC_N(DMPContextStep, 8)
+    };
+    long walked, rounds, prefix_start, prefix_length, suffix_end, suffix_length;
+    VALUE diffs, prefix, suffix;
+
+    // Locate the pattern text[start2, length1] in bytes.
+    scan.steps[0].left   = scan_forward(&scan, 0, DMP_MAX(start2, 0), &walked);
+    scan.steps[0].right  = scan_forward(&scan, scan.steps[0].left, DMP_MAX(length1, 0), &scan.steps[0].length);
+
+    rounds = context_rounds(&scan);
+
+    // Add one chunk for good luck.
+    const long padding = (rounds + 1) * margin;
+    const long left    = scan.steps[0].left;
+    const long right   = scan.steps[0].right;
+    xfree(scan.steps);
+
+    prefix_start  = scan_backward(&scan, left, padding, &prefix_length);
+    suffix_end    = scan_forward(&scan, right, padding, &suffix_length);
+    diffs         = RSTRUCT_GET(patch, DMP_PATCH_DIFFS);
+
+    // Add the prefix.
+    if(prefix_length > 0)
+    {
+        prefix = rb_str_subseq(text, prefix_start, left - prefix_start);
+        rb_ary_unshift(diffs, dmp_new_node(dmp_equal_sym, prefix));
+    }
+
+    // Add the suffix.
+    if(suffix_length > 0)
+    {
+        suffix = rb_str_subseq(text, right, suffix_end - right);
+        rb_ary_push(diffs, dmp_new_node(dmp_equal_sym, suffix));
+    }
+
+    // Roll back the start points.
+    RSTRUCT_SET(patch, DMP_PATCH_START1, LONG2NUM(start1 - prefix_length));
+    RSTRUCT_SET(patch, DMP_PATCH_START2, LONG2NUM(start2 - prefix_length));
+
+    // Extend the lengths.
+    RSTRUCT_SET(patch, DMP_PATCH_LENGTH1, LONG2NUM(length1 + prefix_length + suffix_length));
+    RSTRUCT_SET(patch, DMP_PATCH_LENGTH2, LONG2NUM(length2 + prefix_length + suffix_length));
+
+    return Qnil;
+}
+
+// Read the patch_apply settings from the instance variables
+static DMPApplyConfig apply_config(VALUE self, DMPCancel *cancel)
+{
+    DMPApplyConfig config;
+
+    config.match            = dmp_match_config(self);
+    config.delete_threshold = NUM2DBL(rb_iv_get(self, "@patch_delete_threshold"));
+    config.diff_timeout     = NUM2DBL(rb_iv_get(self, "@diff_timeout"));
+    config.cancel           = cancel;
+
+    return config;
+}
+
+// Convert the diffs of a patch into codepoints and compile its bitap alphabets
+// Returns: the diff_text2 string
+static VALUE prepare_patch(VALUE patch, const DMPApplyConfig *config, rb_encoding *enc, DMPPreparedPatch *prepared)
+{
+    const long max_bits = config->match.max_bits;
+    VALUE text1         = rb_enc_str_new(NULL, 0, enc);
+    VALUE text2         = rb_enc_str_new(NULL, 0, enc);
+    VALUE diffs;
+    long count, i;
+
+    dmp_check_patch(patch);
+    diffs = RSTRUCT_GET(patch, DMP_PATCH_DIFFS);
+    check_diffs(diffs);
+    count = RARRAY_LEN(diffs);
+
+    prepared->start2     = NUM2LONG(RSTRUCT_GET(patch, DMP_PATCH_START2));
+    prepared->length1    = NUM2LONG(RSTRUCT_GET(patch, DMP_PATCH_LENGTH1));
+    prepared->length2    = NUM2LONG(RSTRUCT_GET(patch, DMP_PATCH_LENGTH2));
+    prepared->diff_count = count;
+    prepared->operations = ALLOC_N(int, (size_t)count);
+    prepared->lengths    = ALLOC_N(long, (size_t)count);
+
+    for(i = 0; i < count; i++)
+    {
+        const VALUE diff      = RARRAY_AREF(diffs, i);
+        const VALUE operation = RSTRUCT_GET(diff, DMP_NODE_OPERATION);
+        const VALUE text      = RSTRUCT_GET(diff, DMP_NODE_TEXT);
+
+        prepared->lengths[i]    = rb_str_strlen(text);
+        prepared->operations[i] = operation == dmp_insert_sym ? DMP_DIFF_INSERT :
+                                  operation == dmp_delete_sym ? DMP_DIFF_DELETE : DMP_DIFF_EQUAL;
+
+        if(prepared->operations[i] != DMP_DIFF_INSERT) rb_str_append(text1, text);
+        if(prepared->operations[i] != DMP_DIFF_DELETE) rb_str_append(text2, text);
+    }
+
+    prepared->text1 = rb_str_to_dmp_chars(text1);
+    prepared->text2 = rb_str_to_dmp_chars(text2);
+
+    // Patterns searched by match_main, see match_patch
+    if((long)prepared->text1.size > max_bits)
+    {
+        const DMPString head = { (unsigned int)max_bits, prepared->text1.chars };
+        const DMPString tail = { (unsigned int)max_bits, prepared->text1.chars + prepared->text1.size - max_bits };
+
+        prepared->alphabet      = dmp_match_alphabet(head);
+        prepared->tail_alphabet = dmp_match_alphabet(tail);
+    } else {
+        prepared->alphabet      = dmp_match_alphabet(prepared->text1);
+        prepared->tail_alphabet = NULL;
+    }
+
+    return text2;
+}
+
+// Also frees a zeroed or partly prepared patch, whose preparation raised
+static void free_prepared_patch(DMPPreparedPatch *prepared)
+{
+    FREE_DMP_STR2(prepared->text1, prepared->text2);
+    if(prepared->alphabet != NULL)
+    {
+        FREE_DMP_HT(prepared->alphabet);
+    }
+    if(prepared->tail_alphabet != NULL)
+    {
+        FREE_DMP_HT(prepared->tail_alphabet);
+    }
+    xfree(prepared->operations);
+    xfree(prepared->lengths);
+}
+
+// Prepare the first count patches of a list, collecting their diff_text2 strings into texts2
+static void prepare_patches(VALUE patches, long count, const DMPApplyConfig *config, rb_encoding *enc,
+                            DMPPreparedPatch *prepared, VALUE texts2)
+{
+    long i;
+
+    for(i = 0; i < count; i++)
+    {
+        rb_ary_push(texts2, prepare_patch(RARRAY_AREF(patches, i), config, enc, &prepared[i]));
+    }
+}
+
+// Returns: the encoding text + diff.text would have for every diff_text2 of the patches,
+// raising Encoding::CompatibilityError just like the concatenation would
+static rb_encoding *patched_encoding(VALUE text, VALUE texts2)
+{
+    VALUE encoding_source = text;
+    long i;
+
+    for(i = 0; i < RARRAY_LEN(texts2); i++)
+    {
+        const VALUE text2 = RARRAY_AREF(texts2, i);
+
+        if(rb_enc_check(encoding_source, text2) != rb_enc_get(encoding_source))
+        {
+            encoding_source = text2;
+        }
+    }
+
+    return rb_enc_get(encoding_source);
+}
+
+// Replays the edits of an imperfectly matched patch on a copy of the text around the match
+// and records the smallest window of the text which changed.
+static void apply_patch_edits(const DMPString text, const DMPPreparedPatch *patch, const DMPDiffList *diffs,
+                              long start_loc, long region_size, DMPPatchMatch *match)
+{
+    // Edits can't reach further than the matched region plus the patch texts
+    const long extent = DMP_MIN((long)text.size - start_loc, region_size + (long)patch->text1.size + (long)patch->text2.size);
+    long *buffer      = DMP_NATIVE_ALLOC_N(long, extent + patch->text2.size);
+    long size         = extent;
+    long index1       = 0;
+    long index2       = 0;
+    long text2_offset = 0;
+    long from, to, length, prefix, suffix, i;
+
+    MEMCPY(buffer, text.chars + start_loc, long, extent);
+
+    for(i = 0; i < patch->diff_count; i++)
+    {
+        length = patch->lengths[i];
+
+        if(patch->operations[i] != DMP_DIFF_EQUAL)
+        {
+            index2 = dmp_diff_index(diffs, index1);
+        }
+
+        if(patch->operations[i] == DMP_DIFF_INSERT)
+        {
+            // Ruby equivalent code: text = text[0, start_loc + index2] + diff.text + text[(start_loc + index2)..-1]
+            from = DMP_MIN(index2, size);
+            memmove(buffer + from + length, buffer + from, sizeof(long) * (size_t)(size - from));
+            MEMCPY(buffer + from, patch->text2.chars + text2_offset, long, length);
+            size += length;
+        } else if(patch->operations[i] == DMP_DIFF_DELETE) {
+            // Ruby equivalent code: text = text[0, start_loc + index2] + text[(start_loc + diff_index(diffs, index1 + diff.text.length))..-1]
+            from = DMP_MIN(index2, size);
+            to   = DMP_MIN(DMP_MAX(dmp_diff_index(diffs, index1 + length), from), size);
+            memmove(buffer + from, buffer + to, sizeof(long) * (size_t)(size - to));
+            size -= to - from;
+        }
+
+        if(patch->operations[i] != DMP_DIFF_DELETE)
+        {
+            index1       += length;
+            text2_offset += length;
+        }
+    }
+
+    prefix = 0;
+    while(prefix < size && prefix < extent && buffer[prefix] == text.chars[start_loc + prefix])
+    {
+        prefix++;
+    }
+
+    suffix = 0;
+    while(suffix < size - prefix && suffix < extent - prefix &&
+          buffer[size - suffix - 1] == text.chars[start_loc + extent - suffix - 1])
+    {
+        suffix++;
+    }
+
+    match->buffer           = buffer;
+    match->replacement      = buffer + prefix;
+    match->replacement_size = size - prefix - suffix;
+    match->window_start     = start_loc + prefix;
+    match->window_end       = start_loc + extent - suffix;
+    match->end              = DMP_MAX(start_loc + region_size, match->window_end);
+}
+
+// Locate one patch in the unmodified text and work out the edit it makes there.
+// Same steps as a single iteration of the Ruby patch_apply loop. Safe to call without the GVL.
+static void match_patch(const DMPApplyConfig *config, const DMPString text, rb_encoding *enc,
+                        const DMPPreparedPatch *patch, DMPPatchMatch *match)
+{
+    const long max_bits   = config->match.max_bits;
+    const DMPString text1 = patch->text1;
+    long start_loc        = -1;
+    long end_loc          = -1;
+    long region_size      = 0;
+    DMPDiffContext ctx;
+    DMPDiffList diffs;
+
+    DMP_NATIVE_FREE(match->buffer);
+    match->buffer  = NULL;
+    match->found   = false;
+    match->applied = false;
+
+    if((long)text1.size > max_bits)
+    {
+        DMPString head = { (unsigned int)max_bits, text1.chars };
+        DMPString tail = { (unsigned int)max_bits, text1.chars + text1.size - max_bits };
+
+        start_loc = dmp_match_main(&config->match, text, head, match->expected_loc, patch->alphabet);
+        if(start_loc >= 0)
+        {
+            end_loc = dmp_match_main(&config->match, text, tail, match->expected_loc + text1.size - max_bits, patch->tail_alphabet);
+            if(end_loc < 0 || start_loc >= end_loc)
+            {
+                start_loc = -1;
+            }
+        }
+    } else {
+        start_loc = dmp_match_main(&config->match, text, text1, match->expected_loc, patch->alphabet);
+    }
+
+    if(start_loc < 0)
+    {
+        return; // No match found.
+    }
+
+    // Ruby equivalent code: text2 = text[start_loc, end_loc.negative? ? text1.length : end_loc + @match_max_bits]
+    // end_loc is a location in the patched text there, so the growth of the earlier patches is added back
+    region_size    = end_loc < 0 ? (long)text1.size : end_loc + match->growth + max_bits;
+    region_size    = DMP_MIN(region_size, (long)text.size - start_loc);
+    match->found   = true;
+    match->applied = true;
+    match->start   = start_loc;
+
+    if(region_size == (long)text1.size && memcmp(text.chars + start_loc, text1.chars, sizeof(long) * text1.size) == 0)
+    {
+        // Perfect match, just shove the replacement text in.
+        match->replacement      = patch->text2.chars;
+        match->replacement_size = patch->text2.size;
+        match->window_start     = start_loc;
+        match->window_end       = start_loc + text1.size;
+        match->end              = match->window_end;
+        return;
+    }
+
+    // Imperfect match.
+    // Run a diff to get a framework of equivalent indices.
+    ctx.text1        = text1;
+    ctx.text2.chars  = text.chars + start_loc;
+    ctx.text2.size   = (unsigned int)region_size;
+    ctx.enc          = enc;
+    ctx.half_match   = config->diff_timeout > 0;
+    ctx.parallel_passes = false;
+    ctx.deadline     = config->diff_timeout > 0 ? dmp_time_now() + config->diff_timeout : 0;
+    ctx.cancel       = config->cancel;
+    ctx.progress     = NULL;
+
+    dmp_diff_list_init(&diffs);
+    dmp_diff_main(&ctx, ctx.text1, ctx.text2, &diffs);
+
+    if((long)text1.size > max_bits && ((double)dmp_diff_levenshtein(&diffs) / text1.size) > config->delete_threshold)
+    {
+        match->applied = false;
+    } else {
+        dmp_diff_cleanup_semantic_lossless(&ctx, &diffs);
+        apply_patch_edits(text, patch, &diffs, start_loc, region_size, match);
+    }
+
+    dmp_diff_list_free(&diffs);
+}
+
+static void match_patch_task(void *data, long index)
+{
+    DMPApplyJob *job = data;
+    match_patch(job->config, job->text, job->enc, &job->patches[index], &job->matches[index]);
+}
+
+// Match every patch concurrently, then replay the patch_apply delta bookkeeping in order.
+// Patches whose expected location moved because an earlier patch drifted are searched again.
+static void *apply_without_gvl(void *data)
+{
+    DMPApplyJob *job = data;
+    // Furthest distance from the expected location match_bitap accepts a match at
+    const long radius = (long)(job->config->match.threshold * job->config->match.distance) + 1;
+    long delta        = 0;
+    long last_end     = 0;
+    long expected_loc, i;
+
+    // Short texts are matched faster than the workers are woken up
+    dmp_pool_run_limited(job->count, match_patch_task, job, (long)job->text.size < dmp_pool_min_parallel_size() ? 1 : 0);
+
+    job->growth = 0;
+    for(i = 0; i < job->count; i++)
+    {
+        const DMPPreparedPatch *patch = &job->patches[i];
+        DMPPatchMatch *match          = &job->matches[i];
+
+        // Location in the patched text, the matches were searched for in the original text
+        expected_loc = patch->start2 + delta;
+        if(expected_loc - job->growth != match->expected_loc ||
+           (patch->text1.size > job->config->match.max_bits && job->growth != match->growth))
+        {
+            match->expected_loc = expected_loc - job->growth;
+            match->growth       = job->growth;
+            match_patch(job->config, job->text, job->enc, patch, match);
+        }
+
+        // The sequential search could have seen text an earlier patch changed
+        if(last_end > 0 && match->expected_loc - radius < last_end)
+        {
+            job->overlapping = true;
+            break;
+        }
+
+        if(!match->found)
+        {
+            // Subtract the delta for this failed patch from subsequent patches.
+            delta -= patch->length2 - patch->length1;
+            continue;
+        }
+
+        delta = match->start + job->growth - expected_loc;
+        if(!match->applied)
+        {
+            continue;
+        }
+
+        if(match->start < last_end)
+        {
+            job->overlapping = true;
+            break;
+        }
+
+        last_end     = match->end;
+        job->growth += match->replacement_size - (match->window_end - match->window_start);
+    }
+
+    return NULL;
+}
+
+// Splice the replacements of the applied patches into the text
+static VALUE build_patched_text(const DMPApplyJob *job, rb_encoding *enc)
+{
+    long *chars = ALLOC_N(long, (size_t)(job->text.size + job->growth));
+    long size   = 0;
+    long offset = 0;
+    long i;
+    VALUE result;
+
+    for(i = 0; i < job->count; i++)
+    {
+        const DMPPatchMatch *match = &job->matches[i];
+
+        if(!match->applied)
+        {
+            continue;
+        }
+
+        MEMCPY(chars + size, job->text.chars + offset, long, match->window_start - offset);
+        size += match->window_start - offset;
+        MEMCPY(chars + size, match->replacement, long, match->replacement_size);
+        size  += match->replacement_size;
+        offset = match->window_end;
+    }
+
+    MEMCPY(chars + size, job->text.chars + offset, long, job->text.size - offset);
+    size += job->text.size - offset;
+
+    result = dmp_chars_to_rb_str(chars, size, enc);
+    xfree(chars);
+
+    return result;
+}
+
+// Buffers of a patch_apply_parallel call, released by apply_cleanup even when a patch or the text raises
+typedef struct DMPApplyArgs
+{
+    VALUE patches;
+    VALUE text;
+    DMPCancel *cancel;
+    DMPApplyJob job;
+} DMPApplyArgs;
+
+static VALUE apply_body(VALUE data)
+{
+    DMPApplyArgs *args = (DMPApplyArgs *)data;
+    DMPApplyJob *job   = &args->job;
+    VALUE texts2       = rb_ary_new_capa(job->count);
+    VALUE results      = rb_ary_new_capa(job->count);
+    long offset, i;
+    bool stopped;
+
+    job->patches = ALLOC_N(DMPPreparedPatch, (size_t)job->count);
+    MEMZERO(job->patches, DMPPreparedPatch, job->count);
+    job->matches = ALLOC_N(DMPPatchMatch, (size_t)job->count);
+    MEMZERO(job->matches, DMPPatchMatch, job->count);
+
+    prepare_patches(args->patches, job->count, job->config, job->enc, job->patches, texts2);
+    job->enc  = patched_encoding(args->text, texts2);
+    job->text = rb_str_to_dmp_chars(args->text);
+
+    // Interrupts which don't raise (e.g. a trap handler) stop the matching, it then starts over
+    do
+    {
+        offset = 0;
+        for(i = 0; i < job->count; i++)
+        {
+            // Expected location in the unpatched text, assuming none of the earlier patches drift
+            DMP_NATIVE_FREE(job->matches[i].buffer);
+            MEMZERO(&job->matches[i], DMPPatchMatch, 1);
+            job->matches[i].expected_loc = job->patches[i].start2 - offset;
+            job->matches[i].growth       = offset;
+            offset += job->patches[i].length2 - job->patches[i].length1;
+        }
+
+        job->overlapping          = false;
+        args->cancel->interrupted = false;
+        dmp_without_gvl(apply_without_gvl, job, args->cancel);
+
+        stopped = DMP_CANCELLED(args->cancel);
+        if(stopped)
+        {
+            dmp_check_cancel(args->cancel);
+        }
+    } while(stopped);
+
+    if(job->overlapping)
+    {
+        return Qnil;
+    }
+
+    for(i = 0; i < job->count; i++)
+    {
+        rb_ary_push(results, job->matches[i].applied ? Qtrue : Qfalse);
+    }
+
+    return rb_ary_new_from_args(2, build_patched_text(job, job->enc), results);
+}
+
+static VALUE apply_cleanup(VALUE data)
+{
+    DMPApplyJob *job = &((DMPApplyArgs *)data)->job;
+    long i;
+
+    for(i = 0; job->patches != NULL && i < job->count; i++)
+    {
+        free_prepared_patch(&job->patches[i]);
+    }
+    for(i = 0; job->matches != NULL && i < job->count; i++)
+    {
+        DMP_NATIVE_FREE(job->matches[i].buffer);
+    }
+    xfree(job->patches);
+    xfree(job->matches);
+    xfree(job->text.chars);
+
+    return Qnil;
+}
+
+// Applies padded and split patches to the padded text, locating and verifying
+// every patch in parallel with the GVL released.
+// Returns: [text, results] like patch_apply, or nil when the patched regions
+// overlap and the patches have to be applied sequentially.
+// Ruby equivalent code: patch_apply_parallel(patches, text, cancel = nil)
+static VALUE patch_apply_parallel(int argc, VALUE *argv, VALUE self)
+{
+    VALUE patches, text, token;
+    DMPCancel cancel = { false, NULL, 0 };
+    DMPApplyArgs args;
+
+    rb_scan_args(argc, argv, "21", &patches, &text, &token);
+    Check_Type(patches, T_ARRAY);
+    StringValue(text);
+    cancel.token = dmp_cancel_token(token);
+
+    const DMPApplyConfig config = apply_config(self, &cancel);
+
+    MEMZERO(&args, DMPApplyArgs, 1);
+    // A copy, so a patch's conversion can't change the number of patches
+    args.patches    = rb_ary_dup(patches);
+    args.text       = text;
+    args.cancel     = &cancel;
+    args.job.config = &config;
+    args.job.enc    = rb_enc_get(text);
+    args.job.count  = RARRAY_LEN(args.patches);
+
+    return rb_ensure(apply_body, (VALUE)&args, apply_cleanup, (VALUE)&args);
+}
+
+// Apply every patch to the text one after another, exactly like the Ruby patch_apply loop.
+// Safe to call without the GVL.
+static void apply_patches_in_sequence(const DMPApplyConfig *config, const DMPPreparedPatch *patches,
+                                      long count, DMPBatchText *item)
+{
+    long size         = item->text.size;
+    long capa         = size + 1;
+    long *chars       = DMP_NATIVE_ALLOC_N(long, capa);
+    long delta        = 0;
+    long expected_loc, removed, i;
+    DMPPatchMatch match;
+
+    MEMCPY(chars, item->text.chars, long, size);
+    MEMZERO(&match, DMPPatchMatch, 1);
+
+    for(i = 0; i < count; i++)
+    {
+        const DMPString text = { (unsigned int)size, chars };
+
+        expected_loc       = patches[i].start2 + delta;
+        match.expected_loc = expected_loc;
+        match.growth       = 0;
+        match_patch(config, text, item->enc, &patches[i], &match);
+        item->results[i]   = match.applied;
+
+        if(!match.found)
+        {
+            // Subtract the delta for this failed patch from subsequent patches.
+            delta -= patches[i].length2 - patches[i].length1;
+            continue;
+        }
+
+        delta = match.start - expected_loc;
+        if(!match.applied)
+        {
+            continue;
+        }
+
+        removed = match.window_end - match.window_start;
+        if(size - removed + match.replacement_size > capa)
+        {
+            capa  = 2 * (size - removed + match.replacement_size);
+            chars = dmp_native_realloc(chars, sizeof(long) * (size_t)capa);
+        }
+
+        memmove(chars + match.window_start + match.replacement_size, chars + match.window_end,
+                sizeof(long) * (size_t)(size - match.window_end));
+        MEMCPY(chars + match.window_start, match.replacement, long, match.replacement_size);
+        size += match.replacement_size - removed;
+    }
+
+    DMP_NATIVE_FREE(match.buffer);
+    item->patched      = chars;
+    item->patched_size = size;
+}
+
+static void apply_batch_task(void *data, long index)
+{
+    DMPBatchJob *job = data;
+    apply_patches_in_sequence(job->config, job->patches, job->count, &job->texts[index]);
+}
+
+static void *apply_batch_without_gvl(void *data)
+{
+    DMPBatchJob *job = data;
+
+    dmp_pool_run(job->text_count, apply_batch_task, job);
+    return NULL;
+}
+
+// Buffers of a patch_apply_padded call, released by apply_batch_cleanup even when a patch or a text raises
+typedef struct DMPBatchArgs
+{
+    VALUE patches;
+    VALUE texts;
+    VALUE null_padding;
+    DMPCancel *cancel;
+    long chunk;
+    DMPBatchJob job;
+} DMPBatchArgs;
+
+static VALUE apply_batch_body(VALUE data)
+{
+    DMPBatchArgs *args = (DMPBatchArgs *)data;
+    DMPBatchJob *job   = &args->job;
+    const long count   = job->count;
+    const long padding = rb_str_strlen(args->null_padding);
+    VALUE texts2       = rb_ary_new_capa(count);
+    VALUE output       = rb_ary_new_capa(RARRAY_LEN(args->texts));
+    long first, i, j;
+    bool stopped;
+
+    job->patches = ALLOC_N(DMPPreparedPatch, (size_t)count);
+    MEMZERO(job->patches, DMPPreparedPatch, count);
+    job->texts = ALLOC_N(DMPBatchText, (size_t)args->chunk);
+    MEMZERO(job->texts, DMPBatchText, args->chunk);
+    for(j = 0; j < args->chunk; j++)
+    {
+        job->texts[j].results = ALLOC_N(bool, (size_t)count);
+    }
+
+    prepare_patches(args->patches, count, job->config,
+                    RARRAY_LEN(args->texts) > 0 ? rb_enc_get(RARRAY_AREF(args->texts, 0)) : rb_utf8_encoding(),
+                    job->patches, texts2);
+
+    // Only a chunk of the texts is held as codepoints at any time
+    for(first = 0; first < RARRAY_LEN(args->texts); first += args->chunk)
+    {
+        job->text_count = DMP_MIN(RARRAY_LEN(args->texts) - first, args->chunk);
+
+        for(j = 0; j < job->text_count; j++)
+        {
+            const VALUE text = rb_str_plus(rb_str_plus(args->null_padding, RARRAY_AREF(args->texts, first + j)),
+                                           args->null_padding);
+
+            job->texts[j].enc  = patched_encoding(text, texts2);
+            job->texts[j].text = rb_str_to_dmp_chars(text);
+        }
+
+        // Interrupts which don't raise (e.g. a trap handler) stop the chunk, it then starts over
+        do
+        {
+            for(j = 0; j < job->text_count; j++)
+            {
+                DMP_NATIVE_FREE(job->texts[j].patched);
+                job->texts[j].patched = NULL;
+            }
+
+            args->cancel->interrupted = false;
+            dmp_without_gvl(apply_batch_without_gvl, job, args->cancel);
+
+            stopped = DMP_CANCELLED(args->cancel);
+            if(stopped)
+            {
+                dmp_check_cancel(args->cancel);
+            }
+        } while(stopped);
+
+        for(j = 0; j < job->text_count; j++)
+        {
+            DMPBatchText *item  = &job->texts[j];
+            const VALUE results = rb_ary_new_capa(count);
+
+            for(i = 0; i < count; i++)
+            {
+                rb_ary_push(results, item->results[i] ? Qtrue : Qfalse);
+            }
+
+            // Ruby equivalent code: text[null_padding.length...-null_padding.length]
+            rb_ary_push(output, rb_ary_new_from_args(2, dmp_chars_to_rb_str(item->patched + padding,
+                                                                           item->patched_size - 2 * padding,
+                                                                           item->enc),
+                                                     results));
+            xfree(item->text.chars);
+            DMP_NATIVE_FREE(item->patched);
+            item->text.chars = NULL;
+            item->patched    = NULL;
+        }
+    }
+
+    return output;
+}
+
+static VALUE apply_batch_cleanup(VALUE data)
+{
+    DMPBatchJob *job = &((DMPBatchArgs *)data)->job;
+    long i;
+
+    for(i = 0; job->patches != NULL && i < job->count; i++)
+    {
+        free_prepared_patch(&job->patches[i]);
+    }
+    for(i = 0; job->texts != NULL && i < ((DMPBatchArgs *)data)->chunk; i++)
+    {
+        xfree(job->texts[i].results);
+        xfree(job->texts[i].text.chars);
+        DMP_NATIVE_FREE(job->texts[i].patched);
+    }
+    xfree(job->patches);
+    xfree(job->texts);
+
+    return Qnil;
+}
+
+// Applies padded and split patches to every text, which are padded here with null_padding.
+// The patches are converted and their bitap alphabets compiled only once, the texts are
+// then patched in parallel with the GVL released.
+// Returns: [[text, results], ...] like patch_apply for every text
+static VALUE patch_apply_padded(VALUE self, VALUE patches, VALUE texts, VALUE null_padding)
+{
+    DMPCancel cancel = { false, NULL, 0 };
+    DMPBatchArgs args;
+    long k;
+
+    Check_Type(patches, T_ARRAY);
+    Check_Type(texts, T_ARRAY);
+    StringValue(null_padding);
+
+    // Copies holding every text as a String, so nothing below runs Ruby code which could change the lists
+    texts = rb_ary_dup(texts);
+    for(k = 0; k < RARRAY_LEN(texts); k++)
+    {
+        VALUE text = RARRAY_AREF(texts, k);
+
+        StringValue(text);
+        rb_enc_check(null_padding, text);
+        rb_ary_store(texts, k, text);
+    }
+
+    const DMPApplyConfig config = apply_config(self, &cancel);
+
+    MEMZERO(&args, DMPBatchArgs, 1);
+    args.patches      = rb_ary_dup(patches);
+    args.texts        = texts;
+    args.null_padding = null_padding;
+    args.cancel       = &cancel;
+    args.chunk        = DMP_MIN(RARRAY_LEN(texts), DMP_BATCH_CHUNK);
+    args.job.config   = &config;
+    args.job.count    = RARRAY_LEN(args.patches);
+
+    return rb_ensure(apply_batch_body, (VALUE)&args, apply_batch_cleanup, (VALUE)&args);
+}
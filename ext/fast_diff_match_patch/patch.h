@@ -0,0 +1,121 @@
+#ifndef FAST_DIFF_MATCH_PATCH_PATCH_H
+#define FAST_DIFF_MATCH_PATCH_PATCH_H
+
+#include "ruby/encoding.h"
+#include "diff.h"
+#include "match.h"
+
+// Binary patch format header: "DMP" followed by the format version
+#define DMP_BINARY_MAGIC        "DMP"
+#define DMP_BINARY_MAGIC_LEN    3
+#define DMP_BINARY_VERSION      1
+
+// Operation tags packed into the lower two bits of each diff run header
+#define DMP_BINARY_OP_EQUAL     0
+#define DMP_BINARY_OP_DELETE    1
+#define DMP_BINARY_OP_INSERT    2
+#define DMP_BINARY_OP_BITS      2
+#define DMP_BINARY_OP_MASK      3
+
+typedef struct DMPReader
+{
+    const unsigned char *start;
+    const unsigned char *ptr;
+    const unsigned char *end;
+} DMPReader;
+
+// Byte window of the context pattern after N rounds of padding
+typedef struct DMPContextStep
+{
+    long left;   // Byte offset where the pattern starts
+    long right;  // Byte offset where the pattern ends
+    long length; // Pattern length in characters
+} DMPContextStep;
+
+typedef struct DMPContextScan
+{
+    const char *text;
+    const char *end;
+    rb_encoding *enc;
+    bool single_byte;      // Byte offsets are character offsets
+    bool self_syncing;     // Any byte match is also a character match (UTF-8 and single byte encodings)
+    long margin;
+    long max_length;
+    long step_count;
+    long step_capa;
+    DMPContextStep *steps;
+} DMPContextScan;
+
+// A patch converted to codepoints so it can be applied without the GVL
+typedef struct DMPPreparedPatch
+{
+    long start2;
+    long length1;
+    long length2;
+    DMPString text1;   // Ruby equivalent code: diff_text1(patch.diffs)
+    DMPString text2;   // Ruby equivalent code: diff_text2(patch.diffs)
+    long diff_count;
+    int *operations;   // DMP_DIFF_* of every diff
+    long *lengths;     // Character length of every diff
+    DMP_HT *alphabet;      // Bitap masks of text1, or of its first match_max_bits characters
+    DMP_HT *tail_alphabet; // Bitap masks of the last match_max_bits characters of a longer text1
+} DMPPreparedPatch;
+
+typedef struct DMPApplyConfig
+{
+    DMPMatchConfig match;
+    double delete_threshold; // @patch_delete_threshold
+    double diff_timeout;     // @diff_timeout
+    DMPCancel *cancel;       // Stops the diffs of imperfect matches early
+} DMPApplyConfig;
+
+// Outcome of locating and applying one patch against the unmodified text
+typedef struct DMPPatchMatch
+{
+    long expected_loc;        // Location the search started from
+    long growth;              // Length difference the earlier patches are assumed to cause
+    bool found;               // match_main located the patch
+    bool applied;             // The patch passed the delete threshold and was applied
+    long start;               // Text range read or replaced by the patch
+    long end;
+    long window_start;        // Text range replaced by the replacement
+    long window_end;
+    const long *replacement;
+    long replacement_size;
+    long *buffer;             // Allocation owned by the match, if any
+} DMPPatchMatch;
+
+typedef struct DMPApplyJob
+{
+    const DMPApplyConfig *config;
+    DMPString text;
+    rb_encoding *enc;
+    long count;
+    DMPPreparedPatch *patches;
+    DMPPatchMatch *matches;
+    bool overlapping;         // Patch regions aren't disjoint, the edits must be applied in sequence
+    long growth;              // Length difference of the patched text
+} DMPApplyJob;
+
+// One text of a patch_apply_padded batch
+typedef struct DMPBatchText
+{
+    DMPString text;           // Padded text to patch
+    rb_encoding *enc;         // Encoding of the patched text
+    bool *results;            // Whether every patch was applied
+    long *patched;            // Patched codepoints, allocated without the GVL
+    long patched_size;
+} DMPBatchText;
+
+typedef struct DMPBatchJob
+{
+    const DMPApplyConfig *config;
+    long count;
+    DMPPreparedPatch *patches;
+    long text_count;
+    DMPBatchText *texts;
+} DMPBatchJob;
+
+extern void dmp_init_patch();
+
+#endif //FAST_DIFF_MATCH_PATCH_PATCH_H
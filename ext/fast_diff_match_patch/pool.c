@@ -0,0 +1,333 @@
+#include "fast_diff_match_patch.h"
+#include "pool.h"
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+
+// Jobs waiting for free indexes, oldest first
+static DMPPoolJob *pool_queue      = NULL;
+static long pool_workers           = 0;    // Number of running workers
+static long pool_busy              = 0;    // Workers running an index right now
+static long pool_threads           = 0;    // Configured threads, the calling one included, 0 for one per CPU
+static long pool_cpus              = -1;   // Online CPUs, -1 until first use
+static pthread_mutex_t pool_mutex  = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  pool_work   = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  pool_done   = PTHREAD_COND_INITIALIZER;
+
+// Unlinks a job once all of its indexes were handed out
+static void pool_dequeue(DMPPoolJob *job)
+{
+    DMPPoolJob **link = &pool_queue;
+
+    while(*link != NULL && *link != job)
+    {
+        link = &(*link)->next_job;
+    }
+
+    if(*link == job)
+    {
+        *link = job->next_job;
+    }
+}
+
+// Oldest queued job which can take another thread, or NULL
+static DMPPoolJob *pool_next_job()
+{
+    DMPPoolJob *job = pool_queue;
+
+    while(job != NULL && job->threads > 0 && job->active >= job->threads)
+    {
+        job = job->next_job;
+    }
+
+    return job;
+}
+
+// Runs indexes of the job until none are left. Called and returns with the pool mutex held.
+static void pool_work_on(DMPPoolJob *job)
+{
+    long index = 0;
+
+    job->active++;
+    while(job->next < job->count)
+    {
+        index = job->next++;
+        if(job->next == job->count)
+        {
+            pool_dequeue(job);
+        }
+
+        pthread_mutex_unlock(&pool_mutex);
+        job->task(job->ctx, index);
+        pthread_mutex_lock(&pool_mutex);
+
+        if(++job->done == job->count)
+        {
+            pthread_cond_broadcast(&pool_done);
+        }
+    }
+    job->active--;
+}
+
+// Number of workers the configuration asks for. Called with the pool mutex held.
+static long pool_size()
+{
+    if(pool_threads > 0)
+    {
+        return DMP_MIN(pool_threads - 1, DMP_POOL_MAX_WORKERS);
+    }
+
+    if(pool_cpus < 0)
+    {
+        pool_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    return DMP_MAX(DMP_MIN(pool_cpus - 1, DMP_POOL_MAX_WORKERS), 0);
+}
+
+// Workers above the configured size exit once they run out of work
+static void *pool_worker(void *arg)
+{
+    DMPPoolJob *job = NULL;
+
+    pthread_mutex_lock(&pool_mutex);
+    for(;;)
+    {
+        while((job = pool_next_job()) == NULL)
+        {
+            if(pool_workers > pool_size())
+            {
+                pool_workers--;
+                pthread_mutex_unlock(&pool_mutex);
+                return NULL;
+            }
+            pthread_cond_wait(&pool_work, &pool_mutex);
+        }
+
+        pool_busy++;
+        pool_work_on(job);
+        pool_busy--;
+    }
+
+    return NULL;
+}
+
+// Starts the missing worker threads, lazily on the first run after start up, configure or fork.
+// Called with the pool mutex held. Workers block every signal so they are always delivered to Ruby threads.
+static void pool_start(long size)
+{
+    sigset_t all_signals, previous;
+    pthread_attr_t attr;
+    pthread_t thread;
+
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_SETMASK, &all_signals, &previous);
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    while(pool_workers < size)
+    {
+        if(pthread_create(&thread, &attr, pool_worker, NULL) != 0)
+        {
+            break;
+        }
+        pool_workers++;
+    }
+
+    pthread_attr_destroy(&attr);
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+}
+
+// Calls task(ctx, index) for every index in 0...count across the worker pool
+// and returns once all of them finished. The calling thread takes part in the work.
+// Must be called without the GVL, tasks may not touch Ruby objects.
+void dmp_pool_run(long count, dmp_pool_task task, void *ctx)
+{
+    dmp_pool_run_limited(count, task, ctx, 0);
+}
+
+// Same as dmp_pool_run, running at most the given number of indexes at once (the calling thread included)
+void dmp_pool_run_limited(long count, dmp_pool_task task, void *ctx, long threads)
+{
+    DMPPoolJob job = { task, ctx, count, 0, 0, threads, 0, NULL };
+    DMPPoolJob *other = NULL;
+    DMPPoolJob **tail = &pool_queue;
+    long size;
+
+    pthread_mutex_lock(&pool_mutex);
+    if(pool_workers < (size = pool_size()))
+    {
+        pool_start(size);
+    }
+
+    if(pool_workers > 0 && count > 1 && threads != 1)
+    {
+        while(*tail != NULL)
+        {
+            tail = &(*tail)->next_job;
+        }
+        *tail = &job;
+        pthread_cond_broadcast(&pool_work);
+    }
+
+    pool_work_on(&job);
+    while(job.done < job.count)
+    {
+        // Steal indexes of other jobs, e.g. ones queued by our own tasks, rather than idle until ours finish
+        if((other = pool_next_job()) != NULL)
+        {
+            pool_work_on(other);
+        } else {
+            pthread_cond_wait(&pool_done, &pool_mutex);
+        }
+    }
+    pthread_mutex_unlock(&pool_mutex);
+}
+
+// Locked across fork, so the child never inherits the pool halfway through an update
+static void pool_before_fork()
+{
+    pthread_mutex_lock(&pool_mutex);
+}
+
+static void pool_after_fork_parent()
+{
+    pthread_mutex_unlock(&pool_mutex);
+}
+
+// Only the forking thread survives in the child. Its jobs and workers are gone,
+// the pool starts over and new workers are started by the next run.
+static void pool_after_fork_child()
+{
+    pthread_mutex_init(&pool_mutex, NULL);
+    pthread_cond_init(&pool_work, NULL);
+    pthread_cond_init(&pool_done, NULL);
+    pool_queue   = NULL;
+    pool_workers = 0;
+    pool_busy    = 0;
+}
+
+static void pool_init()
+{
+    pthread_atfork(pool_before_fork, pool_after_fork_parent, pool_after_fork_child);
+}
+
+// Idle workers above the new size exit right away, the others on their way back to the queue
+static void pool_set_threads(long threads)
+{
+    pthread_mutex_lock(&pool_mutex);
+    pool_threads = threads;
+    pthread_cond_broadcast(&pool_work);
+    pthread_mutex_unlock(&pool_mutex);
+}
+
+static VALUE pool_stats_hash()
+{
+    const VALUE stats = rb_hash_new();
+    DMPPoolJob *job = NULL;
+    long jobs = 0, pending = 0;
+    long threads, workers, busy;
+
+    // Ruby objects are only allocated once the lock is released, the workers never wait on the GC
+    pthread_mutex_lock(&pool_mutex);
+    for(job = pool_queue; job != NULL; job = job->next_job)
+    {
+        jobs++;
+        pending += job->count - job->next;
+    }
+    threads = pool_size() + 1;
+    workers = pool_workers;
+    busy    = pool_busy;
+    pthread_mutex_unlock(&pool_mutex);
+
+    rb_hash_aset(stats, ID2SYM(rb_intern("threads")), LONG2NUM(threads));
+    rb_hash_aset(stats, ID2SYM(rb_intern("workers")), LONG2NUM(workers));
+    rb_hash_aset(stats, ID2SYM(rb_intern("active_workers")), LONG2NUM(busy));
+    rb_hash_aset(stats, ID2SYM(rb_intern("queued_jobs")), LONG2NUM(jobs));
+    rb_hash_aset(stats, ID2SYM(rb_intern("queue_depth")), LONG2NUM(pending));
+
+    return stats;
+}
+
+#else
+
+// Without pthreads every task runs on the calling thread
+void dmp_pool_run(long count, dmp_pool_task task, void *ctx)
+{
+    dmp_pool_run_limited(count, task, ctx, 1);
+}
+
+void dmp_pool_run_limited(long count, dmp_pool_task task, void *ctx, long threads)
+{
+    long i;
+
+    for(i = 0; i < count; i++)
+    {
+        task(ctx, i);
+    }
+}
+
+static void pool_init()
+{
+}
+
+static void pool_set_threads(long threads)
+{
+}
+
+static VALUE pool_stats_hash()
+{
+    const VALUE stats = rb_hash_new();
+
+    rb_hash_aset(stats, ID2SYM(rb_intern("threads")), LONG2NUM(1));
+    rb_hash_aset(stats, ID2SYM(rb_intern("workers")), LONG2NUM(0));
+    rb_hash_aset(stats, ID2SYM(rb_intern("active_workers")), LONG2NUM(0));
+    rb_hash_aset(stats, ID2SYM(rb_intern("queued_jobs")), LONG2NUM(0));
+    rb_hash_aset(stats, ID2SYM(rb_intern("queue_depth")), LONG2NUM(0));
+
+    return stats;
+}
+
+#endif
+
+// Read without a lock by every parallel operation, a stale value only moves the cut-over point
+static volatile long pool_min_parallel_size = DMP_POOL_MIN_PARALLEL_SIZE;
+
+long dmp_pool_min_parallel_size()
+{
+    return pool_min_parallel_size;
+}
+
+// nil leaves a setting as it is
+static VALUE pool_configure(VALUE self, VALUE threads, VALUE min_parallel_size)
+{
+    if(!NIL_P(threads))
+    {
+        pool_set_threads(NUM2LONG(threads));
+    }
+
+    if(!NIL_P(min_parallel_size))
+    {
+        pool_min_parallel_size = NUM2LONG(min_parallel_size);
+    }
+
+    return Qnil;
+}
+
+// Ruby equivalent code: { threads:, workers:, active_workers:, queued_jobs:, queue_depth:, min_parallel_size: }
+static VALUE pool_stats(VALUE self)
+{
+    const VALUE stats = pool_stats_hash();
+
+    rb_hash_aset(stats, ID2SYM(rb_intern("min_parallel_size")), LONG2NUM(pool_min_parallel_size));
+    return stats;
+}
+
+void dmp_init_pool()
+{
+    pool_init();
+
+    rb_define_singleton_method(dmp_klass, "pool_configure", RUBY_METHOD_FUNC(pool_configure), 2);
+    rb_define_singleton_method(dmp_klass, "pool_stats", RUBY_METHOD_FUNC(pool_stats), 0);
+}
@@ -0,0 +1,31 @@
+#ifndef FAST_DIFF_MATCH_PATCH_POOL_H
+#define FAST_DIFF_MATCH_PATCH_POOL_H
+
+// Upper bound of worker threads, the calling thread always works as well
+#define DMP_POOL_MAX_WORKERS    16
+
+// Default of min_parallel_size: bisect halves with fewer characters (text1 + text2) and
+// texts shorter than this are handled on the calling thread
+#define DMP_POOL_MIN_PARALLEL_SIZE 2048
+
+// A unit of work, called once for every index of a dmp_pool_run
+typedef void (*dmp_pool_task)(void *ctx, long index);
+
+typedef struct DMPPoolJob
+{
+    dmp_pool_task task;
+    void *ctx;
+    long count;     // Number of indexes to run
+    long next;      // Next index to hand out
+    long done;      // Number of finished indexes
+    long threads;   // Most threads running indexes at once, 0 for no limit
+    long active;    // Threads running indexes right now
+    struct DMPPoolJob *next_job;
+} DMPPoolJob;
+
+extern void dmp_pool_run(long count, dmp_pool_task task, void *ctx);
+extern void dmp_pool_run_limited(long count, dmp_pool_task task, void *ctx, long threads);
+extern long dmp_pool_min_parallel_size();
+extern void dmp_init_pool();
+
+#endif //FAST_DIFF_MATCH_PATCH_POOL_H
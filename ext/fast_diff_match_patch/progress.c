@@ -0,0 +1,204 @@
+#include "fast_diff_match_patch.h"
+#include "progress.h"
+#include "diff.h"
+
+#ifdef HAVE_RUBY_THREAD_H
+#include "ruby/thread.h"
+#endif
+
+static VALUE progress_initialize(VALUE self, VALUE callback, VALUE total);
+static VALUE progress_add(VALUE self, VALUE count);
+static VALUE progress_finish(VALUE self);
+static VALUE progress_completed(VALUE self);
+static VALUE progress_total(VALUE self);
+
+static ID dmp_call_id;
+
+static void progress_mark(void *data);
+static size_t progress_memsize(const void *data);
+
+static const rb_data_type_t progress_type = {
+    "FastDiffMatchPatch::Progress",
+    { progress_mark, RUBY_TYPED_DEFAULT_FREE, progress_memsize, },
+    NULL, NULL, RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+static VALUE progress_alloc(VALUE klass);
+
+void dmp_init_progress()
+{
+    const VALUE progress_klass = rb_define_class_under(dmp_klass, "Progress", rb_cObject);
+
+    dmp_call_id = rb_intern("call");
+
+    rb_define_alloc_func(progress_klass, progress_alloc);
+    rb_define_method(progress_klass, "initialize", RUBY_METHOD_FUNC(progress_initialize), 2);
+    rb_define_method(progress_klass, "add", RUBY_METHOD_FUNC(progress_add), 1);
+    rb_define_method(progress_klass, "finish", RUBY_METHOD_FUNC(progress_finish), 0);
+    rb_define_method(progress_klass, "completed", RUBY_METHOD_FUNC(progress_completed), 0);
+    rb_define_method(progress_klass, "total", RUBY_METHOD_FUNC(progress_total), 0);
+}
+
+static void progress_mark(void *data)
+{
+    rb_gc_mark(((DMPProgress *)data)->callback);
+}
+
+static size_t progress_memsize(const void *data)
+{
+    return sizeof(DMPProgress);
+}
+
+static VALUE progress_alloc(VALUE klass)
+{
+    DMPProgress *progress;
+    const VALUE self = TypedData_Make_Struct(klass, DMPProgress, &progress_type, progress);
+
+    progress->callback = Qnil;
+    return self;
+}
+
+// Ruby equivalent code: Progress.new(->(completed, total) { ... }, total)
+static VALUE progress_initialize(VALUE self, VALUE callback, VALUE total)
+{
+    DMPProgress *progress;
+
+    TypedData_Get_Struct(self, DMPProgress, &progress_type, progress);
+    progress->callback    = callback;
+    progress->total       = NUM2LONG(total);
+    progress->completed   = 0;
+    progress->next_report = 0;
+
+    return self;
+}
+
+static VALUE call_callback(VALUE data)
+{
+    const DMPProgress *progress = (const DMPProgress *)data;
+
+    return rb_funcall(progress->callback, dmp_call_id, 2,
+                      LONG2NUM(DMP_MIN(progress->completed, progress->total)), LONG2NUM(progress->total));
+}
+
+// Calls the callback when DMP_PROGRESS_INTERVAL passed since the last call
+static void report(DMPProgress *progress)
+{
+    const double now = dmp_time_now();
+
+    if(now >= progress->next_report)
+    {
+        progress->next_report = now + DMP_PROGRESS_INTERVAL;
+        call_callback((VALUE)progress);
+    }
+}
+
+// Ruby equivalent code: progress.add(count)
+static VALUE progress_add(VALUE self, VALUE count)
+{
+    DMPProgress *progress;
+
+    TypedData_Get_Struct(self, DMPProgress, &progress_type, progress);
+    progress->completed += NUM2LONG(count);
+    report(progress);
+
+    return self;
+}
+
+// Reports the work as complete, whether the last call was due or not
+static VALUE progress_finish(VALUE self)
+{
+    DMPProgress *progress;
+
+    TypedData_Get_Struct(self, DMPProgress, &progress_type, progress);
+    progress->completed = progress->total;
+    call_callback((VALUE)progress);
+
+    return self;
+}
+
+static VALUE progress_completed(VALUE self)
+{
+    DMPProgress *progress;
+
+    TypedData_Get_Struct(self, DMPProgress, &progress_type, progress);
+
+    return LONG2NUM(DMP_MIN(progress->completed, progress->total));
+}
+
+static VALUE progress_total(VALUE self)
+{
+    DMPProgress *progress;
+
+    TypedData_Get_Struct(self, DMPProgress, &progress_type, progress);
+
+    return LONG2NUM(progress->total);
+}
+
+// Returns: the progress of the Ruby object, claimed by the calling thread; NULL for nil
+DMPProgress *dmp_progress_get(VALUE self)
+{
+    DMPProgress *progress;
+
+    if(NIL_P(self))
+    {
+        return NULL;
+    }
+
+    TypedData_Get_Struct(self, DMPProgress, &progress_type, progress);
+#ifdef HAVE_PTHREAD_H
+    progress->owner = pthread_self();
+#endif
+
+    return progress;
+}
+
+typedef struct DMPProgressCall
+{
+    DMPProgress *progress;
+    int state;
+} DMPProgressCall;
+
+static void *report_with_gvl(void *data)
+{
+    DMPProgressCall *call = data;
+
+    rb_protect(call_callback, (VALUE)call->progress, &call->state);
+    return NULL;
+}
+
+// Add work done without the GVL. On the owner thread the callback is called when due,
+// an exception it raises stops the work through cancel and is raised again by dmp_check_cancel.
+void dmp_progress_add(DMPProgress *progress, DMPCancel *cancel, long count)
+{
+    DMPProgressCall call = { progress, 0 };
+    double now;
+
+    if(progress == NULL)
+    {
+        return;
+    }
+
+    DMP_ATOMIC_ADD(&progress->completed, count);
+
+#ifdef HAVE_PTHREAD_H
+    if(!pthread_equal(progress->owner, pthread_self()))
+    {
+        return;
+    }
+#endif
+
+    // A cancelled run may hold the GVL already, see dmp_without_gvl
+    now = dmp_time_now();
+    if(now < progress->next_report || DMP_CANCELLED(cancel))
+    {
+        return;
+    }
+    progress->next_report = now + DMP_PROGRESS_INTERVAL;
+
+#ifdef HAVE_RUBY_THREAD_H
+    rb_thread_call_with_gvl(report_with_gvl, &call);
+#else
+    report_with_gvl(&call);
+#endif
+    cancel->state = call.state;
+}
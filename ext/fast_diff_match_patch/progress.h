@@ -0,0 +1,36 @@
+#ifndef FAST_DIFF_MATCH_PATCH_PROGRESS_H
+#define FAST_DIFF_MATCH_PATCH_PROGRESS_H
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+// Seconds between two calls of the callback
+#define DMP_PROGRESS_INTERVAL   0.05
+
+// Work done so far, reported to a FastDiffMatchPatch::Progress callback.
+// Diffs count resolved characters: every character of text1 and text2 once it is part of a final diff.
+typedef struct DMPProgress
+{
+    VALUE callback;          // Ruby equivalent code: callback.call(completed, total)
+    volatile long completed; // Added to by every thread working on the diff
+    long total;
+    double next_report;      // dmp_time_now() the callback is called again at
+#ifdef HAVE_PTHREAD_H
+    pthread_t owner;         // The Ruby thread running the work, only it can take the GVL back
+#endif
+} DMPProgress;
+
+#if defined(__GNUC__) || defined(__clang__)
+#define DMP_ATOMIC_ADD(ptr, n)  (__atomic_add_fetch((ptr), (n), __ATOMIC_RELAXED))
+#else
+#define DMP_ATOMIC_ADD(ptr, n)  (*(ptr) += (n))
+#endif
+
+extern void dmp_init_progress();
+extern DMPProgress *dmp_progress_get(VALUE progress);
+
+// Safe to call without the GVL, the callback only runs on the owner thread. cancel must not be NULL.
+extern void dmp_progress_add(DMPProgress *progress, DMPCancel *cancel, long count);
+
+#endif //FAST_DIFF_MATCH_PATCH_PROGRESS_H
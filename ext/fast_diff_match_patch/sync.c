@@ -0,0 +1,672 @@
+#include "fast_diff_match_patch.h"
+#include "sync.h"
+
+static VALUE sync_initialize(int argc, VALUE *argv, VALUE self);
+static VALUE sync_text(VALUE self);
+static VALUE sync_set_text(VALUE self, VALUE text);
+static VALUE sync_shadow(VALUE self);
+static VALUE sync_local_version(VALUE self);
+static VALUE sync_remote_version(VALUE self);
+static VALUE sync_make_message(VALUE self);
+static VALUE sync_receive_message(VALUE self, VALUE message);
+static VALUE sync_sync(VALUE self, VALUE message);
+
+static ID dmp_patch_make_id;
+static ID dmp_patch_apply_id;
+
+static void sync_mark(void *data);
+static void sync_free(void *data);
+static size_t sync_memsize(const void *data);
+
+static const rb_data_type_t sync_type = {
+    "FastDiffMatchPatch::DiffSync",
+    { sync_mark, sync_free, sync_memsize, },
+    NULL, NULL, RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+static VALUE sync_alloc(VALUE klass);
+
+void dmp_init_sync()
+{
+    const VALUE sync_klass = rb_define_class_under(dmp_klass, "DiffSync", rb_cObject);
+
+    dmp_patch_make_id  = rb_intern("patch_make");
+    dmp_patch_apply_id = rb_intern("patch_apply");
+
+    rb_define_alloc_func(sync_klass, sync_alloc);
+    rb_define_method(sync_klass, "initialize", RUBY_METHOD_FUNC(sync_initialize), -1);
+    rb_define_method(sync_klass, "text", RUBY_METHOD_FUNC(sync_text), 0);
+    rb_define_method(sync_klass, "text=", RUBY_METHOD_FUNC(sync_set_text), 1);
+    rb_define_method(sync_klass, "shadow", RUBY_METHOD_FUNC(sync_shadow), 0);
+    rb_define_method(sync_klass, "local_version", RUBY_METHOD_FUNC(sync_local_version), 0);
+    rb_define_method(sync_klass, "remote_version", RUBY_METHOD_FUNC(sync_remote_version), 0);
+    rb_define_method(sync_klass, "make_message", RUBY_METHOD_FUNC(sync_make_message), 0);
+    rb_define_method(sync_klass, "receive_message", RUBY_METHOD_FUNC(sync_receive_message), 1);
+    rb_define_method(sync_klass, "sync", RUBY_METHOD_FUNC(sync_sync), 1);
+}
+
+static void sync_mark(void *data)
+{
+    DMPSync *sync = data;
+
+    rb_gc_mark(sync->dmp);
+    rb_gc_mark(sync->edits);
+}
+
+static void sync_free(void *data)
+{
+    DMPSync *sync = data;
+
+    xfree(sync->text.str.chars);
+    xfree(sync->shadow.str.chars);
+    xfree(sync->backup.str.chars);
+    xfree(sync->scratch.str.chars);
+    xfree(sync);
+}
+
+static size_t sync_memsize(const void *data)
+{
+    const DMPSync *sync = data;
+
+    return sizeof(DMPSync) + sizeof(long) * (size_t)(sync->text.capa + sync->shadow.capa + sync->backup.capa + sync->scratch.capa);
+}
+
+static VALUE sync_alloc(VALUE klass)
+{
+    DMPSync *sync;
+    const VALUE self = TypedData_Make_Struct(klass, DMPSync, &sync_type, sync);
+
+    sync->dmp   = Qnil;
+    sync->edits = Qnil;
+    return self;
+}
+
+static DMPSync *sync_get(VALUE self)
+{
+    DMPSync *sync;
+
+    TypedData_Get_Struct(self, DMPSync, &sync_type, sync);
+    if(sync->busy)
+    {
+        rb_raise(rb_eRuntimeError, "DiffSync is in use by another thread");
+    }
+    if(NIL_P(sync->dmp))
+    {
+        rb_raise(rb_eRuntimeError, "uninitialized DiffSync");
+    }
+
+    return sync;
+}
+
+// Grow the buffer when needed, its old content is dropped
+static void buffer_reserve(DMPSyncBuffer *buffer, long size)
+{
+    if(size > buffer->capa)
+    {
+        buffer->capa = DMP_MAX(size, buffer->capa * 2);
+        REALLOC_N(buffer->str.chars, long, buffer->capa);
+    }
+}
+
+static void buffer_store(DMPSyncBuffer *buffer, const long *chars, long size)
+{
+    buffer_reserve(buffer, size);
+    MEMCPY(buffer->str.chars, chars, long, size);
+    buffer->str.size = (unsigned int)size;
+}
+
+static bool buffer_equal(const DMPSyncBuffer *one, const DMPSyncBuffer *two)
+{
+    return one->str.size == two->str.size && memcmp(one->str.chars, two->str.chars, sizeof(long) * one->str.size) == 0;
+}
+
+static VALUE buffer_to_rb_str(const DMPSync *sync, const DMPSyncBuffer *buffer)
+{
+    return dmp_chars_to_rb_str(buffer->str.chars, buffer->str.size, sync->enc);
+}
+
+// Convert the text into the codepoints of the session encoding
+static void store_text(DMPSync *sync, DMPSyncBuffer *buffer, VALUE text)
+{
+    DMPString chars;
+
+    StringValue(text);
+    if(rb_enc_get(text) != sync->enc && !(rb_enc_asciicompat(sync->enc) && rb_enc_str_asciionly_p(text)))
+    {
+        // Ruby equivalent code: text.encode(encoding)
+        text = rb_str_encode(text, rb_enc_from_encoding(sync->enc), 0, Qnil);
+    }
+
+    chars = rb_str_to_dmp_chars(text);
+    buffer_store(buffer, chars.chars, chars.size);
+    xfree(chars.chars);
+}
+
+// Ruby equivalent code: DiffSync.new(dmp, text = "")
+static VALUE sync_initialize(int argc, VALUE *argv, VALUE self)
+{
+    DMPSync *sync;
+    VALUE dmp, text;
+
+    TypedData_Get_Struct(self, DMPSync, &sync_type, sync);
+    rb_scan_args(argc, argv, "11", &dmp, &text);
+    if(!RTEST(rb_obj_is_kind_of(dmp, dmp_klass)))
+    {
+        rb_raise(rb_eTypeError, "wrong argument type %"PRIsVALUE" (expected FastDiffMatchPatch)", rb_obj_class(dmp));
+    }
+    if(NIL_P(text))
+    {
+        text = rb_enc_str_new("", 0, rb_utf8_encoding());
+    }
+    StringValue(text);
+
+    // An empty or ASCII only text (e.g. from String.new or [].join) doesn't pin the session to
+    // ASCII-8BIT or US-ASCII, it's taken as UTF-8 so later edits can hold any character
+    sync->enc = rb_enc_get(text);
+    if(rb_enc_asciicompat(sync->enc) && rb_enc_str_asciionly_p(text))
+    {
+        sync->enc = rb_utf8_encoding();
+    }
+
+    sync->dmp            = dmp;
+    sync->edits          = rb_ary_new();
+    sync->local_version  = 0;
+    sync->remote_version = 0;
+    sync->backup_version = 0;
+
+    // Both sides start out from the same text
+    store_text(sync, &sync->text, text);
+    buffer_store(&sync->shadow, sync->text.str.chars, sync->text.str.size);
+    buffer_store(&sync->backup, sync->text.str.chars, sync->text.str.size);
+
+    return self;
+}
+
+static VALUE sync_text(VALUE self)
+{
+    const DMPSync *sync = sync_get(self);
+    return buffer_to_rb_str(sync, &sync->text);
+}
+
+static VALUE sync_set_text(VALUE self, VALUE text)
+{
+    store_text(sync_get(self), &sync_get(self)->text, text);
+    return text;
+}
+
+static VALUE sync_shadow(VALUE self)
+{
+    const DMPSync *sync = sync_get(self);
+    return buffer_to_rb_str(sync, &sync->shadow);
+}
+
+static VALUE sync_local_version(VALUE self)
+{
+    return LONG2NUM(sync_get(self)->local_version);
+}
+
+static VALUE sync_remote_version(VALUE self)
+{
+    return LONG2NUM(sync_get(self)->remote_version);
+}
+
+// Characters diff_to_delta leaves unescaped, see ENCODE_REGEX
+static bool delta_safe_byte(unsigned char byte)
+{
+    return (byte >= '0' && byte <= '9') || (byte >= 'A' && byte <= 'Z') || (byte >= 'a' && byte <= 'z') ||
+           (byte != '\0' && strchr("_.;!~*'(),/?:@&=+$#- ", byte) != NULL);
+}
+
+// Ruby equivalent code: URI.encode(text, ENCODE_REGEX)
+static void append_escaped(VALUE delta, VALUE text)
+{
+    const unsigned char *ptr = (const unsigned char *)RSTRING_PTR(text);
+    const unsigned char *end = (const unsigned char *)RSTRING_END(text);
+    char escaped[4];
+
+    for(; ptr < end; ptr++)
+    {
+        if(delta_safe_byte(*ptr))
+        {
+            rb_str_cat(delta, (const char *)ptr, 1);
+        } else {
+            snprintf(escaped, sizeof(escaped), "%%%02X", *ptr);
+            rb_str_cat(delta, escaped, 3);
+        }
+    }
+}
+
+// Crush the native diff into a delta, same format as diff_to_delta.
+// E.g. =3\t-2\t+ing  -> Keep 3 chars, delete 2 chars, insert 'ing'.
+static VALUE diffs_to_delta(const DMPDiffContext *ctx, const DMPDiffList *diffs)
+{
+    const VALUE delta = rb_usascii_str_new(NULL, 0);
+    long i;
+
+    for(i = 0; i < diffs->count; i++)
+    {
+        const DMPDiff *diff = &diffs->items[i];
+
+        if(i > 0)
+        {
+            rb_str_cat(delta, "\t", 1);
+        }
+
+        switch(diff->operation)
+        {
+            case DMP_DIFF_INSERT:
+                rb_str_cat(delta, "+", 1);
+                append_escaped(delta, dmp_chars_to_rb_str(ctx->text2.chars + diff->start, diff->length, ctx->enc));
+                break;
+            case DMP_DIFF_DELETE:
+                rb_str_catf(delta, "-%ld", diff->length);
+                break;
+            default:
+                rb_str_catf(delta, "=%ld", diff->length);
+        }
+    }
+
+    return delta;
+}
+
+static void *diff_without_gvl(void *data)
+{
+    const DMPDiffContext *ctx = ((void **)data)[0];
+    DMPDiffList *diffs        = ((void **)data)[1];
+
+    dmp_diff_main(ctx, ctx->text1, ctx->text2, diffs);
+    return NULL;
+}
+
+static bool has_edits(const DMPDiffList *diffs)
+{
+    long i;
+
+    for(i = 0; i < diffs->count; i++)
+    {
+        if(diffs->items[i].operation != DMP_DIFF_EQUAL)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Diff the shadow against the text and stack the edit, the shadow becomes the text.
+// Nothing is stacked when the text is unchanged.
+static void stack_edit(VALUE self, DMPSync *sync)
+{
+    const double timeout = NUM2DBL(rb_iv_get(sync->dmp, "@diff_timeout"));
+    DMPDiffContext ctx;
+    DMPDiffList diffs;
+    DMPCancel cancel = { false, NULL, 0 };
+    void *job[2]     = { &ctx, &diffs };
+    VALUE delta;
+
+    if(buffer_equal(&sync->shadow, &sync->text))
+    {
+        return;
+    }
+
+    ctx.text1      = sync->shadow.str;
+    ctx.text2      = sync->text.str;
+    ctx.enc        = sync->enc;
+    ctx.half_match = timeout > 0;
+    ctx.parallel_passes = RTEST(rb_iv_get(sync->dmp, "@diff_parallel_passes"));
+    ctx.deadline   = timeout > 0 ? dmp_time_now() + timeout : 0;
+    ctx.cancel     = &cancel;
+    ctx.progress   = NULL;
+
+    // The buffers can't be swapped out by another thread while the GVL is released
+    dmp_diff_list_init(&diffs);
+    sync->busy = true;
+    dmp_without_gvl(diff_without_gvl, job, &cancel);
+    sync->busy = false;
+
+    // Interrupted, nothing is stacked and the diff runs again unless the interrupt raises
+    if(DMP_CANCELLED(&cancel))
+    {
+        dmp_diff_list_free(&diffs);
+        dmp_check_cancel(&cancel);
+        stack_edit(self, sync);
+        return;
+    }
+
+    if(has_edits(&diffs))
+    {
+        delta = diffs_to_delta(&ctx, &diffs);
+        rb_ary_push(sync->edits, rb_ary_new_from_args(2, LONG2NUM(sync->local_version), delta));
+        buffer_store(&sync->shadow, sync->text.str.chars, sync->text.str.size);
+        sync->local_version++;
+    }
+
+    dmp_diff_list_free(&diffs);
+    RB_GC_GUARD(self);
+}
+
+// Returns: the message carrying every unacknowledged edit, including the changes made since the last one
+// e.g. "v:3\nd:5:=4\t+ing\n"
+static VALUE sync_make_message(VALUE self)
+{
+    DMPSync *sync       = sync_get(self);
+    const VALUE message = rb_usascii_str_new(NULL, 0);
+    long i;
+
+    stack_edit(self, sync);
+
+    rb_str_catf(message, DMP_SYNC_ACK_PREFIX "%ld\n", sync->remote_version);
+    for(i = 0; i < RARRAY_LEN(sync->edits); i++)
+    {
+        const VALUE edit = RARRAY_AREF(sync->edits, i);
+
+        rb_str_catf(message, DMP_SYNC_EDIT_PREFIX "%ld:%"PRIsVALUE"\n", NUM2LONG(RARRAY_AREF(edit, 0)), RARRAY_AREF(edit, 1));
+    }
+
+    return message;
+}
+
+static void invalid_message(const char *ptr, const char *end)
+{
+    rb_raise(rb_eArgError, "Invalid sync message line: %.*s", (int)(end - ptr), ptr);
+}
+
+// Parse the digits in front of ptr
+// Returns: a pointer past the digits
+static const char *parse_version(const char *ptr, const char *end, long *version)
+{
+    const char *start = ptr;
+
+    *version = 0;
+    while(ptr < end && *ptr >= '0' && *ptr <= '9')
+    {
+        if(*version > (LONG_MAX - 9) / 10)
+        {
+            invalid_message(start, end);
+        }
+        *version = *version * 10 + (*ptr++ - '0');
+    }
+
+    if(ptr == start)
+    {
+        invalid_message(start, end);
+    }
+
+    return ptr;
+}
+
+static const char *line_end(const char *ptr, const char *end)
+{
+    const char *found = memchr(ptr, '\n', (size_t)(end - ptr));
+    return found == NULL ? end : found;
+}
+
+// Parse an edit line "d:<version>:<delta>"
+// Returns: a pointer to the delta
+static const char *parse_edit(const char *ptr, const char *end, long *version)
+{
+    const char *start = ptr;
+
+    if(end - ptr < 2 || memcmp(ptr, DMP_SYNC_EDIT_PREFIX, 2) != 0)
+    {
+        invalid_message(start, end);
+    }
+
+    ptr = parse_version(ptr + 2, end, version);
+    if(ptr == end || *ptr != ':')
+    {
+        invalid_message(start, end);
+    }
+
+    return ptr + 1;
+}
+
+static int hex_value(char digit)
+{
+    if(digit >= '0' && digit <= '9') return digit - '0';
+    if(digit >= 'A' && digit <= 'F') return digit - 'A' + 10;
+    if(digit >= 'a' && digit <= 'f') return digit - 'a' + 10;
+    return -1;
+}
+
+// Ruby equivalent code: URI.decode(text).force_encoding(encoding)
+static VALUE unescape(const char *ptr, const char *end, rb_encoding *enc)
+{
+    const VALUE text = rb_enc_str_new(NULL, 0, enc);
+    const char *token = ptr;
+    char byte;
+
+    while(ptr < end)
+    {
+        if(*ptr != '%')
+        {
+            rb_str_cat(text, ptr++, 1);
+            continue;
+        }
+
+        if(end - ptr < 3 || hex_value(ptr[1]) < 0 || hex_value(ptr[2]) < 0)
+        {
+            rb_raise(rb_eArgError, "Illegal escape in delta: %.*s", (int)(end - token), token);
+        }
+        byte = (char)(hex_value(ptr[1]) * 16 + hex_value(ptr[2]));
+        rb_str_cat(text, &byte, 1);
+        ptr += 3;
+    }
+
+    return text;
+}
+
+static void scratch_push(DMPSync *sync, const long *chars, long length)
+{
+    DMPSyncBuffer *scratch = &sync->scratch;
+    const long size        = (long)scratch->str.size;
+
+    if(size + length > scratch->capa)
+    {
+        scratch->capa = DMP_MAX(size + length, scratch->capa * 2);
+        REALLOC_N(scratch->str.chars, long, scratch->capa);
+    }
+
+    MEMCPY(scratch->str.chars + size, chars, long, length);
+    scratch->str.size = (unsigned int)(size + length);
+}
+
+// Rebuild the edited shadow from the shadow and a delta into the scratch buffer.
+// The DiffNodes of the delta are appended to diffs unless it's nil.
+// Ruby equivalent code: diff_text2(diff_from_delta(shadow, delta))
+static void apply_delta(DMPSync *sync, const char *ptr, const char *end, VALUE diffs)
+{
+    const DMPString shadow = sync->shadow.str;
+    long position          = 0;
+    long length            = 0;
+    const char *token_end;
+    const char *after;
+    DMPString chars;
+    VALUE text;
+
+    sync->scratch.str.size = 0;
+
+    for(; ptr <= end; ptr = token_end + 1)
+    {
+        token_end = memchr(ptr, '\t', (size_t)(end - ptr));
+        token_end = token_end == NULL ? end : token_end;
+
+        // Blank tokens are ok (from a trailing \t).
+        if(token_end == ptr)
+        {
+            continue;
+        }
+
+        switch(*ptr)
+        {
+            case '+':
+                text  = unescape(ptr + 1, token_end, sync->enc);
+                chars = rb_str_to_dmp_chars(text);
+                scratch_push(sync, chars.chars, chars.size);
+                xfree(chars.chars);
+                if(!NIL_P(diffs))
+                {
+                    rb_ary_push(diffs, dmp_new_node(dmp_insert_sym, text));
+                }
+                break;
+            case '-':
+            case '=':
+                after = ptr + 1 < token_end && ptr[1] >= '0' && ptr[1] <= '9' ? parse_version(ptr + 1, token_end, &length) : ptr + 1;
+                if(after != token_end || after == ptr + 1)
+                {
+                    rb_raise(rb_eArgError, "Invalid number in delta: %.*s", (int)(token_end - ptr), ptr);
+                }
+                if(length > (long)shadow.size - position)
+                {
+                    rb_raise(rb_eArgError, "Delta length exceeds source text length (%u).", shadow.size);
+                }
+                if(*ptr == '=')
+                {
+                    scratch_push(sync, shadow.chars + position, length);
+                }
+                if(!NIL_P(diffs))
+                {
+                    text = dmp_chars_to_rb_str(shadow.chars + position, length, sync->enc);
+                    rb_ary_push(diffs, dmp_new_node(*ptr == '=' ? dmp_equal_sym : dmp_delete_sym, text));
+                }
+                position += length;
+                break;
+            default:
+                rb_raise(rb_eArgError, "Invalid diff operation in delta: %c", *ptr);
+        }
+    }
+
+    if(position != (long)shadow.size)
+    {
+        rb_raise(rb_eArgError, "Delta length (%ld) does not equal source text length (%u).", position, shadow.size);
+    }
+}
+
+// Apply one received edit to the shadow and fold it into the text.
+// The text is patched only when it moved away from the shadow, otherwise it simply becomes the new shadow.
+static void receive_edit(DMPSync *sync, const char *delta, const char *end)
+{
+    const bool diverged = !buffer_equal(&sync->text, &sync->shadow);
+    const VALUE diffs   = diverged ? rb_ary_new() : Qnil;
+    DMPSyncBuffer swap;
+    VALUE shadow, patched;
+
+    apply_delta(sync, delta, end, diffs);
+
+    swap            = sync->shadow;
+    sync->shadow    = sync->scratch;
+    sync->scratch   = swap;
+    sync->remote_version++;
+
+    if(!diverged)
+    {
+        buffer_store(&sync->text, sync->shadow.str.chars, sync->shadow.str.size);
+        return;
+    }
+
+    // Ruby equivalent code: patch_apply(patch_make(shadow, diffs), text).first
+    shadow  = buffer_to_rb_str(sync, &sync->scratch);
+    patched = rb_funcall(sync->dmp, dmp_patch_apply_id, 2,
+                         rb_funcall(sync->dmp, dmp_patch_make_id, 2, shadow, diffs),
+                         buffer_to_rb_str(sync, &sync->text));
+    store_text(sync, &sync->text, RARRAY_AREF(patched, 0));
+}
+
+// Drop the edits the other side acknowledged, falling back to the backup shadow when our last message got lost
+static void receive_ack(DMPSync *sync, long ack)
+{
+    while(RARRAY_LEN(sync->edits) > 0 && NUM2LONG(RARRAY_AREF(RARRAY_AREF(sync->edits, 0), 0)) < ack)
+    {
+        rb_ary_shift(sync->edits);
+    }
+
+    if(ack != sync->local_version)
+    {
+        buffer_store(&sync->shadow, sync->backup.str.chars, sync->backup.str.size);
+        sync->local_version = sync->backup_version;
+        rb_ary_clear(sync->edits);
+    }
+}
+
+// Checks the versions of a message before anything is changed
+static void check_message(const DMPSync *sync, const char *ptr, const char *end, long ack)
+{
+    long expected = sync->remote_version;
+    long version  = 0;
+    const char *line;
+
+    if(ack != sync->local_version && ack != sync->backup_version)
+    {
+        rb_raise(rb_eArgError, "Acknowledged version %ld matches neither the shadow (%ld) nor the backup (%ld) version",
+                 ack, sync->local_version, sync->backup_version);
+    }
+
+    for(; ptr < end; ptr = line + 1)
+    {
+        line = line_end(ptr, end);
+        if(line == ptr)
+        {
+            continue;
+        }
+
+        parse_edit(ptr, line, &version);
+        if(version > expected)
+        {
+            rb_raise(rb_eArgError, "Edit %ld is missing from the sync message", expected);
+        }
+        expected = DMP_MAX(expected, version + 1);
+    }
+}
+
+// Apply the edits of a message made by the other side with make_message.
+// Edits seen before are skipped, so resent messages are harmless.
+// Returns: the updated text
+static VALUE sync_receive_message(VALUE self, VALUE message)
+{
+    DMPSync *sync   = sync_get(self);
+    const char *ptr = StringValueCStr(message);
+    const char *end = ptr + RSTRING_LEN(message);
+    const char *line = line_end(ptr, end);
+    const char *delta;
+    long ack     = 0;
+    long version = 0;
+
+    if(line - ptr < 2 || memcmp(ptr, DMP_SYNC_ACK_PREFIX, 2) != 0 || parse_version(ptr + 2, line, &ack) != line)
+    {
+        invalid_message(ptr, line);
+    }
+    ptr = line == end ? end : line + 1;
+
+    check_message(sync, ptr, end, ack);
+    receive_ack(sync, ack);
+
+    for(; ptr < end; ptr = line + 1)
+    {
+        line = line_end(ptr, end);
+        if(line == ptr)
+        {
+            continue;
+        }
+
+        delta = parse_edit(ptr, line, &version);
+        if(version == sync->remote_version)
+        {
+            receive_edit(sync, delta, line);
+        }
+    }
+
+    // Ruby equivalent code: backup = shadow.dup
+    buffer_store(&sync->backup, sync->shadow.str.chars, sync->shadow.str.size);
+    sync->backup_version = sync->local_version;
+
+    RB_GC_GUARD(message);
+    return buffer_to_rb_str(sync, &sync->text);
+}
+
+// Receive a message and answer it in one go
+// Ruby equivalent code: receive_message(message); make_message
+static VALUE sync_sync(VALUE self, VALUE message)
+{
+    sync_receive_message(self, message);
+    return sync_make_message(self);
+}
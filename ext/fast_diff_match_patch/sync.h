@@ -0,0 +1,36 @@
+#ifndef FAST_DIFF_MATCH_PATCH_SYNC_H
+#define FAST_DIFF_MATCH_PATCH_SYNC_H
+
+#include "diff.h"
+
+// Message lines: "v:<acknowledged version>" followed by one "d:<version>:<delta>" per unacknowledged edit
+#define DMP_SYNC_ACK_PREFIX     "v:"
+#define DMP_SYNC_EDIT_PREFIX    "d:"
+
+// Codepoint buffer kept alive across sync cycles, it only grows
+typedef struct DMPSyncBuffer
+{
+    DMPString str;
+    long capa;
+} DMPSyncBuffer;
+
+// One side of a differential synchronization session.
+// The texts are kept as codepoints between cycles, only the text handed to text= is converted again.
+typedef struct DMPSync
+{
+    VALUE dmp;            // FastDiffMatchPatch instance providing the settings
+    VALUE edits;          // Unacknowledged edits: [[version, delta], ...]
+    DMPSyncBuffer text;
+    DMPSyncBuffer shadow;
+    DMPSyncBuffer backup;  // Shadow as of the last received message
+    DMPSyncBuffer scratch; // Next shadow while a delta is decoded
+    rb_encoding *enc;
+    long local_version;   // Version of the shadow, the number of edits sent
+    long remote_version;  // Number of edits received
+    long backup_version;  // Local version of the backup shadow
+    bool busy;            // A diff is running without the GVL
+} DMPSync;
+
+extern void dmp_init_sync();
+
+#endif //FAST_DIFF_MATCH_PATCH_SYNC_H
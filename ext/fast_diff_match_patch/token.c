@@ -0,0 +1,274 @@
+#include "fast_diff_match_patch.h"
+#include "token.h"
+#include "hash.h"
+
+// Returns: the end of the token starting at ptr
+typedef const char *(*dmp_token_end)(const char *ptr, const char *end, rb_encoding *enc);
+
+static VALUE diff_lines_to_chars(VALUE self, VALUE text1, VALUE text2);
+static VALUE diff_words_to_chars(VALUE self, VALUE text1, VALUE text2);
+static VALUE diff_base_lines_to_chars(VALUE self, VALUE base, VALUE candidates);
+
+void dmp_init_token()
+{
+    rb_define_method(dmp_klass, "diff_lines_to_chars", RUBY_METHOD_FUNC(diff_lines_to_chars), 2);
+    rb_define_method(dmp_klass, "diff_words_to_chars", RUBY_METHOD_FUNC(diff_words_to_chars), 2);
+    rb_define_private_method(dmp_klass, "diff_base_lines_to_chars", RUBY_METHOD_FUNC(diff_base_lines_to_chars), 2);
+}
+
+void dmp_token_table_init(DMPTokenTable *table, uint64_t seed)
+{
+    table->capa  = DMP_TOKEN_SLOTS;
+    table->count = 0;
+    table->seed  = seed;
+    table->slots = DMP_NATIVE_ALLOC_N(DMPToken, table->capa);
+    memset(table->slots, 0, sizeof(DMPToken) * (size_t)table->capa);
+}
+
+void dmp_token_table_free(DMPTokenTable *table)
+{
+    DMP_NATIVE_FREE(table->slots);
+    table->slots = NULL;
+    table->capa  = 0;
+    table->count = 0;
+}
+
+static void token_table_grow(DMPTokenTable *table)
+{
+    DMPToken *old_slots  = table->slots;
+    const long old_capa  = table->capa;
+    long i, j;
+
+    table->capa *= 2;
+    table->slots = DMP_NATIVE_ALLOC_N(DMPToken, table->capa);
+    memset(table->slots, 0, sizeof(DMPToken) * (size_t)table->capa);
+
+    for(i = 0; i < old_capa; i++)
+    {
+        if(old_slots[i].id == 0)
+        {
+            continue;
+        }
+
+        j = (long)(old_slots[i].hash & (uint64_t)(table->capa - 1));
+        while(table->slots[j].id != 0)
+        {
+            j = (j + 1) & (table->capa - 1);
+        }
+        table->slots[j] = old_slots[i];
+    }
+
+    DMP_NATIVE_FREE(old_slots);
+}
+
+// Returns: the token with the given bytes, added with next_id (which must not be 0) when it is new.
+// The bytes must stay alive as long as the table.
+DMPToken *dmp_token_intern(DMPTokenTable *table, const char *ptr, long length, long next_id)
+{
+    return dmp_token_intern_hashed(table, dmp_hash_bytes(ptr, (size_t)length, table->seed), ptr, length, next_id);
+}
+
+// Same as dmp_token_intern with the hash of the bytes (with the seed of the table) already known
+DMPToken *dmp_token_intern_hashed(DMPTokenTable *table, uint64_t hash, const char *ptr, long length, long next_id)
+{
+    DMPToken *token = NULL;
+    long i;
+
+    if((table->count + 1) * 2 > table->capa)
+    {
+        token_table_grow(table);
+    }
+
+    for(i = (long)(hash & (uint64_t)(table->capa - 1)); ; i = (i + 1) & (table->capa - 1))
+    {
+        token = &table->slots[i];
+        if(token->id == 0)
+        {
+            token->hash   = hash;
+            token->ptr    = ptr;
+            token->length = length;
+            token->id     = next_id;
+            table->count++;
+            return token;
+        }
+
+        // Only the hash of a colliding token matches, never its bytes
+        if(token->hash == hash && token->length == length && memcmp(token->ptr, ptr, (size_t)length) == 0)
+        {
+            return token;
+        }
+    }
+}
+
+// Ruby equivalent code: text.each_line
+const char *dmp_line_end(const char *ptr, const char *end, rb_encoding *enc)
+{
+    const char *newline = NULL;
+    int len;
+
+    if(rb_enc_asciicompat(enc))
+    {
+        newline = memchr(ptr, '\n', (size_t)(end - ptr));
+        return newline != NULL ? newline + 1 : end;
+    }
+
+    while(ptr < end)
+    {
+        len = rb_enc_precise_mbclen(ptr, end, enc);
+        if(!MBCLEN_CHARFOUND_P(len))
+        {
+            ptr++;
+            continue;
+        }
+
+        if(rb_enc_mbc_to_codepoint(ptr, end, enc) == '\n')
+        {
+            return ptr + MBCLEN_CHARFOUND_LEN(len);
+        }
+        ptr += MBCLEN_CHARFOUND_LEN(len);
+    }
+
+    return end;
+}
+
+// A run of word characters, or any other single character
+// Ruby equivalent code: text.scan(/\w+|./m)
+static const char *word_end(const char *ptr, const char *end, rb_encoding *enc)
+{
+    const char *start = ptr;
+    int len;
+
+    while(ptr < end)
+    {
+        len = rb_enc_precise_mbclen(ptr, end, enc);
+        if(!MBCLEN_CHARFOUND_P(len))
+        {
+            return ptr == start ? ptr + 1 : ptr;
+        }
+
+        if(!ONIGENC_IS_CODE_CTYPE(enc, rb_enc_mbc_to_codepoint(ptr, end, enc), ONIGENC_CTYPE_WORD))
+        {
+            return ptr == start ? ptr + MBCLEN_CHARFOUND_LEN(len) : ptr;
+        }
+        ptr += MBCLEN_CHARFOUND_LEN(len);
+    }
+
+    return ptr;
+}
+
+// Reduces the text to a string where each character is the index of its token in token_array.
+// Tokens seen for the first time are appended. The surrogate indexes can't be encoded as
+// characters, they are skipped by padding token_array with nil.
+static VALUE tokens_to_chars(VALUE text, DMPTokenTable *table, VALUE token_array, dmp_token_end token_end)
+{
+    rb_encoding *enc = rb_enc_get(text);
+    const char *ptr  = RSTRING_PTR(text);
+    const char *end  = RSTRING_END(text);
+    long *ids        = ALLOC_N(long, (size_t)RSTRING_LEN(text));
+    const char *next = NULL;
+    DMPToken *token  = NULL;
+    long count       = 0;
+    long next_id;
+    VALUE chars;
+
+    while(ptr < end)
+    {
+        if(RARRAY_LEN(token_array) == DMP_TOKEN_SURROGATE_MIN)
+        {
+            rb_ary_resize(token_array, DMP_TOKEN_SURROGATE_MAX + 1);
+        }
+
+        next    = token_end(ptr, end, enc);
+        next_id = RARRAY_LEN(token_array);
+        token   = dmp_token_intern(table, ptr, next - ptr, next_id);
+        if(token->id == next_id)
+        {
+            rb_ary_push(token_array, rb_enc_str_new(ptr, next - ptr, enc));
+        }
+
+        ids[count++] = token->id;
+        ptr = next;
+    }
+
+    chars = dmp_chars_to_rb_str(ids, count, rb_utf8_encoding());
+    xfree(ids);
+
+    return chars;
+}
+
+static VALUE texts_to_chars(VALUE text1, VALUE text2, dmp_token_end token_end)
+{
+    const VALUE token_array = rb_ary_new_from_args(1, rb_str_new_cstr(""));
+    DMPTokenTable table;
+    VALUE chars1, chars2;
+
+    StringValue(text1);
+    StringValue(text2);
+
+    // Ids are handed out in order of appearance, so they don't depend on the seed
+    dmp_token_table_init(&table, 0);
+    chars1 = tokens_to_chars(text1, &table, token_array, token_end);
+    chars2 = tokens_to_chars(text2, &table, token_array, token_end);
+    dmp_token_table_free(&table);
+
+    RB_GC_GUARD(text1);
+    RB_GC_GUARD(text2);
+    return rb_ary_new_from_args(3, chars1, chars2, token_array);
+}
+
+// Split two texts into an array of strings.  Reduce the texts to a string
+// of hashes where each Unicode character represents one line.
+// Ruby equivalent code:
+//   line_array = [""]  # e.g. line_array[4] == "Hello\n"
+//   line_hash = {}     # e.g. line_hash["Hello\n"] == 4
+//   chars = [text1, text2].map do |text|
+//     text.each_line.map { |line| (line_hash[line] ||= (line_array << line).length - 1).chr(Encoding::UTF_8) }.join
+//   end
+//   [*chars, line_array]
+static VALUE diff_lines_to_chars(VALUE self, VALUE text1, VALUE text2)
+{
+    return texts_to_chars(text1, text2, dmp_line_end);
+}
+
+// Same as diff_lines_to_chars with words instead of lines, each run of word characters and
+// every other character is one token. diff_chars_to_lines turns the diffs back into text.
+static VALUE diff_words_to_chars(VALUE self, VALUE text1, VALUE text2)
+{
+    return texts_to_chars(text1, text2, word_end);
+}
+
+// Same as diff_lines_to_chars for one base text and many candidates sharing one line_array,
+// the lines of the base are interned only once.
+// Returns: [base_chars, [candidate_chars, ...], line_array]
+static VALUE diff_base_lines_to_chars(VALUE self, VALUE base, VALUE candidates)
+{
+    const VALUE token_array = rb_ary_new_from_args(1, rb_str_new_cstr(""));
+    VALUE texts, chars, text, base_chars;
+    DMPTokenTable table;
+    long i;
+
+    StringValue(base);
+    Check_Type(candidates, T_ARRAY);
+
+    // Checked before the table is allocated, nothing below raises for a bad candidate
+    texts = rb_ary_new_capa(RARRAY_LEN(candidates));
+    for(i = 0; i < RARRAY_LEN(candidates); i++)
+    {
+        text = RARRAY_AREF(candidates, i);
+        StringValue(text);
+        rb_ary_push(texts, text);
+    }
+
+    chars = rb_ary_new_capa(RARRAY_LEN(texts));
+    dmp_token_table_init(&table, 0);
+    base_chars = tokens_to_chars(base, &table, token_array, dmp_line_end);
+    for(i = 0; i < RARRAY_LEN(texts); i++)
+    {
+        rb_ary_push(chars, tokens_to_chars(RARRAY_AREF(texts, i), &table, token_array, dmp_line_end));
+    }
+    dmp_token_table_free(&table);
+
+    RB_GC_GUARD(base);
+    RB_GC_GUARD(texts);
+    return rb_ary_new_from_args(3, base_chars, chars, token_array);
+}
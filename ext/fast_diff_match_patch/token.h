@@ -0,0 +1,40 @@
+#ifndef FAST_DIFF_MATCH_PATCH_TOKEN_H
+#define FAST_DIFF_MATCH_PATCH_TOKEN_H
+
+#include <stdint.h>
+
+// Slots of a new token table, doubled once half of them are used
+#define DMP_TOKEN_SLOTS         256
+
+// Ids of the UTF-16 surrogates, which aren't valid characters of the token strings
+#define DMP_TOKEN_SURROGATE_MIN 0xD800
+#define DMP_TOKEN_SURROGATE_MAX 0xDFFF
+
+// A distinct line or word, pointing into the text it was first seen in
+typedef struct DMPToken
+{
+    uint64_t hash;
+    const char *ptr;
+    long length;
+    long id;                // 0 for an empty slot
+} DMPToken;
+
+// Interns tokens by content. The stable hash only picks the slot, equal hashes
+// are compared byte for byte so colliding tokens still get their own ids.
+typedef struct DMPTokenTable
+{
+    DMPToken *slots;
+    long capa;              // Power of two
+    long count;
+    uint64_t seed;
+} DMPTokenTable;
+
+extern void dmp_init_token();
+
+extern void dmp_token_table_init(DMPTokenTable *table, uint64_t seed);
+extern void dmp_token_table_free(DMPTokenTable *table);
+extern DMPToken *dmp_token_intern(DMPTokenTable *table, const char *ptr, long length, long next_id);
+extern DMPToken *dmp_token_intern_hashed(DMPTokenTable *table, uint64_t hash, const char *ptr, long length, long next_id);
+extern const char *dmp_line_end(const char *ptr, const char *end, rb_encoding *enc);
+
+#endif //FAST_DIFF_MATCH_PATCH_TOKEN_H
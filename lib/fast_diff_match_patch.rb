@@ -3,14 +3,33 @@
 require "fast_diff_match_patch/version"
 require "fast_diff_match_patch/diff_node"
 require "fast_diff_match_patch/fast_diff_match_patch" # C extension
+require "fast_diff_match_patch/document_cache"
+require "fast_diff_match_patch/diff_session"
 
 # rubocop:disable Metrics/BlockNesting
 class FastDiffMatchPatch
-  attr_accessor :diff_timeout, :diff_edit_cost
+  attr_accessor :diff_timeout, :diff_edit_cost, :diff_parallel_passes, :fiber_offload, :diff_cache
   attr_accessor :match_threshold, :match_distance
   attr_accessor :patch_delete_threshold, :patch_margin
   attr_reader   :match_max_bits
 
+  # Sets up the native thread pool shared by the parallel diffs, matches and
+  # patches of every instance, e.g. once in a Puma initializer. threads: caps
+  # the threads of one parallel operation, the calling thread included (1
+  # turns the pool off, :auto runs one per CPU). Bisect halves and patched
+  # texts shorter than min_parallel_size characters stay on the calling
+  # thread. Omitted settings are left as they are. Workers are started on
+  # first use and again in forked children.
+  def self.configure(threads: nil, min_parallel_size: nil)
+    unless threads.nil? || threads == :auto || threads.is_a?(Integer) && threads.positive?
+      raise ArgumentError.new("threads must be positive or :auto")
+    end
+    raise ArgumentError.new("min_parallel_size must not be negative") if !min_parallel_size.nil? && min_parallel_size.negative?
+
+    pool_configure(threads == :auto ? 0 : threads, min_parallel_size) # C extension
+  end
+  private_class_method :pool_configure
+
   # Init's a diff_match_patch object with default settings.
   # Redefine these in your program to override the defaults.
   def initialize(**options)
@@ -18,6 +37,17 @@ class FastDiffMatchPatch
     @diff_timeout           = options.delete(:diff_timeout)           || 1
     # Cost of an empty edit operation in terms of edit characters.
     @diff_edit_cost         = options.delete(:diff_edit_cost)         || 4
+    # Run the forward and reverse passes of diff_bisect on two threads once
+    # the edit distance gets large, e.g. for big unrelated texts.
+    @diff_parallel_passes   = options.delete(:diff_parallel_passes)   || false
+    # Under a Fiber scheduler (e.g. the async gem) run diffs and patches on a
+    # background thread, so the calling fiber yields to the other fibers
+    # instead of blocking the reactor until the diff is done.
+    @fiber_offload          = options.delete(:fiber_offload)          || false
+    # A DiffCache shared by diff_main calls without a deadline, so pairs
+    # diffed again (e.g. the same revisions by several viewers) are looked up
+    # instead of computed. nil to diff every time.
+    @diff_cache             = options.delete(:diff_cache)
     # At what point is no match declared (0.0 = perfection, 1.0 = very loose).
     @match_threshold        = options.delete(:match_threshold)        || 0.5
     # How far to search for a match (0 = exact location, 1000+ = broad match).
@@ -38,14 +68,49 @@ class FastDiffMatchPatch
 
   # Find the differences between two texts.  Simplifies the problem by
   # stripping any common prefix or suffix off the texts before diffing.
-  def diff_main(text1, text2, check_lines = true, deadline = nil)
+  # Pass the content_hash of both texts as hash1 and hash2 when they are
+  # already known, the texts are then never compared in full.
+  # Pass a CancellationToken as cancel to stop the diff from another thread,
+  # it then raises Cancelled.
+  # Pass a callable as progress to follow a long diff, e.g. with a progress
+  # bar. It's called as progress.call(completed, total) at most every 50ms
+  # and once more when the diff is done, counting the characters of both
+  # texts that are already part of the diff.
+  # Pass cache: false to skip the diff_cache for this call.
+  # Pass a LineDictionary as line_dictionary when diffing the revisions of a
+  # document one after another, the line mode then reuses the lines already
+  # interned by earlier diffs instead of starting over.
+  def diff_main(text1, text2, check_lines = true, deadline = nil, hash1: nil, hash2: nil, cancel: nil, progress: nil, cache: true, line_dictionary: nil)
     raise ArgumentError.new("Null inputs. (diff_main)") if text1.nil? || text2.nil?
+    raise Cancelled.new("cancelled") if !cancel.nil? && cancel.cancelled?
+
+    if offload_fiber?
+      return offload_fiber { diff_main(text1, text2, check_lines, deadline, hash1: hash1, hash2: hash2, cancel: cancel, progress: progress, cache: cache, line_dictionary: line_dictionary) }
+    end
+
+    # Recursive calls share the Progress of the outermost one
+    if !progress.nil? && !progress.is_a?(Progress)
+      progress = Progress.new(progress, text1.length + text2.length) # C extension
+      diffs    = diff_main(text1, text2, check_lines, deadline, hash1: hash1, hash2: hash2, cancel: cancel, progress: progress, cache: cache, line_dictionary: line_dictionary)
+      progress.finish
+      return diffs
+    end
 
     # Check for equality (speedup).
-    if text1 == text2
+    if hash1.nil? || hash2.nil? ? text1 == text2 : hash1 == hash2 && text1.bytesize == text2.bytesize
       return text1.empty? ? [] : [new_equal_node(text1)]
     end
 
+    # Diffs bound to a deadline depend on the time they were computed at, recursive calls pass theirs.
+    if cache && !@diff_cache.nil? && deadline.nil?
+      check_lines = true if check_lines.nil?
+      diffs       = @diff_cache.lookup(text1, text2, hash1, hash2, @diff_timeout, check_lines) # C extension
+      return diffs unless diffs.nil?
+
+      diffs = diff_main(text1, text2, check_lines, nil, hash1: hash1, hash2: hash2, cancel: cancel, progress: progress, cache: false, line_dictionary: line_dictionary)
+      return @diff_cache.store(text1, text2, hash1, hash2, @diff_timeout, check_lines, diffs) # C extension
+    end
+
     # Set a deadline by which time the diff must be complete.
     deadline      = Time.now + @diff_timeout if deadline.nil? && @diff_timeout.positive?
     check_lines   = true if check_lines.nil?
@@ -58,6 +123,7 @@ class FastDiffMatchPatch
       common_prefix = text1[0...common_length]
       text1         = text1[common_length..-1]
       text2         = text2[common_length..-1]
+      progress.add(2 * common_length) unless progress.nil?
     end
 
     # Trim off common suffix (speedup).
@@ -66,9 +132,10 @@ class FastDiffMatchPatch
       common_suffix = text1[-common_length..-1]
       text1         = text1[0...-common_length]
       text2         = text2[0...-common_length]
+      progress.add(2 * common_length) unless progress.nil?
     end
     # Compute the diff on the middle block.
-    diffs = diff_compute(text1, text2, check_lines, deadline)
+    diffs = diff_compute(text1, text2, check_lines, deadline, cancel, progress, line_dictionary)
 
     # Restore the prefix and suffix.
     diffs.unshift(new_equal_node(common_prefix)) unless common_prefix.nil?
@@ -78,18 +145,90 @@ class FastDiffMatchPatch
     diffs
   end
 
+  # Line mode diff of two TokenizedDocuments, e.g. revisions kept in a
+  # DocumentCache. Their stored lines and line hashes are used as they are,
+  # so neither text is split into lines or hashed again. Like diff_main with
+  # check_lines, without first trimming the common prefix and suffix.
+  def diff_documents(document1, document2, deadline = nil, cancel: nil)
+    raise ArgumentError.new("Null inputs. (diff_documents)") if document1.nil? || document2.nil?
+    raise Cancelled.new("cancelled") if !cancel.nil? && cancel.cancelled?
+
+    text1 = document1.text
+    text2 = document2.text
+    if document1.content_hash == document2.content_hash && text1 == text2
+      return text1.empty? ? [] : [new_equal_node(text1)]
+    end
+
+    deadline = Time.now + @diff_timeout if deadline.nil? && @diff_timeout.positive?
+    tokens   = diff_documents_to_chars(document1, document2) # C extension
+    diffs    = diff_line_mode(text1, text2, deadline, cancel, nil, tokens)
+    diff_cleanup_merge(diffs)
+
+    diffs
+  end
+
+  # Find the differences of many [text1, text2] pairs at once.
+  # The pairs are converted and diffed on the native engine across the worker
+  # pool with the GVL released, each like diff_main(text1, text2, false) with
+  # its own diff_timeout. threads: caps the pairs diffed at once (nil for
+  # the whole pool). Returns the diffs in input order, or yields the diffs
+  # and index of each pair when given a block. The pairs are diffed in
+  # chunks of 256 and yielded in input order once their chunk is done.
+  def diff_batch(pairs, threads: nil, &block)
+    raise ArgumentError.new("threads must be positive") if !threads.nil? && threads < 1
+    # The block runs on the calling fiber
+    return offload_fiber { diff_batch(pairs, threads: threads) } if block.nil? && offload_fiber?
+
+    diff_pairs(pairs, threads || 0, &block) # C extension
+  end
+
+  # Find the differences between one base text and each of the candidates,
+  # e.g. to rank near duplicates. The base is converted once and shared by
+  # every diff. parallel: true spreads the candidates over the worker pool.
+  # Like diff_main, texts over 100 characters are diffed in line mode: the
+  # lines of the base are interned once for all candidates, the line diffs
+  # are computed together and their replacement blocks rediffed character by
+  # character. Pass check_lines: false to diff every candidate like
+  # diff_main(base, candidate, false) instead.
+  def diff_one_to_many(base, candidates, parallel: false, check_lines: true)
+    raise ArgumentError.new("Null inputs. (diff_one_to_many)") if base.nil? || candidates.nil?
+    return offload_fiber { diff_one_to_many(base, candidates, parallel: parallel, check_lines: check_lines) } if offload_fiber?
+
+    threads = parallel ? 0 : 1
+    lines   = check_lines && base.length > 100 ? candidates.each_index.select { |i| candidates[i].length > 100 } : []
+    return diff_base_pairs(base, candidates, threads) if lines.empty? # C extension
+
+    results = Array.new(candidates.length)
+    others  = candidates.each_index.to_a - lines
+    diff_base_pairs(base, candidates.values_at(*others), threads).each_with_index { |diffs, i| results[others[i]] = diffs } # C extension
+
+    # Scan the texts on a line-by-line basis first, the base is tokenized once.
+    base_chars, candidate_chars, line_array = diff_base_lines_to_chars(base, candidates.values_at(*lines)) # C extension
+    diff_base_pairs(base_chars, candidate_chars, threads).each_with_index do |diffs, i| # C extension
+      deadline = Time.now + @diff_timeout if @diff_timeout.positive?
+      diffs    = diff_rediff_lines(diffs, line_array, base.length + candidates[lines[i]].length, deadline)
+      diff_cleanup_merge(diffs)
+      results[lines[i]] = diffs
+    end
+
+    results
+  end
+
   # Find the differences between two texts.  Assumes that the texts do not
   # have any common prefix or suffix.
-  def diff_compute(text1, text2, check_lines, deadline)
+  def diff_compute(text1, text2, check_lines, deadline, cancel = nil, progress = nil, line_dictionary = nil)
+    short_text, long_text = [text1, text2].sort_by(&:length)
+    sub_index = long_text.index(short_text)
+
+    # Every shortcut below resolves both texts at once.
+    progress.add(text1.length + text2.length) if !progress.nil? && (!sub_index.nil? || short_text.length == 1)
+
     # Just add some text (speedup).
     return [new_insert_node(text2)] if text1.empty?
 
     # Just delete some text (speedup).
     return [new_delete_node(text1)] if text2.empty?
 
-    short_text, long_text = [text1, text2].sort_by(&:length)
-    sub_index = long_text.index(short_text)
-
     unless sub_index.nil?
       operation = text1.length > text2.length ? :DELETE : :INSERT
       # Shorter text is inside the longer text (speedup).
@@ -112,66 +251,93 @@ class FastDiffMatchPatch
     unless hm.nil?
       # A half-match was found, sort out the return data.
       text1_a, text1_b, text2_a, text2_b, mid_common = hm
+      progress.add(2 * mid_common.length) unless progress.nil?
       # Send both pairs off for separate processing.
-      diffs_a = diff_main(text1_a, text2_a, check_lines, deadline)
-      diffs_b = diff_main(text1_b, text2_b, check_lines, deadline)
+      diffs_a = diff_main(text1_a, text2_a, check_lines, deadline, cancel: cancel, progress: progress, cache: false, line_dictionary: line_dictionary)
+      diffs_b = diff_main(text1_b, text2_b, check_lines, deadline, cancel: cancel, progress: progress, cache: false, line_dictionary: line_dictionary)
       # Merge the results.
       return diffs_a + [new_equal_node(mid_common)] + diffs_b
     end
 
     if check_lines && text1.length > 100 && text2.length > 100
-      return diff_line_mode(text1, text2, deadline)
+      return diff_line_mode(text1, text2, deadline, cancel, progress, nil, line_dictionary)
     end
 
-    diff_bisect(text1, text2, deadline) # C Extention call
+    diff_bisect(text1, text2, deadline, cancel, progress) # C Extention call
   end
 
   # Do a quick line-level diff on both strings, then rediff the parts for
   # greater accuracy.
   # This speedup can produce non-minimal diffs.
-  def diff_line_mode(text1, text2, deadline)
+  # Pass tokens to use the result of an earlier diff_lines_to_chars, or a
+  # LineDictionary to take the line ids from.
+  def diff_line_mode(text1, text2, deadline, cancel = nil, progress = nil, tokens = nil, line_dictionary = nil)
+    if tokens.nil? && !line_dictionary.nil?
+      # The ids are only valid inside the block.
+      return line_dictionary.lines_to_chars(text1, text2) do |*line_tokens| # C extension
+        diff_line_mode(text1, text2, deadline, cancel, progress, line_tokens)
+      end
+    end
+
+    length = text1.length + text2.length
+
     # Scan the text on a line-by-line basis first.
-    text1, text2, line_array = diff_lines_to_chars(text1, text2)
-    diffs = diff_main(text1, text2, false, deadline)
+    text1, text2, line_array = tokens || diff_lines_to_chars(text1, text2)
+    diffs = diff_main(text1, text2, false, deadline, cancel: cancel, cache: false)
+    diff_rediff_lines(diffs, line_array, length, deadline, cancel, progress)
+  end
+
+  # The second half of diff_line_mode: turn the diffs of the line tokens back
+  # into text and rediff the replacement blocks character by character.
+  # length is the length of both texts, for the progress.
+  def diff_rediff_lines(diffs, line_array, length, deadline, cancel = nil, progress = nil)
     diff_chars_to_lines(diffs, line_array) # Convert the diff back to original text.
     diff_cleanup_semantic(diffs)           # Eliminate freak matches (e.g. blank lines)
 
     # Rediff any replacement blocks, this time character-by-character.
-    # Add a dummy entry at the end.
-    diffs << new_equal_node("")
-    pointer      = 0
+    # The blocks don't depend on each other, so they are collected first,
+    # diffed concurrently and spliced back in a single pass.
+    blocks       = [] # e.g. [[pointer, count], ...]
+    texts        = [] # e.g. [[text_delete, text_insert], ...]
     count_delete = 0
     count_insert = 0
     text_delete  = ""
     text_insert  = ""
 
-    while pointer < diffs.length
-      case diffs[pointer].operation
+    # Add a dummy entry at the end.
+    (diffs + [new_equal_node("")]).each.with_index do |diff, pointer|
+      case diff.operation
       when :INSERT
         count_insert += 1
-        text_insert  += diffs[pointer].text
+        text_insert  += diff.text
       when :DELETE
         count_delete += 1
-        text_delete  += diffs[pointer].text
+        text_delete  += diff.text
       else # equal
         # Upon reaching an equality, check for prior redundancies.
         if count_delete.positive? && count_insert.positive?
-          # Delete the offending records and add the merged ones.
-          pointer = pointer - count_delete - count_insert
-          diffs.slice!(pointer, count_delete + count_insert)
-          sub_diffs         = diff_main(text_delete, text_insert, false, deadline)
-          diffs[pointer, 0] = sub_diffs
-          pointer          += sub_diffs.length
+          blocks << [pointer - count_delete - count_insert, count_delete + count_insert]
+          texts  << [text_delete, text_insert]
         end
         count_insert = 0
         count_delete = 0
         text_delete  = ""
         text_insert  = ""
       end
-      pointer += 1
+    end
+    # Everything but the replacement blocks is final.
+    progress.add(length - texts.inject(0) { |sum, (text_a, text_b)| sum + text_a.length + text_b.length }) unless progress.nil?
+    return diffs if blocks.empty?
+
+    # Delete the offending records and add the merged ones.
+    rediffed = []
+    pointer  = 0
+    blocks.zip(diff_main_parallel(texts, deadline, cancel, progress)) do |(start, count), sub_diffs| # C extension
+      rediffed.concat(diffs[pointer...start]).concat(sub_diffs)
+      pointer = start + count
     end
 
-    diffs.tap(&:pop) # Remove the dummy entry at the end.
+    rediffed.concat(diffs[pointer..-1])
   end
 
   # Given the location of the 'middle snake', split the diff in two parts
@@ -183,38 +349,14 @@ class FastDiffMatchPatch
     text2b = text2[y..-1]
 
     # Compute both diffs serially.
-    diffs_a = diff_main(text1a, text2a, false, deadline)
-    diffs_b = diff_main(text1b, text2b, false, deadline)
+    diffs_a = diff_main(text1a, text2a, false, deadline, cache: false)
+    diffs_b = diff_main(text1b, text2b, false, deadline, cache: false)
 
     diffs_a + diffs_b
   end
 
-  # Split two texts into an array of strings.  Reduce the texts to a string
-  # of hashes where each Unicode character represents one line.
-  def diff_lines_to_chars(text1, text2)
-    line_array = [""]  # e.g. line_array[4] == "Hello\n"
-    line_hash = {}     # e.g. line_hash["Hello\n"] == 4
-
-    encoded_strings = [text1, text2].map do |text|
-      # Split text into an array of strings.  Reduce the text to a string of
-      # hashes where each Unicode character represents one line.
-      chars = ""
-      text.each_line do |line|
-        if line_hash[line]
-          chars += line_hash[line].chr(Encoding::UTF_8)
-        else
-          chars += line_array.length.chr(Encoding::UTF_8)
-          line_hash[line] = line_array.length
-          line_array << line
-        end
-      end
-      chars
-    end
-
-    encoded_strings << line_array
-  end
-
   # Rehydrate the text in a diff from a string of line hashes to real lines of text.
+  # Works as well for the word tokens of diff_words_to_chars.
   def diff_chars_to_lines(diffs, line_array)
     diffs.each do |diff|
       diff.text = diff.text.chars.map { |c| line_array[c.ord] }.join
@@ -676,19 +818,17 @@ class FastDiffMatchPatch
             end
           end
 
-          # Delete the offending records and add the merged ones.
+          # Delete the offending records and add the merged ones, unless
+          # factoring emptied them.
           position = pointer - count_delete - count_insert
-          diffs[position, count_delete + count_insert] =
-            if count_delete.zero?
-              [new_insert_node(text_insert)]
-            elsif count_insert.zero?
-              [new_delete_node(text_delete)]
-            else
-              [new_delete_node(text_delete), new_insert_node(text_insert)]
-            end
+          merged   = []
+          merged << new_delete_node(text_delete) unless text_delete.empty?
+          merged << new_insert_node(text_insert) unless text_insert.empty?
+          diffs[position, count_delete + count_insert] = merged
+          pointer = position + merged.length
+        end
 
-          pointer = position + (count_delete.zero? ? 0 : 1) + (count_insert.zero? ? 0 : 1) + 1
-        elsif pointer.positive? && diffs[pointer - 1].is_equal?
+        if pointer.positive? && diffs[pointer - 1].is_equal?
           # Merge this equality with the previous one.
           diffs[pointer - 1].text += diffs[pointer].text
           diffs[pointer, 1] = []
@@ -818,7 +958,7 @@ class FastDiffMatchPatch
       false
     end
 
-    if diffs.length != idx && diffs[idx].is_delete?
+    if !idx.nil? && diffs[idx].is_delete?
       last_chars2
     else
       last_chars2 + (loc - last_chars1)
@@ -872,7 +1012,7 @@ class FastDiffMatchPatch
           patch.length2 += diff.text.length
         elsif diff.text.length >= 2 * @patch_margin
           unless patch.diffs.empty?
-            patch_add_context(patch, prepatch_text)
+            patch_add_context(patch, prepatch_text) # C extension
             patches << patch
             patch         = TempPatch.new
             prepatch_text = postpatch_text
@@ -886,7 +1026,7 @@ class FastDiffMatchPatch
     end
 
     unless patch.diffs.empty?
-      patch_add_context(patch, prepatch_text)
+      patch_add_context(patch, prepatch_text) # C extension
       patches << patch
     end
 
@@ -966,38 +1106,6 @@ class FastDiffMatchPatch
     patches
   end
 
-  def patch_add_context(patch, text)
-    return if text.empty?
-
-    padding            = 0
-    pattern            = text[patch.start2, patch.length1]
-    max_pattern_length = @match_max_bits - 2 * @patch_margin
-
-    while text.index(pattern) != text.rindex(pattern) && pattern.length < max_pattern_length
-      padding += @patch_margin
-      pattern = text[[0, patch.start2 - padding].max...(patch.start2 + patch.length1 + padding)]
-    end
-
-    # Add one chunk for good luck.
-    padding += @patch_margin
-
-    # Add the prefix.
-    prefix = text[[0, patch.start2 - padding].max...patch.start2]
-    patch.diffs.unshift(new_equal_node(prefix)) unless prefix.to_s.empty?
-
-    # Add the suffix.
-    suffix = text[patch.start2 + patch.length1, padding]
-    patch.diffs << new_equal_node(suffix) unless suffix.to_s.empty?
-
-    # Roll back the start points.
-    patch.start1 -= prefix.length
-    patch.start2 -= prefix.length
-
-    # Extend the lengths.
-    patch.length1 += prefix.length + suffix.length
-    patch.length2 += prefix.length + suffix.length
-  end
-
   def patch_add_padding(patches)
     padding_length = @patch_margin
     null_padding   = (1..padding_length).map { |x| x.chr(Encoding::UTF_8) }.join
@@ -1046,92 +1154,27 @@ class FastDiffMatchPatch
     null_padding
   end
 
-  # Look through the patches and break up any which are longer than the
-  # maximum limit of the match algorithm.
-  def patch_split_max(patches)
-    patch_size = match_max_bits
-
-    x = 0
-    while x < patches.length
-      if patches[x].length1 > patch_size
-        big_patch = patches[x]
-        # Remove the big old patch
-        patches[x, 1] = []
-        x -= 1
-        start1 = big_patch.start1
-        start2 = big_patch.start2
-        pre_context = ""
-        until big_patch.diffs.empty?
-          # Create one of several smaller patches.
-          patch = TempPatch.new
-          empty = true
-          patch.start1 = start1 - pre_context.length
-          patch.start2 = start2 - pre_context.length
-          unless pre_context.empty?
-            patch.length1 = patch.length2 = pre_context.length
-            patch.diffs.push(new_equal_node(pre_context))
-          end
-
-          while !big_patch.diffs.empty? && patch.length1 < patch_size - patch_margin
-            diff = big_patch.diffs.first
-            if diff.is_insert?
-              # Insertions are harmless.
-              patch.length2 += diff.text.length
-              start2 += diff.text.length
-              patch.diffs.push(big_patch.diffs.shift)
-              empty = false
-            elsif diff.is_delete? && patch.diffs.length == 1 &&
-                  patch.diffs.first.is_equal? && diff[1].length > 2 * patch_size
-              # This is a large deletion.  Let it pass in one chunk.
-              patch.length1 += diff.text.length
-              start1 += diff.text.length
-              empty = false
-              patch.diffs.push(big_patch.diffs.shift)
-            else
-              # Deletion or equality.  Only take as much as we can stomach.
-              diff_text = diff.text[0, patch_size - patch.length1 - patch_margin]
-              patch.length1 += diff_text.length
-              start1        += diff_text.length
-              if diff.is_equal?
-                patch.length2 += diff_text.length
-                start2 += diff_text.length
-              else
-                empty = false
-              end
-              patch.diffs.push(DiffNode.new(diff.operation, diff_text))
-              if diff_text == big_patch.diffs.first.text
-                big_patch.diffs.shift
-              else
-                big_patch.diffs.first.text = big_patch.diffs.first.text[diff_text.length..-1]
-              end
-            end
-          end
+  # Merge a set of patches onto the text. Returns the patched text and an array
+  # of true/false values indicating which patches were applied.
+  # With parallel: true the patches are located and verified concurrently with
+  # the GVL released. This gives the same result when the patched regions are
+  # disjoint; patches touching overlapping regions are applied sequentially.
+  # Pass checksum: true to get the content_hash of the patched text as a
+  # third element, e.g. to verify it against the other side of a sync.
+  # Pass a CancellationToken as cancel to stop from another thread, it then
+  # raises Cancelled.
+  # Pass a callable as progress to follow the patches, it's called like for
+  # diff_main with the number of patches processed so far.
+  def patch_apply(patches, text, parallel: false, checksum: false, cancel: nil, progress: nil)
+    if offload_fiber?
+      return offload_fiber { patch_apply(patches, text, parallel: parallel, checksum: checksum, cancel: cancel, progress: progress) }
+    end
 
-          # Compute the head context for the next patch.
-          pre_context = diff_text2(patch.diffs)[-patch_margin..-1] || ""
-
-          # Append the end context for this patch.
-          post_context = diff_text1(big_patch.diffs)[0...patch_margin] || ""
-          unless post_context.empty?
-            patch.length1 += post_context.length
-            patch.length2 += post_context.length
-            if !patch.diffs.empty? && patch.diffs.last.is_equal?
-              patch.diffs.last.text += post_context
-            else
-              patch.diffs.push(new_equal_node(post_context))
-            end
-          end
-          unless empty
-            x += 1
-            patches[x, 0] = [patch]
-          end
-        end
-      end
-      x += 1
+    if checksum
+      patched, results = patch_apply(patches, text, parallel: parallel, cancel: cancel, progress: progress)
+      return [patched, results, content_hash(patched)] # C extension
     end
-  end
 
-  def patch_apply(patches, text)
     return [text, []] if patches.empty?
 
     patches      = Marshal.load(Marshal.dump(patches)) # Deep copy patches to prevent outside mutation
@@ -1139,9 +1182,20 @@ class FastDiffMatchPatch
     text         = null_padding + text + null_padding
     delta        = 0
     results      = []
-    patch_split_max(patches)
+    patch_split_max(patches) # C extension
+    progress = Progress.new(progress, patches.length) unless progress.nil? # C extension
+
+    if parallel
+      applied = patch_apply_parallel(patches, text, cancel) # C extension
+      unless applied.nil?
+        progress.finish unless progress.nil?
+        return [applied[0][null_padding.length...-null_padding.length], applied[1]]
+      end
+    end
 
     patches.each.with_index do |patch, idx|
+      raise Cancelled.new("cancelled") if !cancel.nil? && cancel.cancelled?
+
       expected_loc = patch.start2 + delta
       text1        = diff_text1(patch.diffs)
       end_loc      = -1
@@ -1174,7 +1228,7 @@ class FastDiffMatchPatch
         else
           # Imperfect match.
           # Run a diff to get a framework of equivalent indices.
-          diffs = diff_main(text1, text2, false)
+          diffs = diff_main(text1, text2, false, nil, cancel: cancel)
           if text1.length > @match_max_bits && (diff_levenshtein(diffs).to_f / text1.length) > @patch_delete_threshold
             results[idx] = false
           else
@@ -1194,14 +1248,58 @@ class FastDiffMatchPatch
           end
         end
       end
+
+      progress.add(1) unless progress.nil?
     end
 
     text = text[null_padding.length...-null_padding.length]
+    progress.finish unless progress.nil?
     [text, results]
   end
 
+  # Merge a set of patches onto each of the texts. Returns an array with the
+  # patch_apply result of every text.
+  # The patches are padded, split and compiled once, then applied to the texts
+  # concurrently with the GVL released.
+  def patch_apply_batch(patches, texts, checksum: false)
+    return offload_fiber { patch_apply_batch(patches, texts, checksum: checksum) } if offload_fiber?
+
+    if checksum
+      return patch_apply_batch(patches, texts).map do |patched, results|
+        [patched, results, content_hash(patched)] # C extension
+      end
+    end
+
+    return texts.map { |text| [text, []] } if patches.empty?
+
+    patches      = Marshal.load(Marshal.dump(patches)) # Deep copy patches to prevent outside mutation
+    null_padding = patch_add_padding(patches)
+    patch_split_max(patches) # C extension
+
+    patch_apply_padded(patches, texts, null_padding) # C extension
+  end
+
   private
 
+  # The calling thread runs a Fiber scheduler (Ruby 3.0+) and fiber_offload is set
+  def offload_fiber?
+    @fiber_offload && Fiber.respond_to?(:scheduler) && !Fiber.scheduler.nil?
+  end
+
+  # Run the block on a background thread, which has no scheduler of its own.
+  # Thread#value only suspends the calling fiber while the native engine runs
+  # without the GVL. Stopping the fiber kills the thread, which interrupts the
+  # engine right away.
+  def offload_fiber
+    thread = Thread.new do
+      Thread.current.report_on_exception = false
+      yield
+    end
+    thread.value
+  ensure
+    thread.kill unless thread.nil?
+  end
+
   def new_delete_node(text)
     DiffNode.new(:DELETE, text)
   end
@@ -12,15 +12,18 @@ class FastDiffMatchPatch
       self.text       = text
     end
 
+    # Methods defined from a block can't be called outside the main Ractor.
     VALID_OPERATIONS.each do |opt|
       method = opt.to_s.downcase
-      define_method("is_#{method}?") do
-        operation == opt
-      end
+      class_eval <<~RUBY, __FILE__, __LINE__ + 1
+        def is_#{method}?
+          operation == :#{opt}
+        end
 
-      define_method("to_#{method}!") do
-        self.operation = opt
-      end
+        def to_#{method}!
+          self.operation = :#{opt}
+        end
+      RUBY
     end
 
     alias_method :text1_change?, :is_delete?
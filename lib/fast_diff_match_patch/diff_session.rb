@@ -0,0 +1,113 @@
+# frozen_string_literal: true
+
+class FastDiffMatchPatch
+  # Keeps the diff of text1 against a text2 that is being edited, e.g. the
+  # saved and the current version of a document in an editor. After an edit
+  # only the diffs around it are computed again, between equalities on both
+  # sides that the edit doesn't touch, so the cost follows the size of the
+  # edit instead of the size of the document.
+  class DiffSession
+    # Characters of the equalities next to an edit that are diffed again with
+    # it, so the new diffs can line up with the text around the edit.
+    MARGIN = 32
+
+    attr_reader :dmp, :text1, :text2, :diffs
+
+    def initialize(dmp, text1, text2, check_lines = true)
+      @dmp         = dmp
+      @text1       = text1
+      @text2       = text2
+      @check_lines = check_lines
+      @diffs       = dmp.diff_main(text1, text2, check_lines)
+    end
+
+    # Replaces text2 with a new version, in which the length characters at
+    # start were edited (typed, pasted or replaced). Both are found by
+    # comparing the versions when not given.
+    # Returns: the diffs of text1 against the new text2
+    def update(text2, start = nil, length = nil)
+      if start.nil? || length.nil?
+        start  = @dmp.diff_common_prefix(@text2, text2)
+        common = @dmp.diff_common_suffix(@text2[start..-1], text2[start..-1])
+        length = text2.length - start - common
+      end
+
+      delta = text2.length - @text2.length
+      if start.negative? || length.negative? || length - delta < 0 || start + length > text2.length
+        raise ArgumentError.new("Invalid edit: #{start}, #{length}")
+      end
+
+      left   = anchor_before(start)
+      right  = anchor_after(start + length - delta, left)
+      middle = @dmp.diff_main(@text1[left[1]...right[1]], text2[left[2]...(right[2] + delta)], @check_lines)
+
+      # Keep the diffs outside the anchors, cutting the equalities holding them in two.
+      prefix = left[0].negative? ? [] : @diffs[0...left[0]]
+      prefix += [DiffNode.new(:EQUAL, @diffs[left[0]].text[0...left[3]])] if left[3].positive?
+      suffix = right[0] == @diffs.length ? [] : @diffs[(right[0] + 1)..-1]
+      suffix = [DiffNode.new(:EQUAL, @diffs[right[0]].text[right[3]..-1])] + suffix if right[0] < @diffs.length && right[3] < @diffs[right[0]].text.length
+
+      # Merge the new diffs with their neighbours, on copies as earlier results
+      # share the nodes. Merging can slide an edit to the edge of the window,
+      # it then takes in more neighbours.
+      window = middle
+      loop do
+        window = (prefix.pop(2) + window + suffix.shift(2)).map(&:dup)
+        @dmp.diff_cleanup_merge(window)
+        break if window.empty? || (prefix.empty? || window.first.is_equal? != prefix.last.is_equal?) &&
+                                  (suffix.empty? || window.last.is_equal? != suffix.first.is_equal?)
+      end
+
+      @text2 = text2
+      @diffs = prefix + window + suffix
+    end
+
+    private
+
+    # Returns: [index, offset1, offset2, offset in the equality] of the point
+    # in the last equality starting at or before the text2 offset, MARGIN
+    # characters further back where the equality allows. [-1, 0, 0, 0] when
+    # no equality comes first.
+    def anchor_before(offset)
+      anchor  = [-1, 0, 0, 0]
+      offset1 = 0
+      offset2 = 0
+
+      @diffs.each_with_index do |diff, index|
+        break if offset2 > offset
+
+        length = diff.text.length
+        if diff.operation == :EQUAL
+          point  = [offset2, [offset, offset2 + length].min - MARGIN].max
+          anchor = [index, offset1 + point - offset2, point, point - offset2]
+        end
+        offset1 += length unless diff.operation == :INSERT
+        offset2 += length unless diff.operation == :DELETE
+      end
+
+      anchor
+    end
+
+    # Returns: [index, offset1, offset2, offset in the equality] of the point
+    # in the first equality ending at or after the (old) text2 offset and not
+    # before the left anchor, MARGIN characters further on where the equality
+    # allows. [diffs.length, text1.length, text2.length, 0] when no equality
+    # follows.
+    def anchor_after(offset, left)
+      offset1 = 0
+      offset2 = 0
+
+      @diffs.each_with_index do |diff, index|
+        length = diff.text.length
+        if diff.operation == :EQUAL && index >= left[0] && offset2 + length >= offset
+          point = [offset2 + length, [offset2, offset].max + MARGIN].min
+          return [index, offset1 + point - offset2, point, point - offset2]
+        end
+        offset1 += length unless diff.operation == :INSERT
+        offset2 += length unless diff.operation == :DELETE
+      end
+
+      [@diffs.length, @text1.length, @text2.length, 0]
+    end
+  end
+end
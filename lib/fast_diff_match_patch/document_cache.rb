@@ -0,0 +1,59 @@
+# frozen_string_literal: true
+
+require "fileutils"
+
+class FastDiffMatchPatch
+  class TokenizedDocument
+    # Maps a file written by write, or reads it where mmap isn't available.
+    def self.open(path)
+      respond_to?(:map) ? map(path) : load(File.binread(path)) # C extension
+    end
+
+    # Writes the document to path, readers never see a partial file.
+    def write(path)
+      temp = "#{path}.#{Process.pid}.#{Thread.current.object_id}.tmp"
+      File.binwrite(temp, dump) # C extension
+      File.rename(temp, path)
+    ensure
+      File.unlink(temp) if !temp.nil? && File.exist?(temp)
+    end
+  end
+
+  # A directory of TokenizedDocuments named after the content_hash of their
+  # text. Each document is tokenized once, later lookups (from any process
+  # sharing the directory) map the file instead.
+  class DocumentCache
+    EXTENSION = ".dmpt"
+
+    attr_reader :dir
+
+    def initialize(dir)
+      @dir = dir
+      FileUtils.mkdir_p(dir)
+    end
+
+    # Returns: the document of the text, tokenized and written on a miss.
+    # A file of a colliding or stale text is replaced.
+    def fetch(text)
+      hash     = FastDiffMatchPatch.content_hash(text) # C extension
+      document = lookup(hash)
+      return document if !document.nil? && document.encoding == text.encoding && document.text == text
+
+      document = TokenizedDocument.new(text) # C extension
+      document.write(path(hash))
+      document
+    end
+
+    # Returns: the cached document with the given content_hash, nil if there
+    # is none or its file is unreadable.
+    def lookup(hash)
+      TokenizedDocument.open(path(hash))
+    rescue ArgumentError, SystemCallError
+      nil
+    end
+
+    def path(hash)
+      File.join(@dir, format("%016x", hash) + EXTENSION)
+    end
+  end
+end
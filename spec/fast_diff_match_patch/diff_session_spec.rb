@@ -0,0 +1,44 @@
+# frozen_string_literal: true
+
+require "spec_helper"
+
+RSpec.describe FastDiffMatchPatch::DiffSession do
+  let(:dmp)     { FastDiffMatchPatch.new }
+  let(:saved)   { (1..200).map { |i| "Line #{i} of the saved document.\n" }.join }
+  let(:current) { saved.sub("Line 20 of", "Line twenty of").sub("Line 150 of the", "Line 150 of this") }
+  let(:session) { FastDiffMatchPatch::DiffSession.new(dmp, saved, current) }
+
+  describe "#update" do
+    it "rediffs the edited range only" do
+      start  = session.text2.index("Line 100") + 5
+      edited = session.text2[0...start] + "one hundred" + session.text2[(start + 3)..-1]
+      diffs  = session.update(edited, start, "one hundred".length)
+
+      expect(diffs).to eq(dmp.diff_main(saved, edited))
+      expect(session.text2).to eq(edited)
+    end
+
+    it "finds the edited range itself" do
+      edited = session.text2.sub("Line twenty of", "Line 20 of").sub("Line 199", "Line ὂ᭚ 199")
+      diffs  = session.update(edited)
+
+      expect(dmp.diff_text1(diffs)).to eq(saved)
+      expect(dmp.diff_text2(diffs)).to eq(edited)
+      expect(diffs.each_cons(2).none? { |diff1, diff2| diff1.operation == diff2.operation }).to be true
+      expect(session.update(saved)).to eq([FastDiffMatchPatch::DiffNode.new(:EQUAL, saved)])
+    end
+
+    it "leaves earlier diffs unchanged" do
+      diffs = session.diffs
+      copy  = diffs.map(&:dup)
+      session.update(session.text2.sub("Line 150 of this", "Line 150 of that"))
+
+      expect(diffs).to eq(copy)
+    end
+
+    it "raises on an edit outside the text" do
+      expect { session.update(current + "abc", current.length, 2) }.to raise_error(ArgumentError)
+      expect { session.update(current, current.length - 2, 4) }.to raise_error(ArgumentError)
+    end
+  end
+end
@@ -72,6 +72,24 @@ RSpec.describe FastDiffMatchPatch do
     end
   end
 
+  describe "#diff_words_to_chars" do
+    it "splits words and other characters" do
+      expect(dmp.diff_words_to_chars("The quick, brown fox.", "The brown fox!")).to eq(
+        ["\x01\x02\x03\x04\x02\x05\x02\x06\x07", "\x01\x02\x05\x02\x06\x08", ["", "The", " ", "quick", ",", "brown", "fox", ".", "!"]]
+      )
+    end
+
+    it "skips the surrogate codepoints" do
+      words = (1..0xE000).map { |x| "w#{x} " }.join
+      chars, _, word_list = dmp.diff_words_to_chars(words, "")
+
+      expect(chars.valid_encoding?).to be true
+      expect(word_list[0xD800]).to be_nil
+      diffs = [delete_node(chars)]
+      expect { dmp.diff_chars_to_lines(diffs, word_list) }.to change { diffs }.to([delete_node(words)])
+    end
+  end
+
   describe "#diff_chars_to_lines" do
     let(:diffs) { [equal_node("\x01\x02\x01"), insert_node("\x02\x01\x02")] }
 
@@ -168,6 +186,11 @@ RSpec.describe FastDiffMatchPatch do
 
         expect_cleanup_change(diffs, [equal_node("xa"), delete_node("d"), insert_node("b"), equal_node("cy")])
       end
+
+      it "drops edits emptied by the unpacking" do
+        diffs = [equal_node("x"), delete_node("ab"), insert_node("ab"), equal_node("y")]
+        expect_cleanup_change(diffs, [equal_node("xaby")])
+      end
     end
 
     def expect_cleanup_change(diffs, results)
@@ -310,6 +333,30 @@ RSpec.describe FastDiffMatchPatch do
     end
   end
 
+  describe "#diff_index" do
+    let(:diffs) { [delete_node("a"), insert_node("1234"), equal_node("xyz")] }
+
+    it { expect(dmp.diff_index(diffs, 2)).to eq(5) }
+    it { expect(dmp.diff_index([equal_node("a"), delete_node("1234"), equal_node("xyz")], 3)).to eq(1) }
+
+    it "translates a location past the last diff" do
+      expect(dmp.diff_index(diffs, 10)).to eq(13)
+    end
+  end
+
+  describe "#content_hash" do
+    it "is the xxHash64 digest of the bytes" do
+      expect(dmp.content_hash("")).to eq(0xEF46DB3751D8E999)
+      expect(dmp.content_hash("abc")).to eq(0x44BC2CF5AD770999)
+      expect(dmp.content_hash("a" * 100)).to eq(0x375041E8B1DECFB3)
+      expect(dmp.content_hash("", 2654435761)).to eq(0xAC75FDA2929B17EF)
+    end
+
+    it "tells different texts apart" do
+      expect(dmp.content_hash("ὂ᭚ quick brown fox")).not_to eq(dmp.content_hash("ὂ᭚ quick brown fix"))
+    end
+  end
+
   describe "#diff_bisect" do
     it "breaks apart word differences" do
       a     = "cat"
@@ -323,6 +370,111 @@ RSpec.describe FastDiffMatchPatch do
       b     = "map"
       expect(dmp.diff_bisect(a, b, Time.now - 1)).to eq([delete_node("cat"), insert_node("map")])
     end
+
+    it "gives the same result for large texts each run" do
+      a     = (1..400).map { |i| "#{i * 7 % 13} ὂ᭚ #{i}" }.join("\n")
+      b     = (1..400).map { |i| "#{i * 5 % 11} ὂ #{i}" }.join("\n")
+      diffs = dmp.diff_bisect(a, b, nil)
+
+      expect(dmp.diff_text1(diffs)).to eq(a)
+      expect(dmp.diff_text2(diffs)).to eq(b)
+      expect(dmp.diff_bisect(a, b, nil)).to eq(diffs)
+    end
+
+    it "finds the same middle snake with parallel passes" do
+      random = Random.new(42)
+      a      = Array.new(3000) { "abc"[random.rand(3)] }.join
+      b      = Array.new(3000) { "abc"[random.rand(3)] }.join
+      diffs  = dmp.diff_bisect(a, b, nil)
+
+      dmp.diff_parallel_passes = true
+      expect(dmp.diff_bisect(a, b, nil)).to eq(diffs)
+    end
+
+    it "stops when the token is cancelled from another thread" do
+      random = Random.new(42)
+      a      = Array.new(100_000) { "abcd"[random.rand(4)] }.join
+      b      = Array.new(100_000) { "abcd"[random.rand(4)] }.join
+      token  = FastDiffMatchPatch::CancellationToken.new
+      Thread.new { sleep 0.05; token.cancel }
+
+      expect { dmp.diff_bisect(a, b, nil, token) }.to raise_error(FastDiffMatchPatch::Cancelled)
+      expect(token.cancelled?).to eq(true)
+    end
+
+    it "stops on Thread#raise" do
+      random = Random.new(42)
+      a      = Array.new(100_000) { "abcd"[random.rand(4)] }.join
+      b      = Array.new(100_000) { "abcd"[random.rand(4)] }.join
+      thread = Thread.new { dmp.diff_bisect(a, b, nil) }
+      thread.report_on_exception = false if thread.respond_to?(:report_on_exception=)
+      sleep 0.05
+      thread.raise(Interrupt)
+
+      expect { thread.join }.to raise_error(Interrupt)
+    end
+  end
+
+  describe "#diff_main_parallel" do
+    it "diffs every pair like diff_main" do
+      pairs = [["cat", "map"], ["", "abc"], ["a123b456c", "abc"], ["ὂ᭚ fox", "ὂ fix"]]
+
+      expect(dmp.diff_main_parallel(pairs, nil)).to eq(pairs.map { |a, b| dmp.diff_main(a, b, false) })
+    end
+
+    it "rejects malformed pairs" do
+      expect { dmp.diff_main_parallel([["a"]], nil) }.to raise_error(ArgumentError)
+    end
+  end
+
+  describe "#diff_batch" do
+    let(:pairs) { Array.new(300) { |i| ["Revision #{i} of ὂ᭚ the text", "Revision #{i + 1} of the ὂ text"] } }
+
+    it "diffs every pair in input order" do
+      expect(dmp.diff_batch(pairs, threads: 2)).to eq(pairs.map { |a, b| dmp.diff_main(a, b, false) })
+    end
+
+    it "drops edits emptied by the merge cleanup like diff_main" do
+      expect(dmp.diff_batch([["c b ba b c b", "ba ba c a"]])).to eq([dmp.diff_main("c b ba b c b", "ba ba c a", false)])
+    end
+
+    it "yields the diffs of every pair" do
+      yielded = []
+      dmp.diff_batch(pairs) { |diffs, index| yielded[index] = diffs }
+
+      expect(yielded).to eq(dmp.diff_batch(pairs))
+    end
+
+    it "rejects a thread count below one" do
+      expect { dmp.diff_batch(pairs, threads: 0) }.to raise_error(ArgumentError)
+    end
+  end
+
+  describe "#diff_one_to_many" do
+    let(:base)       { "The quick brown fox jumps over the lazy dog. ὂ᭚" }
+    let(:candidates) { ["The quick brown fox jumped over a lazy dog. ὂ᭚", "", base, "ὂ quick red fox"] * 100 }
+
+    it "diffs the base against every candidate" do
+      expect(dmp.diff_one_to_many(base, candidates)).to eq(candidates.map { |candidate| dmp.diff_main(base, candidate, false) })
+    end
+
+    it "gives the same result in parallel" do
+      expect(dmp.diff_one_to_many(base, candidates, parallel: true)).to eq(dmp.diff_one_to_many(base, candidates))
+    end
+
+    context "with texts long enough for the line mode" do
+      let(:base)       { (1..100).map { |i| "Line #{i} of the document.\n" }.join }
+      let(:candidates) { [base.sub("Line 5 of", "Line five of").sub("Line 90 of", "Line 90 in"), base.sub("Line 4", "ὂ᭚"), "short", base] }
+
+      it "diffs the lines first like diff_main" do
+        expect(dmp.diff_one_to_many(base, candidates)).to eq(candidates.map { |candidate| dmp.diff_main(base, candidate) })
+        expect(dmp.diff_one_to_many(base, candidates, parallel: true)).to eq(candidates.map { |candidate| dmp.diff_main(base, candidate) })
+      end
+
+      it "diffs by character with check_lines: false" do
+        expect(dmp.diff_one_to_many(base, candidates, check_lines: false)).to eq(candidates.map { |candidate| dmp.diff_main(base, candidate, false) })
+      end
+    end
   end
 
   describe "#diff_main" do
@@ -338,6 +490,86 @@ RSpec.describe FastDiffMatchPatch do
       expect(dmp.diff_main("abc", "ab123c", false)).to eq([equal_node("ab"), insert_node("123"), equal_node("c")])
     end
 
+    it "can use precomputed content hashes" do
+      expect(dmp.diff_main("abc", +"abc", false, hash1: dmp.content_hash("abc"), hash2: dmp.content_hash("abc"))).to eq([equal_node("abc")])
+      expect(dmp.diff_main("abc", "ab123c", false, hash1: dmp.content_hash("abc"), hash2: dmp.content_hash("ab123c"))).to eq(dmp.diff_main("abc", "ab123c", false))
+    end
+
+    it "gives the same result with fiber_offload" do
+      diffs = dmp.diff_main("abc", "ab123c", false)
+
+      dmp.fiber_offload = true
+      expect(dmp.diff_main("abc", "ab123c", false)).to eq(diffs)
+    end
+
+    it "reports the characters resolved" do
+      a     = (1..300).map { |i| "Line #{i} of the text.\n" }.join
+      b     = a.sub("Line 3 of", "Line three of").sub("Line 200 of", "Line 200 in")
+      calls = []
+      diffs = dmp.diff_main(a, b, true, progress: ->(completed, total) { calls << [completed, total] })
+
+      expect(diffs).to eq(dmp.diff_main(a, b, true))
+      expect(calls.last).to eq([a.length + b.length, a.length + b.length])
+      expect(calls.map(&:first)).to eq(calls.map(&:first).sort)
+    end
+
+    it "counts every character once with a Progress" do
+      a        = (1..300).map { |i| "Line #{i} #{i % 7} of the text.\n" }.join
+      b        = (1..300).map { |i| "Line #{i} #{i % 5} of the text.\n" }.join
+      progress = FastDiffMatchPatch::Progress.new(->(_completed, _total) {}, a.length + b.length)
+      dmp.diff_main(a, b, true, progress: progress)
+
+      expect(progress.completed).to eq(progress.total)
+    end
+
+    it "raises with a cancelled token" do
+      token = FastDiffMatchPatch::CancellationToken.new.cancel
+      expect { dmp.diff_main("abc", "ab123c", false, cancel: token) }.to raise_error(FastDiffMatchPatch::Cancelled)
+    end
+
+    it "looks repeated pairs up in the diff_cache" do
+      expected       = dmp.diff_main("The quick brown fox.", "The quick red fox.")
+      dmp.diff_cache = FastDiffMatchPatch::DiffCache.new(1024 * 1024)
+      dmp.diff_main("The quick brown fox.", "The quick red fox.").first.text << "changed by the caller"
+
+      expect(dmp.diff_main("The quick brown fox.", "The quick red fox.")).to eq(expected)
+      expect(dmp.diff_main("The quick brown fox.", "The quick red fox.", false)).to eq(expected)
+      expect(dmp.diff_cache.stats).to include(hits: 1, misses: 2, entries: 2)
+    end
+
+    it "evicts the least recently used diffs from the diff_cache" do
+      dmp.diff_cache = FastDiffMatchPatch::DiffCache.new(400)
+      3.times { |i| dmp.diff_main("abc#{i}", "ab123c#{i}", false) }
+      dmp.diff_main("abc0", "ab123c0", false)
+
+      expect(dmp.diff_cache.stats).to include(hits: 0, misses: 4, evictions: 2, entries: 2)
+      expect(dmp.diff_cache.stats[:bytes]).to be <= 400
+    end
+
+    it "reuses the lines of a LineDictionary across revisions" do
+      dictionary = FastDiffMatchPatch::LineDictionary.new(1024 * 1024)
+      revisions  = [(1..60).map { |i| "Line #{i} of the first revision.\n" }.join]
+      3.times { |r| revisions << [2, 20, 40, 59].inject(revisions.last) { |text, i| text.sub(/^Line #{i} of .*$/, "Line #{i} of revision #{r + 2}.") } }
+
+      revisions.each_cons(2) do |text1, text2|
+        expect(dmp.diff_main(text1, text2, line_dictionary: dictionary)).to eq(dmp.diff_main(text1, text2))
+      end
+      expect(dictionary.stats).to include(evictions: 0, lines: dictionary.stats[:misses])
+      expect(dictionary.stats[:hits]).to be > 2 * dictionary.stats[:misses]
+    end
+
+    it "evicts the least recently used lines from a LineDictionary" do
+      dictionary = FastDiffMatchPatch::LineDictionary.new(2048)
+      revisions  = (0..5).map { |r| (1..40).map { |i| "Line #{i} of revision #{r}, long enough to need the line mode.\n" }.join }
+
+      revisions.each_cons(2) do |text1, text2|
+        expect(dmp.diff_main(text1, text2, line_dictionary: dictionary)).to eq(dmp.diff_main(text1, text2))
+      end
+      expect(dictionary.stats[:evictions]).to be > 0
+      expect(dictionary.stats[:bytes]).to be <= 2 * 40 * 120
+      expect(dictionary.clear.stats).to include(lines: 0, bytes: 0)
+    end
+
     it "can handel simple deletion" do
       expect(dmp.diff_main("a123bc", "abc", false)).to eq([equal_node("a"), delete_node("123"), equal_node("bc")])
     end
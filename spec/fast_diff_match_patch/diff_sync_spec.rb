@@ -0,0 +1,75 @@
+# frozen_string_literal: true
+
+require "spec_helper"
+
+RSpec.describe FastDiffMatchPatch::DiffSync do
+  let(:dmp)    { FastDiffMatchPatch.new }
+  let(:text)   { "The quick brown fox jumps over the lazy dog." }
+  let(:client) { FastDiffMatchPatch::DiffSync.new(dmp, text) }
+  let(:server) { FastDiffMatchPatch::DiffSync.new(dmp, text) }
+
+  describe "#make_message" do
+    it "encodes the changes as a delta" do
+      client.text = "The quick red fox jumps over the lazy dog."
+
+      expect(client.make_message).to eq("v:0\nd:0:=10\t-1\t=1\t-3\t+ed\t=29\n")
+      expect(client.shadow).to eq(client.text)
+      expect(client.local_version).to eq(1)
+    end
+
+    it "keeps sending unacknowledged edits" do
+      client.text = "The quick brown fox jumps."
+      client.make_message
+      client.text = "The quick ὂ᭚ fox\tjumps."
+
+      expect(client.make_message).to eq("v:0\nd:0:=25\t-18\t=1\nd:1:=10\t-5\t+%E1%BD%82%E1%AD%9A\t=4\t-1\t+%09\t=6\n")
+    end
+  end
+
+  describe "#sync" do
+    it "merges edits made on both sides" do
+      client.text = "The quick red fox jumps over the lazy dog."
+      server.text = "The quick brown fox jumps over the lazy cat."
+
+      client.receive_message(server.sync(client.make_message))
+
+      expect(client.text).to eq("The quick red fox jumps over the lazy cat.")
+      expect(server.text).to eq(client.text)
+      expect(server.remote_version).to eq(1)
+    end
+
+    it "recovers from lost messages" do
+      client.text = "The quick red fox jumps over the lazy dog."
+      client.make_message # Lost on the way
+      client.text += " Twice."
+      server.sync(client.make_message) # Reply lost
+      server.text = "A" + server.text[3..-1]
+
+      reply = server.sync(client.make_message)
+      client.receive_message(reply)
+      client.receive_message(reply) # Duplicates are skipped
+
+      expect(client.text).to eq("A quick red fox jumps over the lazy dog. Twice.")
+      expect(server.text).to eq(client.text)
+    end
+
+    it "raises on a gap in the edits" do
+      expect { client.receive_message("v:0\nd:1:=44\n") }.to raise_error(ArgumentError)
+      expect { client.receive_message("v:0\nd:0:=4\n") }.to raise_error(ArgumentError)
+      expect { client.receive_message("v:3\n") }.to raise_error(ArgumentError)
+    end
+
+    it "takes an empty or ASCII only starting text as UTF-8" do
+      client = FastDiffMatchPatch::DiffSync.new(dmp, String.new)
+      server = FastDiffMatchPatch::DiffSync.new(dmp, [].join)
+      client.text = "Zoë ὂ᭚"
+
+      client.receive_message(server.sync(client.make_message))
+      server.text = "Zoë é ὂ᭚"
+      client.receive_message(server.sync(client.make_message))
+
+      expect(client.text).to eq("Zoë é ὂ᭚")
+      expect(client.text.encoding).to eq(Encoding::UTF_8)
+    end
+  end
+end
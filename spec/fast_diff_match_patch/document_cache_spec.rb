@@ -0,0 +1,54 @@
+# frozen_string_literal: true
+
+require "spec_helper"
+require "tmpdir"
+
+RSpec.describe FastDiffMatchPatch::DocumentCache do
+  let(:dmp)   { FastDiffMatchPatch.new }
+  let(:text1) { (1..200).map { |i| "Line #{i % 50} of the text.\n" }.join }
+  let(:text2) { text1.sub("Line 3 of", "Line three of").sub("Line 20 of", "Line 20 in") + "ὂ᭚ tail" }
+
+  let(:dir)   { Dir.mktmpdir }
+
+  after { FileUtils.rm_rf(dir) }
+
+  it "tokenizes a text once and maps it on later lookups" do
+    cache    = described_class.new(dir)
+    document = cache.fetch(text1)
+
+    expect(document.line_count).to eq(200)
+    expect(document.content_hash).to eq(dmp.content_hash(text1))
+    expect(File.exist?(cache.path(document.content_hash))).to be true
+
+    mapped = cache.fetch(text1)
+    expect(mapped.text).to eq(text1)
+    expect(mapped.dump).to eq(document.dump)
+    expect(cache.lookup(dmp.content_hash(text2))).to be_nil
+  end
+
+  it "diffs documents like diff_main in line mode" do
+    cache = described_class.new(dir)
+    diffs = dmp.diff_documents(cache.fetch(text1), cache.fetch(text2))
+
+    expect(dmp.diff_text1(diffs)).to eq(text1)
+    expect(dmp.diff_text2(diffs)).to eq(text2)
+    expect(dmp.diff_levenshtein(diffs)).to eq(dmp.diff_levenshtein(dmp.diff_main(text1, text2)))
+    expect(dmp.diff_documents(cache.fetch(text1), FastDiffMatchPatch::TokenizedDocument.new(text1))).to eq([FastDiffMatchPatch::DiffNode.new(:EQUAL, text1)])
+  end
+
+  it "replaces a file holding another text under the same hash" do
+    cache = described_class.new(dir)
+    FastDiffMatchPatch::TokenizedDocument.new(text1.tr("L", "M")).write(cache.path(dmp.content_hash(text1)))
+
+    expect(cache.fetch(text1).text).to eq(text1)
+    expect(cache.lookup(dmp.content_hash(text1)).text).to eq(text1)
+  end
+
+  it "rejects corrupt files" do
+    binary = FastDiffMatchPatch::TokenizedDocument.new(text1).dump
+
+    expect { FastDiffMatchPatch::TokenizedDocument.load(binary[0...-1]) }.to raise_error(ArgumentError)
+    expect { FastDiffMatchPatch::TokenizedDocument.load("XXXX" + binary[4..-1]) }.to raise_error(ArgumentError)
+    expect(FastDiffMatchPatch::TokenizedDocument.load(binary).text).to eq(text1)
+  end
+end
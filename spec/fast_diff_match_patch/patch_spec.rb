@@ -60,6 +60,32 @@ RSpec.describe FastDiffMatchPatch do
     end
   end
 
+  describe "#patch_to_binary" do
+    let(:patches) { dmp.patch_make(text1 + " ὂ᭚", text2 + " ὂx") }
+
+    it "is smaller than the text representation" do
+      expect(dmp.patch_to_binary(patches).bytesize).to be < dmp.patch_to_text(patches).bytesize
+    end
+
+    context "when decoded with #patch_from_binary" do
+      let(:binary) { dmp.patch_to_binary(patches) }
+
+      it { expect(dmp.patch_from_binary(binary)).to eq(patches) }
+      it { expect(dmp.patch_from_binary(binary, true)).to eq(patches) }
+      it { expect(dmp.patch_from_binary(dmp.patch_to_binary([]))).to eq([]) }
+      it { expect { dmp.patch_from_binary(binary[0..-2]) }.to raise_error(ArgumentError) }
+      it { expect { dmp.patch_from_binary("@@ -1 +1 @@\n-a\n+b\n") }.to raise_error(ArgumentError) }
+      it { expect { dmp.patch_from_binary("DMP\x01\x01\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF\x01\x00\x00\x00\x00") }.to raise_error(ArgumentError) }
+      it { expect { dmp.patch_from_binary("DMP\x01\x01\x00\x00\x01\x01\x01\x06\xFF") }.to raise_error(ArgumentError) }
+      it { expect { dmp.patch_from_binary("DMP\x01\x01\x00\x00\x01\x01\x01\x06\xFF", true) }.to raise_error(ArgumentError) }
+      it { expect(dmp.patch_from_binary("DMP\x01\x01\x00\x00\x01\x01\x01\x06x")).to eq([FastDiffMatchPatch::TempPatch.new([new_insert_node("x")], 0, 0, 1, 1)]) }
+    end
+
+    it { expect { dmp.patch_to_binary([1]) }.to raise_error(TypeError) }
+    it { expect { dmp.patch_to_binary([FastDiffMatchPatch::TempPatch.new(nil, 0, 0, 0, 0)]) }.to raise_error(TypeError) }
+    it { expect { dmp.patch_to_binary([FastDiffMatchPatch::TempPatch.new([1], 0, 0, 0, 0)]) }.to raise_error(TypeError) }
+  end
+
   describe "#patch_add_context" do
     before do
       dmp.patch_margin = 4
@@ -92,6 +118,23 @@ RSpec.describe FastDiffMatchPatch do
 
       it { expect(patch_text.to_s).to eq("@@ -1,27 +1,28 @@\n Th\n-e\n+at\n  quick brown fox jumps. \n") }
     end
+
+    context "when the text repeats multibyte characters" do
+      let(:patch_text) { dmp.patch_from_text("@@ -11 +11,2 @@\n-ὂ\n+at\n").first }
+      let(:expected_patch) do
+        "@@ -1,24 +1,25 @@\n %E1%BD%82%E1%AD%9A%E1%BD%82%E1%AD%9A%E1%BD%82%E1%AD%9A%E1%BD%82%E1%AD%9A%E1%BD%82%E1%AD%9A\n" \
+          "-%E1%BD%82\n+at\n %E1%AD%9A%E1%BD%82%E1%AD%9A%E1%BD%82%E1%AD%9A%E1%BD%82%E1%AD%9A%E1%BD%82%E1%AD%9A" \
+          "%E1%BD%82%E1%AD%9A%E1%BD%82%E1%AD%9A\n"
+      end
+      before { dmp.patch_add_context(patch_text, "ὂ᭚" * 12) }
+
+      it { expect(patch_text.to_s).to eq(expected_patch) }
+    end
+
+    context "when given something other than a patch" do
+      it { expect { dmp.patch_add_context(1, "abc") }.to raise_error(TypeError) }
+      it { expect { dmp.patch_add_context(FastDiffMatchPatch::TempPatch.new(nil, 0, 0, 0, 0), "abc") }.to raise_error(TypeError) }
+    end
   end
 
   describe "#patch_make" do
@@ -187,6 +230,23 @@ RSpec.describe FastDiffMatchPatch do
       it { expect(dmp.patch_to_text(patches)).to eq(expected_patch) }
     end
 
+    context "when the sequence contains multibyte characters" do
+      let(:expected_patch) do
+        "@@ -1,32 +1,46 @@\n+X\n %E1%BD%82%E1%AD%9A\n+X\n ab\n+X\n cd\n+X\n ef\n+X\n gh\n+X\n ij\n+X\n kl\n" \
+          "+X\n mn\n+X\n op\n+X\n qr\n+X\n st\n+X\n uv\n+X\n wx\n+X\n yz0123\n@@ -25,15 +39,21 @@\n xXyz\n" \
+          "+X\n 01\n+X\n 23\n+X\n 45\n+X\n 67\n+X\n 89\n+X\n 0\n"
+      end
+
+      let(:patches) do
+        dmp.patch_make(
+          "ὂ᭚abcdefghijklmnopqrstuvwxyz01234567890",
+          "Xὂ᭚XabXcdXefXghXijXklXmnXopXqrXstXuvXwxXyzX01X23X45X67X89X0"
+        )
+      end
+
+      it { expect(dmp.patch_to_text(patches)).to eq(expected_patch) }
+    end
+
     context "when it cannot be split and reduced" do
       let!(:expected_patch) { dmp.patch_to_text(patches) }
       let(:patches) do
@@ -224,6 +284,15 @@ RSpec.describe FastDiffMatchPatch do
 
       it { expect(dmp.patch_to_text(patches)).to eq(expected_patch) }
     end
+
+    context "when given something other than patches" do
+      let(:patches) { [] }
+
+      it { expect { dmp.patch_split_max([1]) }.to raise_error(TypeError) }
+      it { expect { dmp.patch_split_max([FastDiffMatchPatch::TempPatch.new(nil, 0, 0, 100, 100)]) }.to raise_error(TypeError) }
+      it { expect { dmp.patch_split_max([FastDiffMatchPatch::TempPatch.new([1], 0, 0, 100, 100)]) }.to raise_error(TypeError) }
+      it { expect { dmp.patch_split_max([FastDiffMatchPatch::TempPatch.new([new_equal_node(nil)], 0, 0, 100, 100)]) }.to raise_error(TypeError) }
+    end
   end
 
   describe "#patch_add_padding" do
@@ -270,6 +339,8 @@ RSpec.describe FastDiffMatchPatch do
     shared_examples "has before and after expectations" do
       let(:applied_patch) { dmp.patch_apply(patches, patch_text) }
       it { expect(applied_patch).to eq(expected_results) }
+      it { expect(dmp.patch_apply(patches, patch_text, parallel: true)).to eq(expected_results) }
+      it { expect(dmp.patch_apply_batch(patches, [patch_text])).to eq([expected_results]) }
     end
 
     context "when null case occurs" do
@@ -383,6 +454,192 @@ RSpec.describe FastDiffMatchPatch do
 
       it_behaves_like "has before and after expectations"
     end
+
+    context "when patches are far apart" do
+      let(:document)         { (1..300).map { |i| "Line #{i} of the document.\n" }.join }
+      let(:edited)           { document.sub("Line 20 of", "Line twenty of").sub("Line 150 of", "Line 150 in").sub("Line 280 of", "Row 280 of") }
+      let(:patches)          { dmp.patch_make(document, edited) }
+      let(:patch_text)       { document.sub("Line 100 of", "Line 100 from").sub("Line 151 of", "Line 151 off") }
+      let(:expected_results) { [edited.sub("Line 100 of", "Line 100 from").sub("Line 151 of", "Line 151 off"), [true, true, true]] }
+
+      it_behaves_like "has before and after expectations"
+
+      it "applies the patches without falling back" do
+        prepared = Marshal.load(Marshal.dump(patches))
+        padding  = dmp.patch_add_padding(prepared)
+        dmp.patch_split_max(prepared)
+
+        expect(dmp.patch_apply_parallel(prepared, padding + patch_text + padding)).not_to be_nil
+      end
+    end
+
+    it "applies a fuzzy match at the end of the text in parallel like in sequence" do
+      patches = dmp.patch_from_text("@@ -5,13 +5,13 @@\n eanf\n- \n %C3%A9a%5C%C3%A9%5C\n+%5C\n fbb\n")
+      text    = "bὂaffeanf éafé"
+
+      expect(dmp.patch_apply(patches, text, parallel: true)).to eq(dmp.patch_apply(patches, text))
+    end
+
+    it "raises in parallel like in sequence for a text the patches can't be joined with" do
+      patches = dmp.patch_make("The quick brown fox é", "The quick brown fox é!")
+      text    = "The quick brown fox \xE9".dup.force_encoding("ISO-8859-1")
+
+      expect { dmp.patch_apply(patches, text) }.to raise_error(Encoding::CompatibilityError)
+      expect { dmp.patch_apply(patches, text, parallel: true) }.to raise_error(Encoding::CompatibilityError)
+      expect { dmp.patch_apply_parallel([1], text) }.to raise_error(TypeError)
+    end
+
+    it "reports the patches processed" do
+      patches = dmp.patch_make(text1, text2)
+      calls   = []
+      dmp.patch_apply(patches, text1, progress: ->(completed, total) { calls << [completed, total] })
+
+      expect(calls.first).to eq([1, patches.length])
+      expect(calls.last).to eq([patches.length, patches.length])
+    end
+  end
+
+  describe "#patch_apply_batch" do
+    let(:patches) { dmp.patch_make("The quick brown fox jumps over the lazy dog.", "That quick brown fox jumped over a lazy dog.") }
+    let(:texts) do
+      [
+        "The quick brown fox jumps over the lazy dog.",
+        "The quick red rabbit jumps over the tired tiger.",
+        "I am the very model of a modern major general.",
+        "The quick brown fox jumps over the lazy dog. Zoë says hi."
+      ]
+    end
+
+    it "applies the patches to every text like patch_apply" do
+      expect(dmp.patch_apply_batch(patches, texts)).to eq(texts.map { |text| dmp.patch_apply(patches, text) })
+    end
+
+    it "returns the texts unchanged without patches" do
+      expect(dmp.patch_apply_batch([], texts)).to eq(texts.map { |text| [text, []] })
+    end
+
+    it "can add the content hash of the patched texts" do
+      expect(dmp.patch_apply_batch(patches, texts, checksum: true)).to eq(texts.map { |text| dmp.patch_apply(patches, text, checksum: true) })
+      expect(dmp.patch_apply(patches, texts[0], checksum: true)[2]).to eq(dmp.content_hash("That quick brown fox jumped over a lazy dog."))
+    end
+
+    it "does not modify the patches" do
+      expect { dmp.patch_apply_batch(patches, texts) }.not_to(change { dmp.patch_to_text(patches) })
+    end
+
+    it "applies a fuzzy match at the end of the text like patch_apply" do
+      patches = dmp.patch_from_text("@@ -5,13 +5,13 @@\n eanf\n- \n %C3%A9a%5C%C3%A9%5C\n+%5C\n fbb\n")
+      text    = "bὂaffeanf éafé"
+
+      expect(dmp.patch_apply_batch(patches, [text])).to eq([dmp.patch_apply(patches, text)])
+    end
+
+    it "raises on texts that aren't strings" do
+      expect { dmp.patch_apply_batch(patches, [texts[0], nil]) }.to raise_error(TypeError)
+    end
+
+    it "raises like patch_apply for a text the patches can't be joined with" do
+      patches = dmp.patch_make("The quick brown fox é", "The quick brown fox é!")
+      text    = "The quick brown fox \xE9".dup.force_encoding("ISO-8859-1")
+
+      expect { dmp.patch_apply_batch(patches, ["The quick brown fox é", text]) }.to raise_error(Encoding::CompatibilityError)
+    end
+  end
+
+  describe "#patch_compose" do
+    let(:text1) { (1..40).map { |i| "Line #{i} of the draft.\n" }.join }
+    let(:text2) { text1.sub("Line 3 of", "Line three of").sub("Line 30 of", "Line 30 in") }
+    let(:text3) { text2.sub("Line three of the", "Line 3 of a").sub("Line 20 of", "Row 20 of").sub("in the draft", "in ὂ᭚") }
+
+    it "composes patch lists into one taking the first text to the last one" do
+      patches = dmp.patch_compose(dmp.patch_make(text1, text2), dmp.patch_make(text2, text3))
+
+      expect(dmp.patch_apply(patches, text1)).to eq([text3, [true, true, true]])
+    end
+
+    it "composes patch lists which were split" do
+      first  = dmp.patch_make(text1, text1.sub("Line 5 of the draft.\n", "A much longer line " * 10))
+      second = dmp.patch_make(dmp.patch_apply(first, text1)[0], text1)
+      dmp.patch_split_max(first)
+      dmp.patch_split_max(second)
+
+      expect(dmp.patch_compose(first, second)).to eq([])
+    end
+
+    it "composes diff lists" do
+      diffs = dmp.patch_compose(dmp.diff_main(text1, text2), dmp.diff_main(text2, text3))
+
+      expect([dmp.diff_text1(diffs), dmp.diff_text2(diffs)]).to eq([text1, text3])
+    end
+
+    it "cancels out text inserted and deleted again" do
+      first  = [new_equal_node("ab"), new_insert_node("XYZ"), new_equal_node("cd")]
+      second = [new_equal_node("abX"), new_delete_node("YZ"), new_equal_node("cd")]
+
+      expect(dmp.patch_compose(first, second)).to eq([new_equal_node("ab"), new_insert_node("X"), new_equal_node("cd")])
+    end
+
+    it "raises when given a diff list and a patch list" do
+      expect { dmp.patch_compose(dmp.diff_main(text1, text2), dmp.patch_make(text2, text3)) }.to raise_error(ArgumentError)
+    end
+  end
+
+  describe "#patch_transform" do
+    let(:base)   { (1..40).map { |i| "Line #{i} of the draft.\n" }.join }
+    let(:mine)   { base.sub("Line 3 of", "Line three of").sub("Line 30 of", "Line 30 in") }
+    let(:theirs) { base.sub("Line 10 of the", "Line 10 of ὂ᭚").sub("Line 35 of", "Row 35 of") }
+    let(:merged) { mine.sub("Line 10 of the", "Line 10 of ὂ᭚").sub("Line 35 of", "Row 35 of") }
+
+    it "rewrites the second patch list against the text of the first one" do
+      patches = dmp.patch_transform(dmp.patch_make(base, mine), dmp.patch_make(base, theirs))
+      dmp.match_threshold = 0.0
+      dmp.match_distance  = 0
+
+      expect(dmp.patch_apply(patches, mine)).to eq([merged, [true, true]])
+    end
+
+    it "rewrites diff lists" do
+      diffs = dmp.patch_transform(dmp.diff_main(base, mine), dmp.diff_main(base, theirs))
+
+      expect([dmp.diff_text1(diffs), dmp.diff_text2(diffs)]).to eq([mine, merged])
+    end
+
+    it "keeps the insertions of the first list ahead" do
+      first  = [new_equal_node("ab"), new_insert_node("X"), new_equal_node("cd")]
+      second = [new_equal_node("ab"), new_insert_node("Y"), new_delete_node("c"), new_equal_node("d")]
+
+      expect(dmp.patch_transform(first, second)).to eq([new_equal_node("abX"), new_delete_node("c"), new_insert_node("Y"), new_equal_node("d")])
+    end
+  end
+
+  describe "#patch_invert" do
+    let(:text1) { (1..40).map { |i| "Line #{i} of the draft.\n" }.join }
+    let(:text2) { text1.sub("Line 3 of", "Line three of").sub("Line 20 of the", "Line 20 of ὂ᭚").sub("Line 30 of the draft.\n", "") }
+    let(:patches) { dmp.patch_make(text1, text2) }
+
+    it "reverts the patches" do
+      dmp.match_threshold = 0.0
+      dmp.match_distance  = 0
+
+      expect(dmp.patch_apply(dmp.patch_invert(patches), text2)).to eq([text1, [true, true, true]])
+    end
+
+    it "swaps insertions and deletions" do
+      inverted = dmp.patch_invert([FastDiffMatchPatch::TempPatch.new([new_equal_node("ab"), new_insert_node("X"), new_delete_node("cd")], 0, 0, 4, 3)])
+
+      expect(inverted).to eq([FastDiffMatchPatch::TempPatch.new([new_equal_node("ab"), new_delete_node("X"), new_insert_node("cd")], 0, 0, 3, 4)])
+    end
+
+    it "reverts patches sharing context" do
+      patches = dmp.patch_make(text1, text1.sub("Line 5 of the draft.\n", "A much longer line " * 10))
+      dmp.patch_split_max(patches)
+
+      expect(dmp.patch_apply(dmp.patch_invert(patches), dmp.patch_apply(patches, text1)[0])[0]).to eq(text1)
+    end
+
+    it "is undone by inverting again" do
+      expect(dmp.patch_apply(dmp.patch_invert(dmp.patch_invert(patches)), text1)[0]).to eq(text2)
+    end
   end
 
   def new_delete_node(text)
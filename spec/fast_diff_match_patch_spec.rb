@@ -4,4 +4,56 @@ RSpec.describe FastDiffMatchPatch do
   it "has a version number" do
     expect(FastDiffMatchPatch::VERSION).not_to be nil
   end
+
+  it "diffs in parallel Ractors", if: defined?(Ractor) do
+    dmp = Ractor.make_shareable(FastDiffMatchPatch.new)
+
+    ractors = 2.times.map do |i|
+      Ractor.new(dmp, i) do |shared, n|
+        text1 = "The quick brown fox #{n} jumps over the lazy dog.\n" * 20
+        text2 = text1.sub("lazy", "sleepy")
+
+        shared.patch_apply(shared.patch_make(text1, text2), text1).first == text2
+      end
+    end
+
+    expect(ractors.map(&:take)).to eq([true, true])
+  end
+
+  describe ".configure" do
+    let(:dmp)   { FastDiffMatchPatch.new }
+    let(:pairs) { Array.new(8) { |i| ["The quick brown fox #{i} jumps.", "The slow brown fox #{i} jumped."] } }
+
+    after { FastDiffMatchPatch.configure(threads: :auto, min_parallel_size: 2048) }
+
+    it "sizes the shared thread pool" do
+      FastDiffMatchPatch.configure(threads: 3, min_parallel_size: 0)
+      expected = pairs.map { |text1, text2| dmp.diff_main(text1, text2, false) }
+
+      expect(dmp.diff_batch(pairs)).to eq(expected)
+      expect(FastDiffMatchPatch.pool_stats).to eq(threads: 3, workers: 2, active_workers: 0, queued_jobs: 0, queue_depth: 0, min_parallel_size: 0)
+
+      FastDiffMatchPatch.configure(threads: 1)
+      expect(dmp.diff_batch(pairs)).to eq(expected)
+      expect(FastDiffMatchPatch.pool_stats[:threads]).to eq(1)
+    end
+
+    it "restarts the pool in forked children", if: Process.respond_to?(:fork) do
+      FastDiffMatchPatch.configure(threads: 3)
+      dmp.diff_batch(pairs)
+
+      pid = fork do
+        diffs = dmp.diff_batch(pairs)
+        exit!(diffs.length == 8 && FastDiffMatchPatch.pool_stats[:workers] == 2)
+      end
+      Process.wait(pid)
+
+      expect($?.success?).to be true
+    end
+
+    it "raises on invalid settings" do
+      expect { FastDiffMatchPatch.configure(threads: 0) }.to raise_error(ArgumentError)
+      expect { FastDiffMatchPatch.configure(min_parallel_size: -1) }.to raise_error(ArgumentError)
+    end
+  end
 end